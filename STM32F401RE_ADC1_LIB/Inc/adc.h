@@ -16,6 +16,23 @@
 #ifndef ADC_H_
 #define ADC_H_
 #include "gpio.h"
+#include "dma.h"
+#include "timer.h"
+#include <stdint.h>
+
+//ADCCLK can't be above 36MHz (with VDDA 2.4-3.6V), Table 67 in Datasheet
+#define ADC_CLK_MAX				36000000
+
+//a 12 bit conversion takes 12 ADCCLK cycles on top of the sample time, 11.5 in Ref Manual
+#define ADC_CONVERSION_CYCLES	12
+
+//longest regular sequence, 11.12.9 in Ref Manual
+#define ADC_MAX_SCAN_CHANNELS	16
+
+//longest period (in counts) of the 16 bit timers (TIM3/TIM4), TIM2/TIM5 are 32 bit
+//but TIM2_5_CONFIG.PERIOD is an int
+#define ADC_TRIGGER_PERIOD_MAX_16	65536
+#define ADC_TRIGGER_PERIOD_MAX_32	0x7FFFFFFF
 /*
  * Enumeration for differentiating between ADC channels
  *
@@ -77,6 +94,41 @@ typedef enum
 	ADC_SQ16
 }ADC_SQ;
 
+/*
+ * Enumeration for the sampling time of a channel, in ADCCLK cycles.
+ * Longer sampling is needed for sources with a higher impedance, and
+ * the temperature sensor/VREF need at least 10us (Table 70/71 in Datasheet)
+ *
+ * SMPx bits, 11.12.4/11.12.5 in Ref Manual
+ */
+typedef enum
+{
+	ADC_SAMPLE_3,
+	ADC_SAMPLE_15,
+	ADC_SAMPLE_28,
+	ADC_SAMPLE_56,
+	ADC_SAMPLE_84,
+	ADC_SAMPLE_112,
+	ADC_SAMPLE_144,
+	ADC_SAMPLE_480
+}ADC_SAMPLE_TIME;
+
+/*
+ * Timer event that starts a conversion (of the whole sequence in scan mode)
+ *
+ * TRGO is the update event (the timer wrapping), CCx is the compare
+ * match on channel x. Not every timer has every event wired to the
+ * ADC, see adc_trigger_extsel().
+ */
+typedef enum
+{
+	ADC_TRIGGER_TRGO,
+	ADC_TRIGGER_CC1,
+	ADC_TRIGGER_CC2,
+	ADC_TRIGGER_CC3,
+	ADC_TRIGGER_CC4
+}ADC_TRIGGER_EVENT;
+
 /*
  * Struct to configure mode, sequence number
  * and channel number for ADC
@@ -88,8 +140,59 @@ typedef struct
 	int SEQ_LENGTH;
 }ADC_CONFIG;
 
+/*
+ * One channel of a scan, in the order it is converted
+ */
+typedef struct
+{
+	ADC_CH CHANNEL;
+	ADC_SAMPLE_TIME SAMPLE_TIME;
+}ADC_SCAN_CHANNEL;
+
+//callback for when half of the scan buffer is full, samples points at that half (count samples,
+//whole sequences in channel order) and stays valid until the DMA comes back around to it
+typedef void (*ADC_SCAN_CALLBACK)(void* context, volatile uint16_t* samples, uint16_t count);
+
+/*
+ * Struct for ADC1 scanning a sequence of channels over and over
+ * into a circular buffer through DMA
+ *
+ * Before adc_scan_init() the caller sets CHANNELS/CHANNEL_COUNT (up to
+ * ADC_MAX_SCAN_CHANNELS), BUFFER/BUFFER_SIZE (in samples, a multiple of
+ * 2 * CHANNEL_COUNT so each half holds whole sequences), STREAM (ADC1 is
+ * on DMA2 stream 0 or 4, channel 0, Table 28 in Ref Manual), and
+ * CALLBACK/CONTEXT (CALLBACK can be NULL).
+ *
+ * Everything else is filled in by adc_scan_init(). HALVES counts the
+ * halves handed to the callback, OVERRUNS the times the DMA fell behind
+ * the ADC and the scan had to be restarted.
+ */
+typedef struct
+{
+	const ADC_SCAN_CHANNEL* CHANNELS;
+	uint8_t CHANNEL_COUNT;
+	volatile uint16_t* BUFFER;
+	uint16_t BUFFER_SIZE;
+	DMA_STREAM_NUM STREAM;
+	ADC_SCAN_CALLBACK CALLBACK;
+	void* CONTEXT;
+	DMA_CONFIG DMA;
+	volatile uint32_t HALVES;
+	volatile uint32_t OVERRUNS;
+}ADC_SCAN;
+
 void adc_init(ADC_CONFIG adc);//function to configure adc based on given sequence number, channel number, mode and length
 void adc_start_single(void);//function to start the single conversion of the channels using software
 void adc_start_continuous(void);//function to start the continuous conversion of the channels using software
 uint32_t adc_read(void);//function to wait until the conversion is complete, and return value contained in data register if not
+void adc_clock_init(void);//function to set the ADC prescaler for the fastest ADCCLK within spec
+uint32_t adc_get_clock(void);//function to return ADCCLK in Hz
+int adc_scan_init(ADC_SCAN* scan);//function to set up ADC1 to scan a sequence of channels into a circular buffer through DMA, returns -1 if the scan is invalid
+void adc_scan_start(ADC_SCAN* scan);//function to start scanning, the ADC and DMA keep going on their own until adc_scan_stop()
+void adc_scan_stop(ADC_SCAN* scan);//function to stop scanning
+uint32_t adc_scan_rate(const ADC_SCAN* scan);//function to return the number of times per second the whole sequence is converted
+int adc_trigger_extsel(TIM_TypeDef* TMR, ADC_TRIGGER_EVENT event);//function to return the EXTSEL value for a timer event, -1 if it can't trigger the ADC
+int adc_trigger_timing(uint32_t timerClk, uint32_t rate, uint32_t maxPeriod, TIM2_5_CONFIG* timer);//function to work out PRESCALER and PERIOD for a trigger rate in Hz, returns 1 if the rate is exact, 0 if it is the closest that can be made, -1 if it can't be made
+int adc_trigger_init(TIM2_5_CONFIG* timer, ADC_TRIGGER_EVENT event, uint32_t rate);//function to start conversions from a TIM2-5 event at the given rate in Hz, returns -1 if it can't be set up (see adc_trigger_timing() for the rest)
+void adc_trigger_disable(void);//function to go back to starting conversions from software
 #endif /* ADC_H_ */
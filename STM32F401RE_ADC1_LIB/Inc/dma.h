@@ -0,0 +1,170 @@
+/**
+ ******************************************************************************
+ * @file           : dma.h
+ * @author         : Nubal Manhas
+ * @brief          : Header file for DMA library
+ ******************************************************************************
+ * @purpose
+ *
+ * The purpose of this file is to declare functions, enums, and structs, that
+ * will support the creation of a library for DMA functionality for the
+ * STM32F01RE MCU
+ *
+ ******************************************************************************
+ */
+
+#ifndef DMA_H_
+#define DMA_H_
+#include "stm32f401xe.h"
+#include <stdint.h>
+
+/*
+ * Events that can be passed to a DMA callback, more
+ * than one can be set at a time
+ *
+ * 9.5.1/9.5.2 in Ref Manual for the flags behind these
+ */
+#define DMA_EVENT_HALF_TRANSFER		(1U<<0)
+#define DMA_EVENT_TRANSFER_COMPLETE	(1U<<1)
+#define DMA_EVENT_ERROR				(1U<<2)
+
+/*
+ * Each DMA controller has 8 streams
+ *
+ * 9.3.5 in Ref Manual
+ */
+typedef enum
+{
+	DMA_STREAM0,
+	DMA_STREAM1,
+	DMA_STREAM2,
+	DMA_STREAM3,
+	DMA_STREAM4,
+	DMA_STREAM5,
+	DMA_STREAM6,
+	DMA_STREAM7
+}DMA_STREAM_NUM;
+
+/*
+ * Each stream selects one of 8 channels for its request,
+ * which peripheral is on which channel/stream can be seen in
+ * Table 27 (DMA1) and Table 28 (DMA2) in Ref Manual
+ */
+typedef enum
+{
+	DMA_CH0,
+	DMA_CH1,
+	DMA_CH2,
+	DMA_CH3,
+	DMA_CH4,
+	DMA_CH5,
+	DMA_CH6,
+	DMA_CH7
+}DMA_CHANNEL;
+
+/*
+ * Data transfer direction (DIR bits)
+ *
+ * 9.5.5 in Ref Manual
+ */
+typedef enum
+{
+	DMA_PERIPH_TO_MEMORY,
+	DMA_MEMORY_TO_PERIPH,
+	DMA_MEMORY_TO_MEMORY
+}DMA_DIRECTION;
+
+/*
+ * Data size for the peripheral and memory side (PSIZE/MSIZE bits)
+ *
+ * 9.5.5 in Ref Manual
+ */
+typedef enum
+{
+	DMA_SIZE_BYTE,
+	DMA_SIZE_HALF_WORD,
+	DMA_SIZE_WORD
+}DMA_DATA_SIZE;
+
+/*
+ * Priority level between streams on the same controller (PL bits)
+ *
+ * 9.5.5 in Ref Manual
+ */
+typedef enum
+{
+	DMA_PRIORITY_LOW,
+	DMA_PRIORITY_MEDIUM,
+	DMA_PRIORITY_HIGH,
+	DMA_PRIORITY_VERY_HIGH
+}DMA_PRIORITY;
+
+/*
+ * Normal mode stops once NDTR reaches 0, circular
+ * mode reloads NDTR and starts over (CIRC bit)
+ *
+ * 9.3.9 in Ref Manual
+ */
+typedef enum
+{
+	DMA_NORMAL,
+	DMA_CIRCULAR
+}DMA_MODE;
+
+/*
+ * Callback for DMA interrupts, context is whatever was given
+ * when the interrupt was enabled and events is a mask of
+ * the DMA_EVENT_x values above
+ */
+typedef void (*DMA_CALLBACK)(void* context, uint32_t events);
+
+/*
+ * Struct to configure a DMA stream
+ *
+ * MEM_INCREMENT = 1 increments the memory address after
+ * every transfer, 0 keeps writing/reading the same address
+ */
+typedef struct
+{
+	DMA_TypeDef* DMA;
+	DMA_STREAM_NUM STREAM;
+	DMA_CHANNEL CHANNEL;
+	DMA_DIRECTION DIRECTION;
+	DMA_DATA_SIZE PERIPH_SIZE;
+	DMA_DATA_SIZE MEM_SIZE;
+	DMA_PRIORITY PRIORITY;
+	DMA_MODE MODE;
+	int MEM_INCREMENT;
+}DMA_CONFIG;
+
+//function to return the register block for the configured stream
+DMA_Stream_TypeDef* dma_get_stream(DMA_CONFIG dma);
+
+//function to initialize a DMA stream, the stream is left disabled
+void dma_init(DMA_CONFIG dma);
+
+//function to start a transfer of count items between the peripheral and memory address
+void dma_start(DMA_CONFIG dma, uint32_t periphAddr, uint32_t memAddr, uint16_t count);
+
+//function to disable a stream and wait for it to stop
+void dma_stop(DMA_CONFIG dma);
+
+//function to check if a stream is still enabled
+int dma_busy(DMA_CONFIG dma);
+
+//function to return the number of items left to transfer (NDTR)
+uint16_t dma_remaining(DMA_CONFIG dma);
+
+//function to clear all interrupt flags for a stream
+void dma_clear_flags(DMA_CONFIG dma);
+
+//function to enable the given events as interrupts, and register a callback for them
+void dma_interrupt_enable(DMA_CONFIG dma, uint32_t events, DMA_CALLBACK callback, void* context);
+
+//function to disable all interrupts for a stream
+void dma_interrupt_disable(DMA_CONFIG dma);
+
+//function to handle a DMA stream interrupt, called from the DMAx_Streamy_IRQHandler's in dma.c
+void dma_irq_handler(DMA_TypeDef* DMA, DMA_STREAM_NUM stream);
+
+#endif /* DMA_H_ */
@@ -12,13 +12,42 @@
  ******************************************************************************
  */
 #include "adc.h"
+#include "rcc.h"
+#include <stddef.h>
 
 #define MAX_SQR_BITS	30 //number of configurable SQRx Register bits
 #define MAX_SEQ_LENGTH  15 //max number of ADC conversions per sequence
+#define SMPR_BITS		3  //bits per channel in SMPR1/SMPR2
+#define SMPR2_CHANNELS	10 //channels 0-9 are in SMPR2, 10-18 in SMPR1
+
+//sampling time in ADCCLK cycles for each ADC_SAMPLE_TIME, 11.12.4 in Ref Manual
+static const uint16_t SAMPLE_CYCLES[8] = {3, 15, 28, 56, 84, 112, 144, 480};
+
+//scan that ADC_IRQHandler restarts after an overrun
+static ADC_SCAN* activeScan = NULL;
+
+//EXTSEL/EXTEN taken off by adc_scan_stop(), put back by adc_scan_start()
+static uint32_t pausedTrigger = 0;
+
+//EXTSEL value for each timer event, -1 where the event isn't wired to the ADC
+//11.12.3 in Ref Manual, in ADC_TRIGGER_EVENT order (TRGO, CC1-CC4)
+static const int8_t TIM2_EXTSEL[5] = {6, -1, 3, 4, 5};
+static const int8_t TIM3_EXTSEL[5] = {8, 7, -1, -1, -1};
+static const int8_t TIM4_EXTSEL[5] = {-1, -1, -1, -1, 9};
+static const int8_t TIM5_EXTSEL[5] = {-1, 10, 11, 12, -1};
 
 //function to help configure what sequences to set the conversion to
 void sequence_config(ADC_CONFIG adc);
 
+//function to set up the pin (or internal source) for a channel
+void adc_channel_init(ADC_CH channel);
+
+//function to hand the finished half of the scan buffer to the callback, called by the DMA interrupt
+void adc_scan_dma_callback(void* context, uint32_t events);
+
+//function to start the DMA stream of a scan from the beginning of its buffer
+void adc_scan_dma_start(ADC_SCAN* scan);
+
 /*
  * Function for initializing adc based on the configurable ADC structure
  *
@@ -28,38 +57,13 @@ void sequence_config(ADC_CONFIG adc);
  */
 void adc_init(ADC_CONFIG adc)
 {
-	//setup GPIO for analog mode
-	GPIOx_PIN_CONFIG GPIO;
-	GPIO.PIN_MODE = GPIOx_PIN_ANALOG;
-	GPIO.PUPDR_MODE = GPIOx_PUPDR_NONE;
-	GPIO.OTYPER_MODE = GPIOx_OTYPER_PUSH_PULL;
-
-	//init gpio based on channel number
-	//Table 8. in datasheet to see mapping
-	if(adc.CHANNEL <= 7)
-	{
-		//PA0-PA7 = ADC_IN0-ADC_IN7
-		GPIO.PIN_NUM = adc.CHANNEL;
-		gpio_init(GPIOA, GPIO);
-
-	}
-	else if(adc.CHANNEL > 7 && adc.CHANNEL < 10)
-	{
-		//PB0-PB1 = ADC8-AD9
-		GPIO.PIN_NUM = adc.CHANNEL - 8;
-		gpio_init(GPIOB, GPIO);
-	}
-	else
-	{
-		//PC0-PC5 = ADC10-ADC15
-		GPIO.PIN_NUM = adc.CHANNEL - 10;
-		gpio_init(GPIOC, GPIO);
-	}
-
 	//ADC1 clock access is from APB2 bus
 	//Figure 3. in datasheet
 	RCC->APB2ENR |= RCC_APB2ENR_ADC1EN;
 
+	//setup the pin for analog mode
+	adc_channel_init(adc.CHANNEL);
+
 	//setup for conversion sequence
 	sequence_config(adc);
 
@@ -154,3 +158,510 @@ uint32_t adc_read(void)
 	while(!(ADC1->SR & ADC_SR_EOC)); //wait for completion, based on Section 11.12.1 in Reference Manual
 	return (ADC1->DR); //return data read from data register, based on Section 11.12.14 in Reference Manual
 }
+
+/*
+ * Function to set up the pin for a channel in analog mode
+ *
+ * Channels 16-18 aren't on pins, they are the temperature sensor and
+ * VREFINT, which are turned on with TSVREFE instead (11.10 in Ref Manual)
+ */
+void adc_channel_init(ADC_CH channel)
+{
+	//setup GPIO for analog mode
+	GPIOx_PIN_CONFIG GPIO;
+	GPIO.PIN_MODE = GPIOx_PIN_ANALOG;
+	GPIO.ALT_FUNC = GPIOx_ALT_AF0;
+	GPIO.PUPDR_MODE = GPIOx_PUPDR_NONE;
+	GPIO.OTYPER_MODE = GPIOx_OTYPER_PUSH_PULL;
+
+	//init gpio based on channel number
+	//Table 8. in datasheet to see mapping
+	if(channel <= 7)
+	{
+		//PA0-PA7 = ADC_IN0-ADC_IN7
+		GPIO.PIN_NUM = channel;
+		gpio_init(GPIOA, GPIO);
+
+	}
+	else if(channel > 7 && channel < 10)
+	{
+		//PB0-PB1 = ADC8-AD9
+		GPIO.PIN_NUM = channel - 8;
+		gpio_init(GPIOB, GPIO);
+	}
+	else if(channel < ADC_CH16)
+	{
+		//PC0-PC5 = ADC10-ADC15
+		GPIO.PIN_NUM = channel - 10;
+		gpio_init(GPIOC, GPIO);
+	}
+	else
+	{
+		ADC1_COMMON->CCR |= ADC_CCR_TSVREFE;
+	}
+}
+
+/*
+ * Function to set the ADC prescaler
+ *
+ * ADCCLK is PCLK2 / 2, 4, 6 or 8 (ADCPRE), the smallest divider that
+ * keeps it at or under ADC_CLK_MAX is picked. At 16MHz (HSI) that is
+ * /2 = 8MHz, at 84MHz it is /4 = 21MHz (/2 would be 42MHz).
+ *
+ * 11.12.16 in Ref Manual
+ */
+void adc_clock_init(void)
+{
+	uint32_t pclk2 = rcc_get_pclk2();
+	uint32_t adcpre = 0;
+
+	while(adcpre < 3 && pclk2 / ((adcpre + 1) * 2) > ADC_CLK_MAX)
+	{
+		adcpre++;
+	}
+
+	ADC1_COMMON->CCR = (ADC1_COMMON->CCR & ~ADC_CCR_ADCPRE) | (adcpre << ADC_CCR_ADCPRE_Pos);
+}
+
+/*
+ * Function to return ADCCLK in Hz, from PCLK2 and ADCPRE
+ */
+uint32_t adc_get_clock(void)
+{
+	uint32_t adcpre = (ADC1_COMMON->CCR & ADC_CCR_ADCPRE) >> ADC_CCR_ADCPRE_Pos;
+
+	return rcc_get_pclk2() / ((adcpre + 1) * 2);
+}
+
+/*
+ * Function to set up a scan of a sequence of channels
+ *
+ * ADC1 is put in scan mode (SCAN), so each trigger converts the whole
+ * sequence in SQR1-SQR3, and in continuous mode (CONT) so the next
+ * sequence starts straight after. DMA = 1 with DDS = 1 has the ADC ask
+ * for a DMA transfer after every conversion for as long as it runs, and
+ * the stream writes each result into the next slot of the circular
+ * buffer. The DMA interrupt at each half hands that half to the callback
+ * while the other half is being filled, so the CPU isn't involved in
+ * any of the conversions.
+ *
+ * With the shortest sample time a conversion takes 15 ADCCLK cycles, so
+ * at ADCCLK = 36MHz (PCLK2 = 72MHz) this can get to 2.4Msps. At 84MHz
+ * ADCCLK is 21MHz (see adc_clock_init()), so the most is 1.4Msps.
+ *
+ * -1 is returned, and nothing is touched, if the channels, buffer
+ * or stream are invalid
+ *
+ * 11.3.7, 11.8 and 11.12 in Ref Manual
+ */
+int adc_scan_init(ADC_SCAN* scan)
+{
+	uint32_t sqr[3] = {0, 0, 0};
+	uint32_t smpr1 = 0;
+	uint32_t smpr2 = 0;
+
+	if(scan->CHANNEL_COUNT == 0 || scan->CHANNEL_COUNT > ADC_MAX_SCAN_CHANNELS || scan->BUFFER == NULL ||
+	   scan->BUFFER_SIZE == 0 || scan->BUFFER_SIZE % (2 * scan->CHANNEL_COUNT) != 0 ||
+	   (scan->STREAM != DMA_STREAM0 && scan->STREAM != DMA_STREAM4))
+	{
+		return -1;
+	}
+
+	for(uint8_t i = 0; i < scan->CHANNEL_COUNT; i++)
+	{
+		if(scan->CHANNELS[i].CHANNEL > ADC_CH18)
+		{
+			return -1;
+		}
+	}
+
+	//ADC1 clock access is from APB2 bus
+	//Figure 3. in datasheet
+	RCC->APB2ENR |= RCC_APB2ENR_ADC1EN;
+
+	//the ADC has to be off while it is being set up
+	ADC1->CR2 &= ~(ADC_CR2_ADON | ADC_CR2_CONT | ADC_CR2_DMA | ADC_CR2_DDS);
+
+	adc_clock_init();
+
+	//same layout as sequence_config(), SQ1 in the bottom of SQR3 up to SQ16
+	//in SQR1, 5 bits each. the sample time goes with the channel, not its
+	//place in the sequence, 3 bits each in SMPR2 (0-9) and SMPR1 (10-18)
+	for(uint8_t i = 0; i < scan->CHANNEL_COUNT; i++)
+	{
+		ADC_CH channel = scan->CHANNELS[i].CHANNEL;
+		uint32_t smp = scan->CHANNELS[i].SAMPLE_TIME;
+		int seq = i * 5;
+
+		adc_channel_init(channel);
+
+		sqr[seq / MAX_SQR_BITS] |= (channel << (seq % MAX_SQR_BITS));
+
+		if(channel < SMPR2_CHANNELS)
+		{
+			smpr2 |= smp << (channel * SMPR_BITS);
+		}
+		else
+		{
+			smpr1 |= smp << ((channel - SMPR2_CHANNELS) * SMPR_BITS);
+		}
+	}
+
+	ADC1->SQR3 = sqr[0];
+	ADC1->SQR2 = sqr[1];
+	ADC1->SQR1 = sqr[2] | ((scan->CHANNEL_COUNT - 1) << ADC_SQR1_L_Pos);
+	ADC1->SMPR1 = smpr1;
+	ADC1->SMPR2 = smpr2;
+
+	//scan the sequence, and interrupt on an overrun (the DMA didn't
+	//read DR before the next conversion finished)
+	ADC1->CR1 |= ADC_CR1_SCAN | ADC_CR1_OVRIE;
+	ADC1->CR2 |= ADC_CR2_CONT | ADC_CR2_DMA | ADC_CR2_DDS;
+
+	//ADC1 is on channel 0 of DMA2 stream 0/4, Table 28 in Ref Manual
+	scan->DMA.DMA = DMA2;
+	scan->DMA.STREAM = scan->STREAM;
+	scan->DMA.CHANNEL = DMA_CH0;
+	scan->DMA.DIRECTION = DMA_PERIPH_TO_MEMORY;
+	scan->DMA.PERIPH_SIZE = DMA_SIZE_HALF_WORD;
+	scan->DMA.MEM_SIZE = DMA_SIZE_HALF_WORD;
+	scan->DMA.PRIORITY = DMA_PRIORITY_VERY_HIGH;
+	scan->DMA.MODE = DMA_CIRCULAR;
+	scan->DMA.MEM_INCREMENT = 1;
+	dma_init(scan->DMA);
+	dma_interrupt_enable(scan->DMA, DMA_EVENT_HALF_TRANSFER | DMA_EVENT_TRANSFER_COMPLETE, adc_scan_dma_callback, scan);
+
+	scan->HALVES = 0;
+	scan->OVERRUNS = 0;
+
+	//ADC global interrupt for the overrun
+	NVIC->ISER[ADC_IRQn >> 5] |= (1U << (ADC_IRQn & 0x1F));
+
+	ADC1->CR2 |= ADC_CR2_ADON;
+
+	return 0;
+}
+
+/*
+ * Function to start the DMA stream of a scan from the start of
+ * its buffer, so the samples stay lined up with the sequence
+ */
+void adc_scan_dma_start(ADC_SCAN* scan)
+{
+	dma_start(scan->DMA, (uint32_t)&ADC1->DR, (uint32_t)scan->BUFFER, scan->BUFFER_SIZE);
+}
+
+/*
+ * Function to start scanning
+ *
+ * One software start is enough, CONT starts every
+ * sequence after that by itself. If adc_trigger_init() has been
+ * called only the DMA is started here, and each sequence is started
+ * by the timer once it is enabled.
+ *
+ * OVR and EOC are rc_w0, so they are cleared by writing 0 to them
+ * and 1 to the rest.
+ *
+ * 11.3.5 in Ref Manual
+ */
+void adc_scan_start(ADC_SCAN* scan)
+{
+	activeScan = scan;
+
+	adc_scan_dma_start(scan);
+
+	ADC1->SR = ~(ADC_SR_OVR | ADC_SR_EOC);
+
+	//the trigger adc_scan_stop() took off, only once the DMA is ready for it
+	ADC1->CR2 |= pausedTrigger;
+	pausedTrigger = 0;
+
+	//a timer trigger starts each sequence instead (see adc_trigger_init())
+	if(ADC1->CR2 & ADC_CR2_EXTEN)
+	{
+		return;
+	}
+
+	ADC1->CR2 |= ADC_CR2_CONT;
+	ADC1->CR2 |= ADC_CR2_SWSTART;
+}
+
+/*
+ * Function to stop scanning
+ *
+ * Clearing CONT lets the sequence that is running finish and no new one
+ * starts. A timer trigger is taken off too, otherwise every trigger after
+ * the DMA stops would start a conversion nothing reads and set OVR. It is
+ * put back by adc_scan_start(), and the timer is left running. The ADC is
+ * left on, so adc_scan_start() can carry on straight away. The overrun from
+ * the conversion the stopped DMA doesn't read is ignored.
+ */
+void adc_scan_stop(ADC_SCAN* scan)
+{
+	activeScan = NULL;
+
+	pausedTrigger |= ADC1->CR2 & (ADC_CR2_EXTSEL | ADC_CR2_EXTEN);
+	ADC1->CR2 &= ~(ADC_CR2_CONT | ADC_CR2_EXTSEL | ADC_CR2_EXTEN);
+	dma_stop(scan->DMA);
+}
+
+/*
+ * Function to return the number of times per second the sequence is
+ * converted, each channel takes its sample time + 12 ADCCLK cycles
+ *
+ * 11.5 in Ref Manual
+ */
+uint32_t adc_scan_rate(const ADC_SCAN* scan)
+{
+	uint32_t cycles = 0;
+
+	for(uint8_t i = 0; i < scan->CHANNEL_COUNT; i++)
+	{
+		cycles += SAMPLE_CYCLES[scan->CHANNELS[i].SAMPLE_TIME] + ADC_CONVERSION_CYCLES;
+	}
+
+	if(cycles == 0)
+	{
+		return 0;
+	}
+
+	return adc_get_clock() / cycles;
+}
+
+/*
+ * Function called from the DMA interrupt, the half transfer event means
+ * the first half is full, transfer complete means the second half is.
+ * If both are set the interrupt was late, and both are handed on in order.
+ */
+void adc_scan_dma_callback(void* context, uint32_t events)
+{
+	ADC_SCAN* scan = context;
+	uint16_t half = scan->BUFFER_SIZE / 2;
+
+	if(events & DMA_EVENT_HALF_TRANSFER)
+	{
+		scan->HALVES++;
+
+		if(scan->CALLBACK != NULL)
+		{
+			scan->CALLBACK(scan->CONTEXT, scan->BUFFER, half);
+		}
+	}
+
+	if(events & DMA_EVENT_TRANSFER_COMPLETE)
+	{
+		scan->HALVES++;
+
+		if(scan->CALLBACK != NULL)
+		{
+			scan->CALLBACK(scan->CONTEXT, scan->BUFFER + half, half);
+		}
+	}
+}
+
+/*
+ * ADC global interrupt, only the overrun is enabled
+ *
+ * When the DMA doesn't read DR in time the ADC sets OVR and stops asking
+ * for DMA transfers. Following 11.8.1 in Ref Manual, the stream is
+ * restarted from the start of the buffer, OVR is cleared and the
+ * conversions are started again.
+ */
+void ADC_IRQHandler(void)
+{
+	if(!(ADC1->SR & ADC_SR_OVR))
+	{
+		return;
+	}
+
+	if(activeScan == NULL)
+	{
+		ADC1->SR = ~ADC_SR_OVR;
+		return;
+	}
+
+	activeScan->OVERRUNS++;
+
+	dma_stop(activeScan->DMA);
+	adc_scan_dma_start(activeScan);
+
+	ADC1->SR = ~ADC_SR_OVR;
+
+	//the next timer trigger carries on by itself
+	if(!(ADC1->CR2 & ADC_CR2_EXTEN))
+	{
+		ADC1->CR2 |= ADC_CR2_SWSTART;
+	}
+}
+
+/*
+ * Function to return the EXTSEL value that picks the given timer event
+ * as the regular conversion trigger
+ *
+ * Only some TIM2-5 events are wired to the ADC (11.12.3 in Ref Manual):
+ * TIM2 TRGO/CC2/CC3/CC4, TIM3 TRGO/CC1, TIM4 CC4 and TIM5 CC1/CC2/CC3
+ */
+int adc_trigger_extsel(TIM_TypeDef* TMR, ADC_TRIGGER_EVENT event)
+{
+	if(event > ADC_TRIGGER_CC4)
+	{
+		return -1;
+	}
+
+	if(TMR == TIM2)
+	{
+		return TIM2_EXTSEL[event];
+	}
+	else if(TMR == TIM3)
+	{
+		return TIM3_EXTSEL[event];
+	}
+	else if(TMR == TIM4)
+	{
+		return TIM4_EXTSEL[event];
+	}
+	else if(TMR == TIM5)
+	{
+		return TIM5_EXTSEL[event];
+	}
+
+	return -1;
+}
+
+/*
+ * Function to work out the timer PRESCALER and PERIOD for a trigger rate
+ *
+ * The timer makes one event every PRESCALER * PERIOD counts of its clock,
+ * so the rate is exact when that product is timerClk / rate. The smallest
+ * PRESCALER that divides it with PERIOD <= maxPeriod is picked, which keeps
+ * the most resolution for the compare value. If the rate doesn't divide
+ * the clock (or nothing divides with a small enough PERIOD), the closest
+ * PERIOD for the smallest PRESCALER that fits is used and 0 is returned.
+ *
+ * PERIOD has to be at least 2, since the counter doesn't move with ARR = 0,
+ * so -1 is returned if the rate is above timerClk / 2 (or 0), or too slow
+ * for a 65536 prescaler
+ *
+ * 13.4.10/13.4.11 in Ref Manual
+ */
+int adc_trigger_timing(uint32_t timerClk, uint32_t rate, uint32_t maxPeriod, TIM2_5_CONFIG* timer)
+{
+	uint32_t counts;
+	uint32_t prescaler;
+
+	if(rate == 0 || rate > timerClk / 2 || maxPeriod < 2)
+	{
+		return -1;
+	}
+
+	//counts of the timer clock per event, rounded to the nearest
+	counts = (timerClk + (rate / 2)) / rate;
+
+	//smallest prescaler that gets the period to fit
+	prescaler = (counts + maxPeriod - 1) / maxPeriod;
+
+	if(prescaler > 65536)
+	{
+		return -1;
+	}
+
+	for(uint32_t p = prescaler; p <= 65536 && counts / p >= 2; p++)
+	{
+		if(counts % p == 0)
+		{
+			timer->PRESCALER = p;
+			timer->PERIOD = counts / p;
+
+			return ((uint64_t)counts * rate == timerClk) ? 1 : 0;
+		}
+	}
+
+	timer->PRESCALER = prescaler;
+	timer->PERIOD = (counts + (prescaler / 2)) / prescaler;
+
+	if(timer->PERIOD < 2)
+	{
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Function to start conversions from a timer event
+ *
+ * PRESCALER and PERIOD of the timer are worked out for the rate (see
+ * adc_trigger_timing()) and it is initialized, but not enabled, the
+ * first conversion comes one period after tim2_5_enable().
+ *
+ * TRGO: the timer's master mode is set to send the update event out on
+ * TRGO (MMS = 010, 13.4.2 in Ref Manual).
+ * CCx: the channel is set to PWM mode 1 with the compare at half the
+ * period, so OCxREF rises once a period. No pin is set up, the signal
+ * only goes to the ADC.
+ *
+ * The ADC starts a conversion (the whole sequence in scan mode) on the
+ * rising edge of the event (EXTEN = 01), so CONT is cleared. Since the
+ * timer runs from its own clock the samples are evenly spaced, no matter
+ * what the CPU is doing. adc_scan_start() still has to be called to
+ * start the DMA.
+ *
+ * 11.3.8 and 11.12.3 in Ref Manual
+ */
+int adc_trigger_init(TIM2_5_CONFIG* timer, ADC_TRIGGER_EVENT event, uint32_t rate)
+{
+	int extsel = adc_trigger_extsel(timer->TMR, event);
+	uint32_t maxPeriod = (timer->TMR == TIM2 || timer->TMR == TIM5) ? ADC_TRIGGER_PERIOD_MAX_32 : ADC_TRIGGER_PERIOD_MAX_16;
+	int exact;
+
+	if(extsel < 0)
+	{
+		return -1;
+	}
+
+	timer->COUNTER_MODE = TIM2_5_UP;
+	exact = adc_trigger_timing(tim2_5_get_clk(*timer), rate, maxPeriod, timer);
+
+	if(exact < 0)
+	{
+		return -1;
+	}
+
+	tim2_5_disable(*timer);
+	tim2_5_init(*timer);
+
+	if(event == ADC_TRIGGER_TRGO)
+	{
+		timer->TMR->CR2 = (timer->TMR->CR2 & ~TIM_CR2_MMS) | (2U << TIM_CR2_MMS_Pos);
+	}
+	else
+	{
+		TIM2_5_CH channel = event - ADC_TRIGGER_CC1;
+		volatile uint32_t* ccmr = (channel < TIM2_5_CH3) ? &timer->TMR->CCMR1 : &timer->TMR->CCMR2;
+		uint32_t shift = (channel % 2) ? TIM_CCMR1_OC2M_Pos : TIM_CCMR1_OC1M_Pos;
+
+		//output compare (CCxS = 00), PWM mode 1, 13.4.7 in Ref Manual
+		*ccmr = (*ccmr & ~((TIM_CCMR1_CC1S | TIM_CCMR1_OC1M) << (shift - TIM_CCMR1_OC1M_Pos))) | (TIM2_5_PWM_MODE1 << shift);
+		(&timer->TMR->CCR1)[channel] = timer->PERIOD / 2;
+
+		//the ADC takes the internal CCx event, CCxE would also drive OCx
+		//onto its pin, so it is kept clear, 13.4.9 in Ref Manual
+		timer->TMR->CCER &= ~(1U << (channel * 4));
+	}
+
+	pausedTrigger = 0;
+	ADC1->CR2 &= ~(ADC_CR2_CONT | ADC_CR2_EXTSEL | ADC_CR2_EXTEN);
+	ADC1->CR2 |= (extsel << ADC_CR2_EXTSEL_Pos) | ADC_CR2_EXTEN_0;
+
+	return exact;
+}
+
+/*
+ * Function to go back to starting conversions from software,
+ * the timer is left as it is
+ */
+void adc_trigger_disable(void)
+{
+	pausedTrigger = 0;
+	ADC1->CR2 &= ~(ADC_CR2_EXTSEL | ADC_CR2_EXTEN);
+}
@@ -14,15 +14,103 @@
 #include "gpio.h"
 #include "uart.h"
 #include "adc.h"
+#include "timer.h"
 #include <stdio.h>
 #include <stdint.h>
 
 /* TESTS: */
 //#define SINGLE_TEST //un-comment this to test single conversion for ADC
 //#define CONTINUOUS_TEST //un-comment this to test continuous conversion for ADC
+//#define SCAN_TEST //un-comment this to test scanning PA0, PA1 and VREFINT into a circular buffer through DMA
+//#define TRIGGER_TEST //un-comment this to check the trigger timing math, then sample PA1 at exactly 1KHz from TIM2, view results with live expressions
 
 UART_CONFIG UART2;
 ADC_CONFIG adc;
+
+#ifdef SCAN_TEST
+	//PA0 and PA1 sampled quickly, VREFINT needs at least 10us of sampling (Table 71 in Datasheet)
+	const ADC_SCAN_CHANNEL SCAN_CHANNELS[3] = {
+												{ADC_CH0, ADC_SAMPLE_15},
+												{ADC_CH1, ADC_SAMPLE_15},
+												{ADC_CH17, ADC_SAMPLE_480}
+											  };
+
+	//32 sequences per half
+	volatile uint16_t scanBuffer[3 * 2 * 32];
+
+	//average of each channel over the last half that was filled
+	volatile uint32_t scanAverage[3];
+
+	//callback for each half of the buffer, the samples go PA0, PA1, VREFINT, PA0, ...
+	void scan_half(void* context, volatile uint16_t* samples, uint16_t count)
+	{
+		uint32_t sum[3] = {0, 0, 0};
+
+		for(uint16_t i = 0; i < count; i++)
+		{
+			sum[i % 3] += samples[i];
+		}
+
+		for(int ch = 0; ch < 3; ch++)
+		{
+			scanAverage[ch] = sum[ch] / (count / 3);
+		}
+	}
+#endif
+
+#ifdef TRIGGER_TEST
+	volatile uint32_t triggerChecked = 0; //number of clock/rate/timer width cases checked
+	volatile uint32_t triggerErrors = 0; //number that were out of range, wrongly exact/inexact, or wrongly accepted/rejected
+
+	const ADC_SCAN_CHANNEL TRIGGER_CHANNELS[1] = {{ADC_CH1, ADC_SAMPLE_15}};
+
+	//100 samples per half, so at 1KHz a half is filled every 100ms
+	volatile uint16_t triggerBuffer[200];
+
+	//checks adc_trigger_timing() for one case, exact means the rate divides the clock
+	void check_trigger(uint32_t timerClk, uint32_t rate, uint32_t maxPeriod)
+	{
+		TIM2_5_CONFIG timer;
+		int result = adc_trigger_timing(timerClk, rate, maxPeriod, &timer);
+		int shouldWork = (rate != 0 && rate <= timerClk / 2 && timerClk / rate <= (uint64_t)65536 * maxPeriod);
+
+		triggerChecked++;
+
+		if((result >= 0) != shouldWork)
+		{
+			triggerErrors++;
+			return;
+		}
+
+		if(result < 0)
+		{
+			return;
+		}
+
+		uint64_t counts = (uint64_t)timer.PRESCALER * timer.PERIOD;
+
+		if(timer.PRESCALER < 1 || timer.PRESCALER > 65536 || timer.PERIOD < 2 || (uint32_t)timer.PERIOD > maxPeriod)
+		{
+			triggerErrors++;
+		}
+
+		//an exact rate has to be reported as exact, and really be exact
+		if((result == 1) != (timerClk % rate == 0) || (result == 1 && counts * rate != timerClk))
+		{
+			triggerErrors++;
+		}
+
+		//otherwise it has to be the closest the timer can make, within half a
+		//count either side of the clock / rate (half a prescaled count plus
+		//the rounding of the count itself)
+		uint64_t error = (counts * rate > timerClk) ? counts * rate - timerClk : timerClk - counts * rate;
+
+		if(result == 0 && error > (uint64_t)rate * (timer.PRESCALER + 1) / 2)
+		{
+			triggerErrors++;
+		}
+	}
+#endif
 int main(void)
 {
 	//UART for 115200 baudrate, PA3 as RX, PA2 as TX for USART2
@@ -40,9 +128,8 @@ int main(void)
 
 	adc_init(adc); //init adc
 
-	uint32_t val; //storing ADC value
-
 	#ifdef SINGLE_TEST
+		uint32_t val; //storing ADC value
 
 		adc_start_single(); //start single conversion
 
@@ -61,7 +148,84 @@ int main(void)
 		}
 	#endif
 
+	#ifdef SCAN_TEST
+		ADC_SCAN scan;
+		scan.CHANNELS = SCAN_CHANNELS;
+		scan.CHANNEL_COUNT = 3;
+		scan.BUFFER = scanBuffer;
+		scan.BUFFER_SIZE = sizeof(scanBuffer) / sizeof(scanBuffer[0]);
+		scan.STREAM = DMA_STREAM0;
+		scan.CALLBACK = scan_half;
+		scan.CONTEXT = NULL;
+
+		adc_scan_init(&scan);
+		adc_scan_start(&scan);
+
+		while(1)
+		{
+			char str[100];
+
+			//expect PA0/PA1 to follow their inputs, VREFINT ~1500 (1.21V at 3.3V VDDA), OVERRUNS = 0,
+			//and HALVES counting up at 2 * rate / 32 per second
+			sprintf(str, "PA0 = %d PA1 = %d VREF = %d rate = %d/s halves = %d overruns = %d \n\r",
+					(int)scanAverage[0], (int)scanAverage[1], (int)scanAverage[2],
+					(int)adc_scan_rate(&scan), (int)scan.HALVES, (int)scan.OVERRUNS);
+
+			uart_write_string(UART2.USART, str);
+		}
+	#endif
+
+	#ifdef TRIGGER_TEST
+		static const uint32_t clocks[3] = {16000000, 42000000, 84000000};
+		static const uint32_t rates[10] = {0, 1, 7, 1000, 8000, 44100, 48000, 1000000, 8000000, 42000001};
+
+		for(int c = 0; c < 3; c++)
+		{
+			for(int r = 0; r < 10; r++)
+			{
+				check_trigger(clocks[c], rates[r], ADC_TRIGGER_PERIOD_MAX_16);
+				check_trigger(clocks[c], rates[r], ADC_TRIGGER_PERIOD_MAX_32);
+			}
+		}
+
+		//events that aren't wired to the ADC
+		if(adc_trigger_extsel(TIM2, ADC_TRIGGER_CC1) != -1 || adc_trigger_extsel(TIM4, ADC_TRIGGER_TRGO) != -1 ||
+		   adc_trigger_extsel(TIM2, ADC_TRIGGER_TRGO) != 6 || adc_trigger_extsel(TIM5, ADC_TRIGGER_CC3) != 12)
+		{
+			triggerErrors++;
+		}
+
+		//sample PA1 from TIM2 TRGO at 1KHz
+		TIM2_5_CONFIG TMR2 = {TIM2, TIM2_5_UP, 1, 1};
+		ADC_SCAN scan;
+		scan.CHANNELS = TRIGGER_CHANNELS;
+		scan.CHANNEL_COUNT = 1;
+		scan.BUFFER = triggerBuffer;
+		scan.BUFFER_SIZE = sizeof(triggerBuffer) / sizeof(triggerBuffer[0]);
+		scan.STREAM = DMA_STREAM0;
+		scan.CALLBACK = NULL;
+		scan.CONTEXT = NULL;
+
+		adc_scan_init(&scan);
+		volatile int exact = adc_trigger_init(&TMR2, ADC_TRIGGER_TRGO, 1000);
+		adc_scan_start(&scan);
+		tim2_5_enable(TMR2);
+
+		while(1)
+		{
+			char str[100];
+
+			//expect triggerChecked = 60, triggerErrors = 0, exact = 1 (16MHz / 1KHz = 16000 counts),
+			//halves going up by 10 a second however long the UART takes
+			sprintf(str, "checked = %d errors = %d exact = %d halves = %d \n\r",
+					(int)triggerChecked, (int)triggerErrors, exact, (int)scan.HALVES);
+
+			uart_write_string(UART2.USART, str);
+		}
+	#endif
+
 	#ifdef CONTINUOUS_TEST
+		uint32_t val; //storing ADC value
 
 		adc_start_continuous(); //start continuous conversion
 
@@ -0,0 +1,44 @@
+/**
+ ******************************************************************************
+ * @file           : dwt.h
+ * @author         : Nubal Manhas
+ * @brief          : Header file for DWT cycle counter library
+ ******************************************************************************
+ * @purpose
+ *
+ * The purpose of this file is to declare functions, enums, and structs, that
+ * will support the creation of a library for cycle accurate timing and
+ * microsecond delays with the DWT cycle counter of the STM32F01RE MCU
+ *
+ ******************************************************************************
+ */
+
+#ifndef DWT_H_
+#define DWT_H_
+#include <stdint.h>
+
+//function to start the cycle counter and calibrate it to HCLK, call again after the clock speed changes
+void dwt_init(void);
+
+//function to return the current cycle count
+uint32_t cycles_now(void);
+
+//function to return the number of cycles since start, this is correct across the counter wrapping
+uint32_t cycles_elapsed(uint32_t start);
+
+//function to return the number of cycles from start to end, this is correct across the counter wrapping
+uint32_t cycles_between(uint32_t start, uint32_t end);
+
+//function to convert a number of cycles to microseconds
+uint32_t cycles_to_us(uint32_t cycles);
+
+//function to convert a number of microseconds to cycles
+uint32_t us_to_cycles(uint32_t us);
+
+//function to wait for the given number of cycles
+void delay_cycles(uint32_t cycles);
+
+//function to wait for the given number of microseconds
+void delay_us(uint32_t us);
+
+#endif /* DWT_H_ */
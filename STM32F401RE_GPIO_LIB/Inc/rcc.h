@@ -0,0 +1,75 @@
+/**
+ ******************************************************************************
+ * @file           : rcc.h
+ * @author         : Nubal Manhas
+ * @brief          : Header file for RCC (clock) library
+ ******************************************************************************
+ * @purpose
+ *
+ * The purpose of this file is to declare functions, enums, and structs, that
+ * will support the creation of a library for configuring and reading the
+ * clock tree of the STM32F01RE MCU
+ *
+ ******************************************************************************
+ */
+
+#ifndef RCC_H_
+#define RCC_H_
+#include "stm32f4xx.h"
+#include <stdint.h>
+
+//internal RC oscillator frequency in Hz, the default clock after reset
+//6.2.2 in Ref Manual
+#define RCC_HSI_FREQ		16000000
+
+//external clock frequency in Hz, on the Nucleo board this comes from
+//the ST-LINK MCO (8MHz) which has to be used in bypass mode
+//6.2.1 in Ref Manual
+#define RCC_HSE_FREQ		8000000
+
+//max SYSCLK/HCLK, APB1 and APB2 frequencies in Hz
+//6.2 in Ref Manual
+#define RCC_SYSCLK_MAX		84000000
+#define RCC_PCLK1_MAX		42000000
+#define RCC_PCLK2_MAX		84000000
+
+//cycles to wait for an oscillator/PLL to become ready before giving up
+#define RCC_READY_TIMEOUT	100000
+
+/*
+ * Clock that feeds the PLL
+ *
+ * HSE uses a crystal, HSE_BYPASS takes an external clock
+ * signal straight in on OSC_IN (which is what the Nucleo has)
+ *
+ * 6.2.1/6.3.1 in Ref Manual
+ */
+typedef enum
+{
+	RCC_SOURCE_HSI,
+	RCC_SOURCE_HSE,
+	RCC_SOURCE_HSE_BYPASS
+}RCC_CLOCK_SOURCE;
+
+//function to run SYSCLK at 84MHz from the PLL, returns -1 if the clock couldn't be started
+int rcc_init(RCC_CLOCK_SOURCE source);
+
+//function to return the SYSCLK frequency in Hz
+uint32_t rcc_get_sysclk(void);
+
+//function to return the AHB (HCLK) frequency in Hz, this is the core and SysTick clock
+uint32_t rcc_get_hclk(void);
+
+//function to return the APB1 (PCLK1) frequency in Hz
+uint32_t rcc_get_pclk1(void);
+
+//function to return the APB2 (PCLK2) frequency in Hz
+uint32_t rcc_get_pclk2(void);
+
+//function to return the clock of the timers on APB1 (TIM2-5) in Hz
+uint32_t rcc_get_timclk1(void);
+
+//function to return the clock of the timers on APB2 (TIM1, TIM9-11) in Hz
+uint32_t rcc_get_timclk2(void);
+
+#endif /* RCC_H_ */
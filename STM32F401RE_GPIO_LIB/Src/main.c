@@ -13,16 +13,62 @@
  */
 #include "stm32f4xx.h"
 #include "gpio.h"
+#include "rcc.h"
+#include "flash.h"
+#include "dwt.h"
 
 /* TESTS: */
 //#define TOGGLE_TEST  //un-comment this to test for output toggle on PA5
 //#define OUTPUT_WRITE //un-comment this to test for output write to PA5, should be a similar result to TOGGLE_TEST
 //#define INPUT_TEST //un-comment this to test input for PC13, PA5 should go high when PC13 is high
 //#define OUTPUT_SETRESET //un-comment this to test output bit set/reset, should be similar to INPUT_TEST
+//#define ART_BENCHMARK_TEST //un-comment this to measure a tight loop and gpio_toggle_output on PA5 at 84MHz, with and without the ART accelerator
 
 GPIOx_PIN_CONFIG PIN5; //PA5
 GPIOx_PIN_CONFIG PIN13; //PC13
 
+#ifdef ART_BENCHMARK_TEST
+	//number of times each benchmark repeats what it measures
+	#define BENCHMARK_COUNT		1000
+
+	//CPU cycles for each benchmark, view with live expressions in the debugger
+	uint32_t loopCyclesNoArt = 0;
+	uint32_t loopCyclesArt = 0;
+	uint32_t toggleCyclesNoArt = 0;
+	uint32_t toggleCyclesArt = 0;
+
+	/*
+	 * Function to time a tight loop with the DWT cycle counter
+	 */
+	static uint32_t benchmark_loop(void)
+	{
+		volatile uint32_t count = 0;
+		uint32_t start = cycles_now();
+
+		for(int i = 0; i < BENCHMARK_COUNT; i++)
+		{
+			count++;
+		}
+
+		return cycles_elapsed(start);
+	}
+
+	/*
+	 * Function to time gpio_toggle_output on PA5 with the DWT cycle counter
+	 */
+	static uint32_t benchmark_toggle(void)
+	{
+		uint32_t start = cycles_now();
+
+		for(int i = 0; i < BENCHMARK_COUNT; i++)
+		{
+			gpio_toggle_output(GPIOA, PIN5);
+		}
+
+		return cycles_elapsed(start);
+	}
+#endif
+
 int main(void)
 {
 	//we want PA5 as an output for all the tests
@@ -90,4 +136,30 @@ int main(void)
 			}
 		}
 	#endif
+
+	#ifdef ART_BENCHMARK_TEST
+		//84MHz needs 2 wait states, which is where the ART accelerator matters
+		rcc_init(RCC_SOURCE_HSI);
+
+		gpio_init(GPIOA, PIN5); //init PA5 as output
+
+		//turn on the DWT cycle counter
+		dwt_init();
+
+		//every flash read waits the full 2 wait states
+		flash_art_disable();
+		loopCyclesNoArt = benchmark_loop();
+		toggleCyclesNoArt = benchmark_toggle();
+
+		//run each once to fill the caches, then measure
+		flash_art_enable();
+		benchmark_loop();
+		loopCyclesArt = benchmark_loop();
+		benchmark_toggle();
+		toggleCyclesArt = benchmark_toggle();
+
+		while(1)
+		{
+		}
+	#endif
 }
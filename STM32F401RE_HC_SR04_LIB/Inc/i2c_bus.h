@@ -0,0 +1,122 @@
+/**
+ ******************************************************************************
+ * @file           : i2c_bus.h
+ * @author         : Nubal Manhas
+ * @brief          : Header file for I2C bus manager library
+ ******************************************************************************
+ * @purpose
+ *
+ * The purpose of this file is to declare functions, enums, and structs, that
+ * will support the creation of a library for sharing one I2C interface
+ * between several device drivers, by queueing their transactions by
+ * priority and running them back to back, on the STM32F01RE MCU
+ *
+ ******************************************************************************
+ */
+
+#ifndef I2C_BUS_H_
+#define I2C_BUS_H_
+#include "i2c.h"
+#include <stdint.h>
+
+//number of transactions that can be waiting on (or running on) one bus
+#define I2C_BUS_QUEUE_SIZE		16
+
+/*
+ * Priority of a device's transactions, a waiting transaction always
+ * goes before any waiting transaction of a lower priority, and
+ * transactions of the same priority go in the order they were queued
+ */
+typedef enum
+{
+	I2C_BUS_PRIORITY_HIGH,
+	I2C_BUS_PRIORITY_NORMAL,
+	I2C_BUS_PRIORITY_LOW,
+	I2C_BUS_PRIORITIES
+}I2C_BUS_PRIORITY;
+
+/*
+ * Counters for one device
+ *
+ * TRANSFERS is the number of finished transactions, NACKS the ones the
+ * device didn't acknowledge and ERRORS the ones that ended with any other
+ * error. Latency is from i2c_bus_submit() to the end of the transaction in
+ * microseconds, so it includes the time spent waiting in the queue.
+ * TOTAL_LATENCY_US / TRANSFERS is the average.
+ */
+typedef struct
+{
+	uint32_t TRANSFERS;
+	uint32_t NACKS;
+	uint32_t ERRORS;
+	uint32_t LAST_LATENCY_US;
+	uint32_t MAX_LATENCY_US;
+	uint32_t TOTAL_LATENCY_US;
+}I2C_DEVICE_STATS;
+
+/*
+ * Struct for one device on the bus, set up with i2c_bus_device_init()
+ */
+typedef struct
+{
+	uint8_t ADDRESS;
+	I2C_BUS_PRIORITY PRIORITY;
+	volatile I2C_DEVICE_STATS STATS;
+}I2C_DEVICE;
+
+struct I2C_BUS;
+
+/*
+ * One slot in the bus queue, the I2C_TRANSFER given to i2c_transfer()
+ * lives in here so callers don't have to keep one around
+ */
+typedef struct I2C_BUS_ENTRY
+{
+	I2C_TRANSFER TRANSFER;
+	struct I2C_BUS* BUS;
+	I2C_DEVICE* DEVICE;
+	I2C_CALLBACK CALLBACK;
+	void* CONTEXT;
+	uint32_t QUEUED_CYCLES;
+	struct I2C_BUS_ENTRY* NEXT;
+}I2C_BUS_ENTRY;
+
+/*
+ * Struct for one I2C interface shared between devices
+ *
+ * ENTRIES are handed out from FREE, waiting entries are kept in a list
+ * per priority (HEAD/TAIL), and ACTIVE is the one on the bus.
+ * Only CONFIG should be set by the caller, using i2c_bus_init().
+ *
+ * REJECTED counts submits that found the queue full, and MAX_QUEUED
+ * is the most entries that were ever in use at once.
+ */
+typedef struct I2C_BUS
+{
+	I2C_CONFIG CONFIG;
+	I2C_BUS_ENTRY ENTRIES[I2C_BUS_QUEUE_SIZE];
+	I2C_BUS_ENTRY* FREE;
+	I2C_BUS_ENTRY* HEAD[I2C_BUS_PRIORITIES];
+	I2C_BUS_ENTRY* TAIL[I2C_BUS_PRIORITIES];
+	I2C_BUS_ENTRY* volatile ACTIVE;
+	volatile uint32_t QUEUED;
+	volatile uint32_t MAX_QUEUED;
+	volatile uint32_t REJECTED;
+}I2C_BUS;
+
+//function to set up the I2C interface and an empty queue, returns -1 if i2c_init() fails
+int i2c_bus_init(I2C_BUS* bus, I2C_CONFIG config);
+
+//function to set up a device with its 7-bit address and the priority of its transactions
+void i2c_bus_device_init(I2C_DEVICE* device, uint8_t address, I2C_BUS_PRIORITY priority);
+
+//function to queue a write (then read after a repeated start) for a device, returns -1 if the queue is full
+int i2c_bus_submit(I2C_BUS* bus, I2C_DEVICE* device, const uint8_t* txData, uint16_t txSize, uint8_t* rxData, uint16_t rxSize, I2C_CALLBACK callback, void* context);
+
+//function to return the number of transactions waiting or on the bus, checking the one on the bus for a timeout, this has to be polled for timeouts to be caught
+uint32_t i2c_bus_pending(I2C_BUS* bus);
+
+//function to clear the counters of a device
+void i2c_bus_device_reset_stats(I2C_DEVICE* device);
+
+#endif /* I2C_BUS_H_ */
@@ -17,6 +17,7 @@
 
 #ifndef LCD_H_
 #define LCD_H_
+#include <stdint.h>
 
 //LCD Slave address, check p. 17 in
 //the LCD datasheet to verify
@@ -38,14 +39,154 @@
 //and no shift
 #define CURSOR_INCREMENT    0x06
 
-//Instruction to set CGRAM address, to begin writing data to the
-//LCD
+//Instruction to set the CGRAM address (the custom character
+//patterns), OR'd with the address
 #define SET_CGRAM			0x40
 
+//Instruction to set the DDRAM address (the character position),
+//OR'd with the address
+#define SET_DDRAM			0x80
+
+/*
+ * The control byte in front of each command/data byte, p. 17 in the
+ * LCD datasheet. Bit 7 (Co) set means another control byte comes after
+ * the next byte, clear means every byte after it is the same type until
+ * the stop. Bit 6 (RS) picks data (DDRAM/CGRAM) or a command.
+ */
+#define LCD_CONTROL_COMMAND	0x00
+#define LCD_CONTROL_DATA	0x40
+#define LCD_CONTROL_CO		0x80
+
+//size of the display, 8 characters x 2 lines
+#define LCD_ROWS			2
+#define LCD_COLS			8
+
+//DDRAM address of the first character of each line in 2 line mode
+#define LCD_ROW0_ADDR		0x00
+#define LCD_ROW1_ADDR		0x40
+
+//CLEAR_DISPLAY takes 1.52ms at the slowest LCD clock, section 12 in the LCD Datasheet
+#define LCD_CLEAR_DELAY_MS	2
+
+//8 custom characters (glyphs) in CGRAM, each 5 dots wide and 8 rows high. row 0 is the
+//top, bit 4 is the left dot. they are shown by writing character codes 0-7
+#define LCD_GLYPHS			8
+#define LCD_GLYPH_ROWS		8
+
+//number of lcd_printf() requests for different places on the display that can wait to be drawn
+#define LCD_RENDER_QUEUE_SIZE	4
+
+//largest burst lcd_fb_encode() can make, every cell changed with gaps between them
+//(2 bytes to set the address + 2 bytes per character)
+#define LCD_BURST_MAX		(LCD_ROWS * LCD_COLS * 4)
+
+/*
+ * Copy of the display in RAM
+ *
+ * TEXT is what should be on the display, SHOWN is what was last sent to
+ * it. DIRTY has bit n set for each column n of a line where they differ,
+ * so only the characters that changed are sent. Writing the character
+ * that is already shown clears the bit again, so redrawing a whole line
+ * with mostly the same text costs nothing for the parts that didn't change.
+ *
+ * A full redraw is 29 bytes on the bus, ~0.7ms with SCL at 400KHz
+ * (I2C_FAST_MODE_FREQ) and ~2.7ms at 100KHz, so the I2C should be set
+ * up in fast mode to get a redraw in about a millisecond.
+ */
+typedef struct
+{
+	I2C_CONFIG I2C;
+	char TEXT[LCD_ROWS][LCD_COLS];
+	char SHOWN[LCD_ROWS][LCD_COLS];
+	uint32_t DIRTY[LCD_ROWS];
+}LCD_FRAMEBUFFER;
+
+/*
+ * One lcd_printf() request waiting to be drawn, TEXT starts at
+ * ROW/COL and the rest of the line after it is cleared
+ */
+typedef struct
+{
+	uint8_t ROW;
+	uint8_t COL;
+	char TEXT[LCD_COLS + 1];
+}LCD_RENDER_REQUEST;
+
+/*
+ * Struct for drawing to the LCD in the background
+ *
+ * lcd_printf() only formats the text and queues it, lcd_render_poll()
+ * puts the queue into the framebuffer and sends the changes with
+ * i2c_transfer(), so neither waits on the LCD. A request for the same
+ * place as one still in the queue replaces its text, and anything
+ * queued while a burst is on the bus is sent together in the next
+ * one, so only the latest text is ever drawn.
+ *
+ * REQUESTS counts lcd_printf() calls, COALESCED the ones that replaced a
+ * request that was never drawn, DROPPED the ones the queue had no room
+ * for, FRAMES the bursts sent and ERRORS the bursts that failed (the
+ * whole display is sent again after one).
+ *
+ * Everything is set up by lcd_render_init()
+ */
+typedef struct
+{
+	LCD_FRAMEBUFFER FB;
+	LCD_RENDER_REQUEST QUEUE[LCD_RENDER_QUEUE_SIZE];
+	volatile uint8_t QUEUED;
+	uint8_t BURST[LCD_BURST_MAX];
+	I2C_TRANSFER TRANSFER;
+	volatile int BUSY;
+	volatile uint32_t REQUESTS;
+	volatile uint32_t COALESCED;
+	volatile uint32_t DROPPED;
+	volatile uint32_t FRAMES;
+	volatile uint32_t ERRORS;
+}LCD_RENDER;
+
 //function to initialize the LCD
 void lcd_init(I2C_CONFIG i2c);
 
 //function to write characters to the LCD
 void lcd_write(I2C_CONFIG i2c, char* data);
 
+//function to move the cursor to the given line and column, returns -1 if it is off the display or the I2C transaction fails
+int lcd_set_cursor(I2C_CONFIG i2c, uint8_t row, uint8_t col);
+
+//function to upload custom characters to CGRAM in one transaction, starting at the given character code, returns -1 if they don't fit or the I2C transaction fails
+int lcd_load_glyphs(I2C_CONFIG i2c, uint8_t first, const uint8_t glyphs[][LCD_GLYPH_ROWS], uint8_t count);
+
+//function to set up a framebuffer for a display that lcd_init() has just cleared
+void lcd_fb_init(LCD_FRAMEBUFFER* fb, I2C_CONFIG i2c);
+
+//function to fill the framebuffer with spaces
+void lcd_fb_clear(LCD_FRAMEBUFFER* fb);
+
+//function to put one character into the framebuffer, this can be a custom character code (0-7) which can't go in a string
+void lcd_fb_set(LCD_FRAMEBUFFER* fb, uint8_t row, uint8_t col, char c);
+
+//function to write a string into the framebuffer at the given line and column, cut off at the end of the line
+void lcd_fb_write(LCD_FRAMEBUFFER* fb, uint8_t row, uint8_t col, const char* text);
+
+//function to encode the changed characters into one burst for the LCD (up to LCD_BURST_MAX bytes), returns its length
+uint16_t lcd_fb_encode(LCD_FRAMEBUFFER* fb, uint8_t* burst);
+
+//function to mark every character as changed, so the whole display is sent again
+void lcd_fb_invalidate(LCD_FRAMEBUFFER* fb);
+
+//function to send the changed characters to the LCD in one transaction, returns -1 if the I2C transaction fails
+int lcd_fb_flush(LCD_FRAMEBUFFER* fb);
+
+//function to set up background drawing for a display that lcd_init() has just cleared
+void lcd_render_init(LCD_RENDER* render, I2C_CONFIG i2c);
+
+//function to queue printf style text to be drawn at the given line and column, clearing the rest of the line, returns -1 if it is off the display or the queue is full
+int lcd_printf(LCD_RENDER* render, uint8_t row, uint8_t col, const char* format, ...);
+
+//function to start sending whatever has changed if the LCD isn't busy, call this from the main loop
+void lcd_render_poll(LCD_RENDER* render);
+
+//function to check if there is anything left to draw
+int lcd_render_busy(LCD_RENDER* render);
+
 #endif /* LCD_H_ */
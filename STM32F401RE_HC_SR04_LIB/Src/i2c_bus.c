@@ -0,0 +1,268 @@
+/**
+ ******************************************************************************
+ * @file           : i2c_bus.c
+ * @author         : Nubal Manhas
+ * @brief          : Main c file for I2C bus manager library
+ ******************************************************************************
+ * @purpose
+ *
+ * The purpose of this file is to define functions that will support sharing
+ * one I2C interface between several device drivers on the STM32F01RE MCU
+ *
+ ******************************************************************************
+ */
+#include "i2c_bus.h"
+#include "dwt.h"
+
+void i2c_bus_next(I2C_BUS* bus);
+void i2c_bus_done(void* context, I2C_STATUS status);
+
+/*
+ * Function to set up the I2C interface for the bus and put
+ * every queue entry on the free list
+ *
+ * dwt_init() has to have been called, the latency is
+ * timed with the cycle counter
+ */
+int i2c_bus_init(I2C_BUS* bus, I2C_CONFIG config)
+{
+	bus->CONFIG = config;
+	bus->FREE = NULL;
+	bus->ACTIVE = NULL;
+	bus->QUEUED = 0;
+	bus->MAX_QUEUED = 0;
+	bus->REJECTED = 0;
+
+	for(int i = 0; i < I2C_BUS_PRIORITIES; i++)
+	{
+		bus->HEAD[i] = NULL;
+		bus->TAIL[i] = NULL;
+	}
+
+	for(int i = 0; i < I2C_BUS_QUEUE_SIZE; i++)
+	{
+		bus->ENTRIES[i].BUS = bus;
+		bus->ENTRIES[i].NEXT = bus->FREE;
+		bus->FREE = &bus->ENTRIES[i];
+	}
+
+	return i2c_init(config);
+}
+
+/*
+ * Function to set up a device, the address is the
+ * 7-bit one (not shifted for the read/write bit)
+ */
+void i2c_bus_device_init(I2C_DEVICE* device, uint8_t address, I2C_BUS_PRIORITY priority)
+{
+	device->ADDRESS = address;
+	device->PRIORITY = priority;
+	i2c_bus_device_reset_stats(device);
+}
+
+/*
+ * Function to clear the counters of a device
+ */
+void i2c_bus_device_reset_stats(I2C_DEVICE* device)
+{
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+
+	device->STATS.TRANSFERS = 0;
+	device->STATS.NACKS = 0;
+	device->STATS.ERRORS = 0;
+	device->STATS.LAST_LATENCY_US = 0;
+	device->STATS.MAX_LATENCY_US = 0;
+	device->STATS.TOTAL_LATENCY_US = 0;
+
+	__set_PRIMASK(primask);
+}
+
+/*
+ * Function to queue a transaction for a device
+ *
+ * txSize bytes from txData are written, then if rxSize isn't 0 rxSize
+ * bytes are read into rxData after a repeated start (see I2C_TRANSFER).
+ * The data isn't copied, both buffers have to stay untouched until the
+ * callback is called. The callback comes from an interrupt once the
+ * transaction is over and can be NULL.
+ *
+ * If the bus is free the transaction starts right away, otherwise it
+ * waits behind anything of the same or a higher priority.
+ *
+ * -1 is returned without queueing anything if all I2C_BUS_QUEUE_SIZE
+ * entries are in use, or a size is set without its buffer
+ */
+int i2c_bus_submit(I2C_BUS* bus, I2C_DEVICE* device, const uint8_t* txData, uint16_t txSize, uint8_t* rxData, uint16_t rxSize, I2C_CALLBACK callback, void* context)
+{
+	I2C_BUS_ENTRY* entry;
+	uint32_t primask;
+
+	//checked here so i2c_transfer() can't turn it down later on
+	if((txSize != 0 && txData == NULL) || (rxSize != 0 && rxData == NULL))
+	{
+		return -1;
+	}
+
+	primask = __get_PRIMASK();
+	__disable_irq();
+
+	entry = bus->FREE;
+
+	if(entry == NULL)
+	{
+		bus->REJECTED++;
+		__set_PRIMASK(primask);
+		return -1;
+	}
+
+	bus->FREE = entry->NEXT;
+
+	entry->TRANSFER.ADDRESS = device->ADDRESS;
+	entry->TRANSFER.TX_DATA = txData;
+	entry->TRANSFER.TX_SIZE = txSize;
+	entry->TRANSFER.RX_DATA = rxData;
+	entry->TRANSFER.RX_SIZE = rxSize;
+	entry->TRANSFER.CALLBACK = i2c_bus_done;
+	entry->TRANSFER.CONTEXT = entry;
+	entry->TRANSFER.TIMEOUT_US = 0;
+	entry->DEVICE = device;
+	entry->CALLBACK = callback;
+	entry->CONTEXT = context;
+	entry->QUEUED_CYCLES = cycles_now();
+	entry->NEXT = NULL;
+
+	//add to the back of the list for the device's priority
+	if(bus->TAIL[device->PRIORITY] == NULL)
+	{
+		bus->HEAD[device->PRIORITY] = entry;
+	}
+	else
+	{
+		bus->TAIL[device->PRIORITY]->NEXT = entry;
+	}
+
+	bus->TAIL[device->PRIORITY] = entry;
+
+	bus->QUEUED++;
+
+	if(bus->QUEUED > bus->MAX_QUEUED)
+	{
+		bus->MAX_QUEUED = bus->QUEUED;
+	}
+
+	if(bus->ACTIVE == NULL)
+	{
+		i2c_bus_next(bus);
+	}
+
+	__set_PRIMASK(primask);
+
+	return 0;
+}
+
+/*
+ * Function to return the number of transactions waiting or on the bus
+ *
+ * The transaction on the bus is checked for a timeout first (timeouts
+ * count as ERRORS in the device stats), so polling this from the main
+ * loop is enough to keep a hung bus from holding up the queue
+ */
+uint32_t i2c_bus_pending(I2C_BUS* bus)
+{
+	i2c_timeout_poll(bus->CONFIG.I2C);
+
+	return bus->QUEUED;
+}
+
+/*
+ * Function to put the highest priority waiting transaction on the bus
+ *
+ * Only one transaction is given to i2c_transfer() at a time, so one
+ * that is queued later with a higher priority can still go next.
+ * Called with interrupts off.
+ */
+void i2c_bus_next(I2C_BUS* bus)
+{
+	I2C_BUS_ENTRY* entry;
+
+	for(int i = 0; i < I2C_BUS_PRIORITIES; i++)
+	{
+		entry = bus->HEAD[i];
+
+		if(entry == NULL)
+		{
+			continue;
+		}
+
+		bus->HEAD[i] = entry->NEXT;
+
+		if(bus->HEAD[i] == NULL)
+		{
+			bus->TAIL[i] = NULL;
+		}
+
+		entry->NEXT = NULL;
+		bus->ACTIVE = entry;
+
+		i2c_transfer(bus->CONFIG.I2C, &entry->TRANSFER);
+
+		return;
+	}
+}
+
+/*
+ * Function called from the I2C interrupt when the transaction on the bus
+ * is over
+ *
+ * The next transaction is started before anything else, so the bus only
+ * sits idle for the few instructions it takes to get here from the stop
+ * condition, then the device's counters are updated and its callback is
+ * called. A stop held up by a slave stretching SCL is the exception, the
+ * next transaction then waits for i2c_bus_pending() (see i2c_transfer()). The entry goes back on the free list after the callback, so the
+ * callback can queue the next transaction for its device.
+ */
+void i2c_bus_done(void* context, I2C_STATUS status)
+{
+	I2C_BUS_ENTRY* entry = (I2C_BUS_ENTRY*)context;
+	I2C_BUS* bus = entry->BUS;
+	I2C_DEVICE* device = entry->DEVICE;
+	uint32_t latency = cycles_to_us(cycles_elapsed(entry->QUEUED_CYCLES));
+	uint32_t primask;
+
+	primask = __get_PRIMASK();
+	__disable_irq();
+	bus->ACTIVE = NULL;
+	i2c_bus_next(bus);
+	__set_PRIMASK(primask);
+
+	device->STATS.TRANSFERS++;
+	device->STATS.LAST_LATENCY_US = latency;
+	device->STATS.TOTAL_LATENCY_US += latency;
+
+	if(latency > device->STATS.MAX_LATENCY_US)
+	{
+		device->STATS.MAX_LATENCY_US = latency;
+	}
+
+	if(status == I2C_STATUS_NACK)
+	{
+		device->STATS.NACKS++;
+	}
+	else if(status != I2C_STATUS_OK)
+	{
+		device->STATS.ERRORS++;
+	}
+
+	if(entry->CALLBACK != NULL)
+	{
+		entry->CALLBACK(entry->CONTEXT, status);
+	}
+
+	primask = __get_PRIMASK();
+	__disable_irq();
+	entry->NEXT = bus->FREE;
+	bus->FREE = entry;
+	bus->QUEUED--;
+	__set_PRIMASK(primask);
+}
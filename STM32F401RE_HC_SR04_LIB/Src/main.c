@@ -23,6 +23,9 @@
 #include "systick.h"
 #include "i2c.h"
 #include "lcd.h"
+#include "rcc.h"
+#include "dwt.h"
+#include "i2c_bus.h"
 #include <stdio.h>
 #include <stdint.h>
 
@@ -31,11 +34,18 @@ static void tim2_callback(void);
 
 /* TESTS: */
 #define HCSR04_TEST
+//#define I2C_BUS_TEST //un-comment (and comment out HCSR04_TEST) to share I2C3 between the LCD and a missing sensor through the bus manager, view results with live expressions
 
-//prescaler value for the timer
-//sysclock = 16MHz by default,
-//16MHz clk/100KHz = 160, 100KHz = 10us
-const int PRESCALER = 160;
+//frequency the timer counts at, 100KHz = 10us per count.
+//the prescaler for this is worked out in main() from the timer clock,
+//84MHz clk/100KHz = 840
+const int TIMER_FREQ = 100000;
+
+//frequency the buzzer PWM timer counts at. it was originally given a
+//prescaler of 16000000, which the 16 bit PSC cut down to 9216, so at 16MHz
+//it counted at about 1736Hz. that is kept so the buzzer sounds the same
+//at any clock speed
+const int BUZZER_TIMER_FREQ = 1736;
 
 //period will be as high as possible for the timer
 const int PERIOD = 0xFFFF;
@@ -46,13 +56,12 @@ const int UART_BAUDRATE = 115200;
 //divisor needed to calculate distance in CM, in accordance to the ultrasonic datsheet
 const int CM_DIVISOR = 58;
 
-//a 10uS timer is being used and the trigger pin is required to be high for at least 10uS to activate the echo pin.
-//a check of the timer count being equal to 1 would mean that 10uS has past, therefore the trigger pin can be set to low,
-//since enough time has past for the echo pin to begin its signal
-const int TEN_MICROSECONDS_COUNT = 1;
+//the trigger pin is required to be high for at least 10uS to activate the echo pin, this is timed with the
+//DWT cycle counter so the timer is only needed for the echo input capture
+const int TRIGGER_PULSE_MICROSECONDS = 10;
 
-//the ultrasonic datasheet recommends a 60ms delay between measurements, this delay will occur using the SYSTICK timer and
-//will happen before the trigger pin goes high
+//the ultrasonic datasheet recommends a 60ms delay between measurements, this is a deadline on the SYSTICK millisecond
+//count that gets checked before the trigger pin goes high, so the loop isn't blocked while waiting
 const int TRIGGER_DELAY_MILLISECONDS = 60;
 
 //distance measurement in CM that is required to activate the buzzer, in this case it's < 10cm by default
@@ -61,9 +70,6 @@ const int BUZZER_MEASUREMENT = 10;
 //duty cycle for the buzzer PWM timer (TMR3)
 const int PWM_DUTY = 50;
 
-//frequency for the I2C clock speed, in MHz
-const int I2C_FREQ_MHZ = 16;
-
 /*
  * Enumeration to keep track of ultrasonic state
  *
@@ -72,7 +78,7 @@ const int I2C_FREQ_MHZ = 16;
  * TRIGGER_HIGH: set trigger pin high and wait at least 10uS, then set the trigger pin back to low
  * ECHO_RISING: capture timer count during the rising edge of the echo input capture, then change polarity to falling edge
  * ECHO_FALLING: capture timer count during the falling edge of the echo input capture, then disable interrupts
- * MEASUREMENT: compute the distance in CM by using the formula in the ultrasonic datasheet, display over UART, and reset
+ * MEASUREMENT: compute the distance in CM by using the formula in the ultrasonic datasheet, display over UART, queue it for the LCD, and reset
  * 				the state machine back to TRIGGER_HIGH
  */
 typedef enum
@@ -103,29 +109,31 @@ const I2C_SCL_CONFIG SCL_PIN = {
 								GPIOA
 						 	   };
 
-//configuration for I2C3, using the default clock frequency (16MHz) with the
-//configured SDA and SCL lines
+//configuration for I2C3 with the configured SDA and SCL lines,
+//the I2C clock is taken from APB1, SCL at 400KHz so a full LCD redraw
+//takes ~0.7ms instead of ~2.7ms at 100KHz
 I2C_CONFIG MY_I2C = {
 		 	 	 	 SCL_PIN,
 					 SDA_PIN,
 					 I2C3,
-					 I2C_FREQ_MHZ
+					 I2C_FAST_MODE_FREQ,
+					 I2C_DUTY_2
 					};
 
-//configuration for about 10us timer
+//configuration for about 10us timer, the prescaler is set in main()
 TIM2_5_CONFIG TMR2 = {
 					  TIM2,
 					  TIM2_5_UP,
-					  PRESCALER,
+					  1,
 					  PERIOD
 					 };
 
 //configuration for the PWM timer, the numbers are fairly arbitrary, just picked based on what sounded good based
-//on the noise made from the buzzer
+//on the noise made from the buzzer. the prescaler is set in main()
 TIM2_5_CONFIG TMR3 = {
 					  TIM3,
 					  TIM2_5_UP,
-					  PRESCALER * 100000,
+					  1,
 					  PERIOD / 500
 					 };
 
@@ -174,10 +182,100 @@ volatile int previousMeasurement = 0;
 //enum to keep track of current state of ultrasonic sensor
 ULTRASONIC_STATE CURRENT_STATE = TRIGGER_HIGH;
 
+//millis() value at which the next trigger is allowed
+uint64_t nextTrigger = 0;
+
 //char buffer for uart transmitting
 char str[30];
+
+//char buffer for the distance bar on the LCD
+char lcdBar[LCD_COLS + 1];
+
+//the LCD is drawn in the background, only the characters that change are sent to it
+LCD_RENDER LCD;
+
+//distance the bar graph on the second line of the LCD is full at
+const int BAR_MAX_CM = 200;
+
+//the bar graph has 5 steps per character, character code n has the left n columns filled.
+//code 0 isn't used since it would end the string given to lcd_printf()
+const uint8_t BAR_GLYPHS[5][LCD_GLYPH_ROWS] = {
+												{0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10},
+												{0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18},
+												{0x1C, 0x1C, 0x1C, 0x1C, 0x1C, 0x1C, 0x1C, 0x1C},
+												{0x1E, 0x1E, 0x1E, 0x1E, 0x1E, 0x1E, 0x1E, 0x1E},
+												{0x1F, 0x1F, 0x1F, 0x1F, 0x1F, 0x1F, 0x1F, 0x1F}
+											  };
+
+/*
+ * Function to make the distance into a bar of custom characters
+ *
+ * Only the end of the bar changes between measurements, so usually
+ * only one or two characters have to be sent
+ */
+static void make_bar(char* bar, int cm)
+{
+	int steps = (cm * LCD_COLS * 5) / BAR_MAX_CM;
+
+	for(uint8_t col = 0; col < LCD_COLS; col++)
+	{
+		int fill = steps - col * 5;
+
+		if(fill >= 5)
+		{
+			bar[col] = 5;
+		}
+		else if(fill > 0)
+		{
+			bar[col] = fill;
+		}
+		else
+		{
+			bar[col] = ' ';
+		}
+	}
+
+	bar[LCD_COLS] = '\0';
+}
+
+#ifdef I2C_BUS_TEST
+	//I2C3 shared by the LCD and a sensor, the sensor's reads go first
+	I2C_BUS BUS;
+	I2C_DEVICE LCD_DEVICE;
+	I2C_DEVICE SENSOR_DEVICE;
+
+	//no sensor is fitted at this address, so every read should be NACKed
+	const uint8_t SENSOR_ADDR = 0x68;
+
+	//order the transactions finished in, LCD writes are 0-7 and sensor reads are 100-103
+	volatile int finishOrder[12];
+	volatile int finished = 0;
+
+	//callback for each finished transaction, context is its number
+	void bus_done(void* context, I2C_STATUS status)
+	{
+		if(finished < 12)
+		{
+			finishOrder[finished] = (int)context;
+		}
+
+		finished++;
+	}
+#endif
 int main(void)
 {
+	//run at 84MHz from the PLL (HSI as the source), this has to happen before
+	//anything else is initialized since the libraries set up their clock
+	//dividers from it
+	rcc_init(RCC_SOURCE_HSI);
+
+	//start the 1ms SYSTICK count and the cycle counter, after the clock is set
+	systick_init();
+	dwt_init();
+
+	//work out the timer prescalers for the clock that is now running
+	TMR2.PRESCALER = tim2_5_prescaler(TMR2, TIMER_FREQ);
+	TMR3.PRESCALER = tim2_5_prescaler(TMR3, BUZZER_TIMER_FREQ);
 
 	//init uart at 115200 baud
 	uart_init(UART2, UART_BAUDRATE);
@@ -188,8 +286,12 @@ int main(void)
 	//initialize the PWM timer for the buzzer at 50% duty rising edge
 	tim2_5_init_pwm(TMR3, BUZZER_PIN, PWM_DUTY, TIM2_5_RISING_EDGE);
 
-	//initialize i2c for I2C3 and the LCD
+	//initialize i2c for I2C3 and the LCD, the LCD only
+	//has to be set up (and cleared) once
 	i2c_init(MY_I2C);
+	lcd_init(MY_I2C);
+	lcd_load_glyphs(MY_I2C, 1, BAR_GLYPHS, 5);
+	lcd_render_init(&LCD, MY_I2C);
 
 
 	#ifdef HCSR04_TEST
@@ -198,13 +300,22 @@ int main(void)
 		tim2_5_enable(TMR2);
 		while(1)
 		{
+			//send anything new to the LCD if it has finished the last update,
+			//this only starts the transfer so it can't hold up a measurement
+			lcd_render_poll(&LCD);
+
 			//gpio_toggle_output(GPIOA, BUZZER_PIN);
 			//switch
 			switch (CURRENT_STATE)
 			{
 				case TRIGGER_HIGH:
-					//wait 60ms before next trigger
-					systickDelayMS(TRIGGER_DELAY_MILLISECONDS);
+					//stay in this state until 60ms have past since the last trigger
+					if(!deadline_expired(nextTrigger))
+					{
+						break;
+					}
+
+					nextTrigger = millis() + TRIGGER_DELAY_MILLISECONDS;
 
 					//generate a timer event, to reset the counter register
 					tim2_5_generate_event(TMR2);
@@ -213,7 +324,7 @@ int main(void)
 					gpio_output_bit_setreset(GPIOA, TRIGGER_PIN, GPIOx_BSRR_SET);
 
 					//wait 10us while trigger is high, as datasheet states
-					while(!(TMR2.TMR->CNT == TEN_MICROSECONDS_COUNT));
+					delay_us(TRIGGER_PULSE_MICROSECONDS);
 
 					//set trigger pin back to low
 					gpio_output_bit_setreset(GPIOA, TRIGGER_PIN, GPIOx_BSRR_RESET);
@@ -251,15 +362,19 @@ int main(void)
 						tim2_5_disable(TMR3);
 					}
 
+					//only queued here, lcd_render_poll() draws the latest of these in the
+					//background. only the digits and the end of the bar that changed go out
 					if(measurement != previousMeasurement)
 					{
 						previousMeasurement = measurement;
-						lcd_init(MY_I2C);
-						lcd_write(MY_I2C, str);
+						make_bar(lcdBar, measurement);
+						lcd_printf(&LCD, 0, 0, "%i CM", measurement);
+						lcd_printf(&LCD, 1, 0, "%s", lcdBar);
 					}
 
-					//write the distance to uart using the str buffer
-					uart_write_string(USART2, str);
+					//queue the distance to be sent over uart using the str buffer, the USART2
+					//interrupt sends it so the next measurement doesn't wait on the transmit
+					uart_write_string_it(USART2, str);
 
 					//set the state back to trigger high to begin another measurement
 					CURRENT_STATE = TRIGGER_HIGH;
@@ -267,6 +382,36 @@ int main(void)
 			}
 		}
 	#endif
+
+	#ifdef I2C_BUS_TEST
+		i2c_bus_init(&BUS, MY_I2C);
+		i2c_bus_device_init(&LCD_DEVICE, LCD_SLAVE_ADDR, I2C_BUS_PRIORITY_NORMAL);
+		i2c_bus_device_init(&SENSOR_DEVICE, SENSOR_ADDR, I2C_BUS_PRIORITY_HIGH);
+
+		//the data control byte, then the characters
+		static const uint8_t text[] = {LCD_CONTROL_DATA, 'B', 'U', 'S'};
+		static const uint8_t sensorReg = 0x75;
+		static uint8_t sensorValue[4];
+
+		//the first LCD write gets the bus straight away, the sensor reads queued
+		//after the LCD writes should still go before the rest of them
+		for(int i = 0; i < 8; i++)
+		{
+			i2c_bus_submit(&BUS, &LCD_DEVICE, text, sizeof(text), NULL, 0, bus_done, (void*)i);
+		}
+
+		for(int i = 0; i < 4; i++)
+		{
+			i2c_bus_submit(&BUS, &SENSOR_DEVICE, &sensorReg, 1, &sensorValue[i], 1, bus_done, (void*)(100 + i));
+		}
+
+		while(i2c_bus_pending(&BUS));
+
+		//expect finishOrder = 0, 100, 101, 102, 103, 1 .. 7
+		//LCD_DEVICE.STATS: TRANSFERS = 8, NACKS = 0
+		//SENSOR_DEVICE.STATS: TRANSFERS = 4, NACKS = 4, MAX_LATENCY_US well under the LCD's
+		while(1);
+	#endif
 }
 
 /*
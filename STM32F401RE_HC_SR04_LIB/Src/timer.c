@@ -13,6 +13,7 @@
  */
 #include "timer.h"
 #include "gpio.h"
+#include "rcc.h"
 #include "stm32f4xx.h"
 
 void tim2_5_init_output_compare(TIM2_5_CONFIG timer, TIM2_5_CAPTURE_COMPARE_CONFIG compare);
@@ -160,7 +161,8 @@ void tim2_5_init(TIM2_5_CONFIG timer)
 	}
 
 	//set the prescaler and period
-	//clock speed (16MHz)/(prescaler * period) = desired delay
+	//timer clock/(prescaler * period) = desired frequency
+	//(see tim2_5_get_clk() for the timer clock)
 	if(timer.PRESCALER >= 0)
 	{
 		timer.TMR->PSC = timer.PRESCALER - 1;
@@ -197,6 +199,56 @@ void tim2_5_init(TIM2_5_CONFIG timer)
 	}
 }
 
+/*
+ * Function to return the clock that TIM2-5 count from, in Hz
+ *
+ * TIM2-5 are all on APB1, and get twice the APB1 clock whenever
+ * the APB1 prescaler isn't 1 (16MHz by default, 84MHz with rcc_init())
+ *
+ * Returns 0 if TMR isn't one of TIM2-5, since its bus isn't known
+ *
+ * Figure 12 in Ref Manual
+ */
+uint32_t tim2_5_get_clk(TIM2_5_CONFIG timer)
+{
+	if(timer.TMR != TIM2 && timer.TMR != TIM3 && timer.TMR != TIM4 && timer.TMR != TIM5)
+	{
+		return 0;
+	}
+
+	return rcc_get_timclk1();
+}
+
+/*
+ * Function to work out the PRESCALER value for the timer to count at
+ * the given frequency in Hz, based on the current timer clock. The result
+ * is rounded to the nearest whole prescaler.
+ *
+ * Returns -1 if the frequency can't be reached, since PSC is only 16 bits
+ * the prescaler has to be from 1 to 65536
+ *
+ * 13.4.11 in Ref Manual
+ */
+int tim2_5_prescaler(TIM2_5_CONFIG timer, uint32_t frequency)
+{
+	uint32_t clk = tim2_5_get_clk(timer);
+	uint32_t prescaler;
+
+	if(frequency == 0 || frequency > clk)
+	{
+		return -1;
+	}
+
+	prescaler = (clk + (frequency / 2)) / frequency;
+
+	if(prescaler > 65536)
+	{
+		return -1;
+	}
+
+	return prescaler;
+}
+
 /*
  * Function to initialize + enable the timer immediately
  */
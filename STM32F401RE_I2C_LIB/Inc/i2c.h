@@ -18,6 +18,25 @@
 #include "gpio.h"
 #include "stm32f4xx.h"
 #include "uart.h"
+#include "dma.h"
+
+//highest SCL frequency for standard mode and fast mode, in Hz
+//18.3.1 in Ref Manual
+#define I2C_STANDARD_MODE_FREQ	100000
+#define I2C_FAST_MODE_FREQ		400000
+
+//longest a blocking function waits on the I2C before taking the bus to be
+//hung, and the time a queued transfer gets on top of its bytes, in us
+#define I2C_TIMEOUT_US		1000
+
+//clocks sent by i2c_recover(), enough for a slave stuck part
+//way through sending a byte to finish it (8 bits + ACK)
+#define I2C_RECOVERY_CLOCKS	9
+
+//payloads of at least this many bytes are moved by DMA in i2c_transfer(),
+//shorter ones are moved from the event interrupt (one interrupt per byte).
+//this has to stay at 2 or more, DMA can't close a 1 byte read
+#define I2C_DMA_THRESHOLD	4
 
 /*
  * Enumeration to keep track of all available
@@ -70,36 +89,200 @@ typedef struct
 	GPIO_TypeDef* GPIO_PORT;
 } I2C_SCL_CONFIG;
 
+/*
+ * Low/high ratio of SCL in fast mode (DUTY bit), 16:9
+ * lets 400KHz be hit exactly with PCLK1 a multiple of 10MHz
+ *
+ * 18.6.8 in Ref Manual
+ */
+typedef enum
+{
+	I2C_DUTY_2,
+	I2C_DUTY_16_9
+}I2C_DUTY;
+
 /*
  * Struct for configuring I2C. Holds the
  * SCL and SDA pin configurations, and chosen I2C
- * interface. The frequency is also set, from
- * 2 to 50 MHz.
+ * interface. The peripheral clock frequency is
+ * taken from the APB1 clock (see rcc.h).
+ *
+ * SPEED_HZ is the SCL frequency, up to I2C_STANDARD_MODE_FREQ
+ * is standard mode and up to I2C_FAST_MODE_FREQ is fast mode,
+ * 0 is taken as I2C_STANDARD_MODE_FREQ. DUTY is only used in
+ * fast mode.
  */
 typedef struct
 {
 	I2C_SCL_CONFIG SCL_CONFIG;
 	I2C_SDA_CONFIG SDA_CONFIG;
 	I2C_TypeDef * I2C;
-	int FREQ_IN_MHz;
+	uint32_t SPEED_HZ;
+	I2C_DUTY DUTY;
 }I2C_CONFIG;
 
-//function to initialize I2C
-void i2c_init(I2C_CONFIG i2c);
+/*
+ * Register values for the SCL timing, FREQ goes in
+ * CR2, CCR is the whole CCR register (F/S and DUTY
+ * included) and TRISE goes in TRISE
+ *
+ * 18.6.2/18.6.8/18.6.9 in Ref Manual
+ */
+typedef struct
+{
+	uint8_t FREQ;
+	uint16_t CCR;
+	uint8_t TRISE;
+}I2C_TIMING;
 
-//function to generate a start condition for I2C
-void i2c_start(I2C_CONFIG i2c);
+/*
+ * Result of a transfer given to i2c_transfer()
+ *
+ * I2C_STATUS_BUSY while it is queued or on the bus, and one
+ * of the others once it is finished. NACK means the slave didn't
+ * acknowledge its address or a byte (AF), TIMEOUT that the transfer
+ * ran out of time and the bus was recovered, the rest match the error
+ * flags in 18.6.6 in Ref Manual
+ *
+ * Also used by i2c_error() for the blocking functions
+ */
+typedef enum
+{
+	I2C_STATUS_OK,
+	I2C_STATUS_BUSY,
+	I2C_STATUS_NACK,
+	I2C_STATUS_BUS_ERROR,
+	I2C_STATUS_ARB_LOST,
+	I2C_STATUS_OVERRUN,
+	I2C_STATUS_DMA_ERROR,
+	I2C_STATUS_TIMEOUT
+}I2C_STATUS;
+
+//callback for a finished transfer, context is whatever was set in the I2C_TRANSFER
+typedef void (*I2C_CALLBACK)(void* context, I2C_STATUS status);
+
+/*
+ * Struct for one non-blocking transaction
+ *
+ * TX_SIZE bytes from TX_DATA are written to the 7-bit ADDRESS, then if
+ * RX_SIZE isn't 0 a repeated start is sent and RX_SIZE bytes are read
+ * into RX_DATA. With both sizes 0 only the address is sent, which can
+ * be used to check if a slave is there.
+ *
+ * TIMEOUT_US is the longest the transfer can be on the bus before it is
+ * stopped and the bus is recovered, 0 gives it the time its bytes take
+ * at the bus speed (twice over, for clock stretching) + I2C_TIMEOUT_US
+ *
+ * The memory is given by the caller and transfers are queued through
+ * NEXT, so nothing is allocated. The transfer and both buffers have to
+ * stay untouched until STATUS isn't I2C_STATUS_BUSY anymore.
+ */
+typedef struct I2C_TRANSFER
+{
+	uint8_t ADDRESS;
+	const uint8_t* TX_DATA;
+	uint16_t TX_SIZE;
+	uint8_t* RX_DATA;
+	uint16_t RX_SIZE;
+	I2C_CALLBACK CALLBACK;
+	void* CONTEXT;
+	uint32_t TIMEOUT_US;
+	volatile I2C_STATUS STATUS;
+	struct I2C_TRANSFER* NEXT;
+}I2C_TRANSFER;
+
+/*
+ * State for an I2C interface
+ *
+ * HEAD is the transfer on the bus and TAIL the last one queued.
+ * INDEX is the next byte to move in the current direction, READING
+ * is set once the transfer has moved on to its read, and DMA_ACTIVE
+ * while TX_DMA/RX_DMA owns the buffer for the current direction.
+ * HEAD went on the bus at START_CYCLES and has TIMEOUT_CYCLES to finish.
+ *
+ * STOPPING is set when the stop of the last transfer is held up by a
+ * slave stretching SCL, the next one isn't started until i2c_timeout_poll()
+ * sees STOP clear, and START_CYCLES/TIMEOUT_CYCLES then time the stop. RECOVERING is set
+ * while i2c_timeout_poll() has the pins for i2c_recover().
+ *
+ * CONFIG is the one last given to i2c_init(), so the bus can be recovered
+ * outside of the interrupts. ERROR is why the last blocking function failed,
+ * and RECOVERIES counts the calls to i2c_recover().
+ */
+typedef struct
+{
+	I2C_TypeDef* I2C;
+	DMA_CONFIG TX_DMA;
+	DMA_CONFIG RX_DMA;
+	I2C_TRANSFER* volatile HEAD;
+	I2C_TRANSFER* TAIL;
+	uint16_t INDEX;
+	int READING;
+	int DMA_ACTIVE;
+	volatile int STOPPING;
+	volatile int RECOVERING;
+	I2C_CONFIG CONFIG;
+	uint32_t START_CYCLES;
+	uint32_t TIMEOUT_CYCLES;
+	I2C_STATUS ERROR;
+	volatile uint32_t RECOVERIES;
+}I2C_ASYNC;
+
+//function to work out the SCL timing for the given APB1 clock and SCL frequency in Hz, returns -1 if it can't meet the I2C spec
+int i2c_timing(uint32_t pclk1, uint32_t speed, I2C_DUTY duty, I2C_TIMING* timing);
+
+//function to initialize I2C, returns -1 if the SCL frequency can't be made from the APB1 clock
+int i2c_init(I2C_CONFIG i2c);
+
+//function to generate a start condition for I2C, returns -1 if it couldn't be sent (see i2c_error())
+int i2c_start(I2C_CONFIG i2c);
 
 //function to generate a stop condition
 void i2c_stop(I2C_CONFIG i2c);
 
-//function to transmit data to a slave
-void i2c_write(I2C_CONFIG i2c, uint8_t data);
+//function to transmit data to a slave, returns -1 if it wasn't acknowledged or timed out (see i2c_error())
+int i2c_write(I2C_CONFIG i2c, uint8_t data);
+
+//function to send slave address to the master, returns -1 if it wasn't acknowledged or timed out (see i2c_error())
+int i2c_send_address(I2C_CONFIG i2c, uint8_t saddr);
+
+//function to transmit multiple bytes of data to a slave, returns -1 if they weren't acknowledged or timed out (see i2c_error())
+int i2c_burst_write(I2C_CONFIG i2c, uint8_t *data, uint8_t size);
+
+//function to read bytes from a slave, ending with a stop, returns -1 on an error or timeout (see i2c_error())
+int i2c_read(I2C_CONFIG i2c, uint8_t saddr, uint8_t* data, uint16_t size);
+
+//function to write bytes to a slave, then read bytes back after a repeated start, returns -1 on an error or timeout (see i2c_error())
+int i2c_write_read(I2C_CONFIG i2c, uint8_t saddr, const uint8_t* txData, uint16_t txSize, uint8_t* rxData, uint16_t rxSize);
+
+//function to read bytes from a slave starting at the given register, returns -1 on an error or timeout (see i2c_error())
+int i2c_read_register(I2C_CONFIG i2c, uint8_t saddr, uint8_t reg, uint8_t* data, uint16_t size);
+
+//function to read one register of a slave, returns the value or -1 on an error or timeout (see i2c_error())
+int i2c_read_register_byte(I2C_CONFIG i2c, uint8_t saddr, uint8_t reg);
+
+//function to read bytes from a slave with DMA, returns -1 if there is no DMA stream for the I2C, size is less than 2, or on an error or timeout
+int i2c_read_dma(I2C_CONFIG i2c, uint8_t saddr, uint8_t* data, uint16_t size);
+
+//function to return why the last blocking function on the given I2C returned -1
+I2C_STATUS i2c_error(I2C_TypeDef* I2C);
+
+//function to free a bus held by a slave by clocking SCL from GPIO, then set the I2C up again, returns -1 if SDA is still held low
+int i2c_recover(I2C_CONFIG i2c);
+
+//function to queue a transfer and start it if the bus is free, returns -1 if the transfer isn't valid (i2c_busy() or i2c_timeout_poll() still has to be polled to catch timeouts)
+int i2c_transfer(I2C_TypeDef* I2C, I2C_TRANSFER* transfer);
+
+//function to check if there are transfers queued or on the bus, this also checks the transfer on the bus for a timeout
+int i2c_busy(I2C_TypeDef* I2C);
+
+//function to start the next queued transfer once the last stop has gone out, and stop the transfer on the bus and recover the bus if it has run out of time
+void i2c_timeout_poll(I2C_TypeDef* I2C);
 
-//function to send slave address to the master
-void i2c_send_address(I2C_CONFIG i2c, uint8_t saddr);
+//function to handle an I2C event interrupt, called from the I2Cx_EV_IRQHandler's in i2c.c
+void i2c_ev_irq_handler(I2C_TypeDef* I2C);
 
-//function to transmit multiple bytes of data to a slave
-void i2c_burst_write(I2C_CONFIG i2c, uint8_t *data, uint8_t size);
+//function to handle an I2C error interrupt, called from the I2Cx_ER_IRQHandler's in i2c.c
+void i2c_er_irq_handler(I2C_TypeDef* I2C);
 
 #endif /* I2C_H_ */
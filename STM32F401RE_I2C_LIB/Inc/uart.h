@@ -15,6 +15,8 @@
 #ifndef UART_H_
 #define UART_H_
 #include "stm32f401xe.h"
+#include "dma.h"
+#include <stddef.h>
 
 //bits to enable USARTx on APB1/APB2 bus
 //6.3.11/6.3.12 in Ref Manual
@@ -22,15 +24,15 @@
 #define USART1_EN	     (1U<<4) //APB2
 #define USART6_EN	     (1U<<5) //APB2
 
-//default clock speed for APB1 and APB2 in Hz
-#define APB1_FREQ	     16000000
-#define APB2_FREQ	     16000000 //not sure about this one?
-
 //bits for enabling USART/TX/RX in CR1
 //19.6.4 in Ref Manual
 #define USART_CR1_TXEN    (1U<<3)
 #define USART_CR1_RXEN    (1U<<2)
 
+//size of the interrupt driven transmit ring buffer for each USART,
+//this needs to be a power of 2 so the indexes can wrap with a mask
+#define UART_TX_BUFFER_SIZE	256
+
 /*
  * USARTx RX can be configured to different
  * pins for each USARTx
@@ -77,9 +79,109 @@ typedef struct
 	GPIO_TypeDef* PORT;
 }UART_CONFIG;
 
+/*
+ * Result of the baudrate calculation
+ *
+ * BRR is the value for the USART_BRR register, OVER8 = 1 if 8 times
+ * oversampling is needed, BAUDRATE is the baudrate that will actually
+ * be produced, and ERROR_PPM is how far off that is from the requested
+ * one in parts per million (+ = faster)
+ */
+typedef struct
+{
+	uint32_t BRR;
+	int OVER8;
+	uint32_t BAUDRATE;
+	int32_t ERROR_PPM;
+}UART_BAUD;
+
+/*
+ * Ring buffer for interrupt driven transmitting.
+ *
+ * HEAD is only moved by the writer and TAIL is only moved
+ * by the interrupt, both are free running counters that get
+ * masked when indexing DATA, so HEAD - TAIL is always the
+ * number of bytes waiting to be sent
+ */
+typedef struct
+{
+	uint8_t DATA[UART_TX_BUFFER_SIZE];
+	volatile uint32_t HEAD;
+	volatile uint32_t TAIL;
+}UART_TX_RING;
+
+/*
+ * Callback for a finished DMA transmit, called from the
+ * DMA transfer complete interrupt with the USART that sent it
+ */
+typedef void (*UART_DMA_CALLBACK)(USART_TypeDef* USART);
+
+/*
+ * DMA transmit state for a USART, BUSY is set while
+ * the DMA stream still owns the caller's buffer
+ */
+typedef struct
+{
+	DMA_CONFIG DMA;
+	USART_TypeDef* USART;
+	UART_DMA_CALLBACK CALLBACK;
+	volatile int BUSY;
+}UART_DMA_TX;
+
+/*
+ * Callback for received data, called from interrupts with the
+ * part of the receive buffer that has been filled since the last call.
+ * The data has to be used (or copied) before the DMA comes back
+ * around the buffer to the same spot.
+ */
+typedef void (*UART_RX_CALLBACK)(USART_TypeDef* USART, const uint8_t* data, size_t length);
+
+/*
+ * Receive counters for a USART, BYTES is the total delivered through
+ * the callback, OVERRUNS the number of times ORE was set (a byte was lost
+ * because the data register wasn't read in time) and CHUNKS the number
+ * of callbacks
+ *
+ * FRAMING_ERRORS, NOISE_ERRORS and PARITY_ERRORS count FE, NF and PE,
+ * the byte is still received but may be corrupt
+ */
+typedef struct
+{
+	uint32_t BYTES;
+	uint32_t OVERRUNS;
+	uint32_t CHUNKS;
+	uint32_t FRAMING_ERRORS;
+	uint32_t NOISE_ERRORS;
+	uint32_t PARITY_ERRORS;
+}UART_RX_STATS;
+
+/*
+ * Circular DMA receive state for a USART
+ *
+ * POSITION is the index in BUFFER up to which data has already
+ * been given to the callback
+ */
+typedef struct
+{
+	DMA_CONFIG DMA;
+	USART_TypeDef* USART;
+	uint8_t* BUFFER;
+	uint16_t SIZE;
+	uint16_t POSITION;
+	UART_RX_CALLBACK CALLBACK;
+	volatile int ACTIVE;
+	volatile UART_RX_STATS STATS;
+}UART_DMA_RX;
+
 //USART init function
 void uart_init(UART_CONFIG UART, uint32_t baudrate);
 
+//function to calculate the BRR value for a baudrate from the peripheral clock in Hz, returns -1 if it can't be reached
+int uart_baud_solve(uint32_t pclk, uint32_t baudrate, UART_BAUD* result);
+
+//function to return the baudrate settings that were last applied to the given USART
+UART_BAUD uart_get_baud(USART_TypeDef* USART);
+
 //function to write to transmit data over USART
 void uart_write(USART_TypeDef* USART, int ch);
 
@@ -88,4 +190,43 @@ void uart_write_string(USART_TypeDef* USART, char* str);
 
 //function to read data register, when it's status is not empty
 char uart_read(USART_TypeDef* USART);
+
+//function to queue data to be sent by the USART interrupt, returns how many bytes were accepted
+size_t uart_write_it(USART_TypeDef* USART, const uint8_t* data, size_t length);
+
+//function to queue a full string to be sent by the USART interrupt, returns how many bytes were accepted
+size_t uart_write_string_it(USART_TypeDef* USART, const char* str);
+
+//function to return how many bytes can still be queued for the given USART
+size_t uart_tx_free(USART_TypeDef* USART);
+
+//function to wait until everything queued has been fully sent
+void uart_flush(USART_TypeDef* USART);
+
+//function to handle USARTx interrupts, called from the USARTx_IRQHandler's in uart.c
+void uart_irq_handler(USART_TypeDef* USART);
+
+//function to copy data into a transmit ring buffer, returns how many bytes fit
+size_t uart_tx_ring_push(UART_TX_RING* ring, const uint8_t* data, size_t length);
+
+//function to service TXE/TC for the given USART and ring buffer
+void uart_tx_ring_irq(USART_TypeDef* USART, UART_TX_RING* ring);
+
+//function to send a buffer with DMA without copying it, returns 0 if started and -1 if it couldn't be
+int uart_write_dma(USART_TypeDef* USART, const uint8_t* data, size_t length, UART_DMA_CALLBACK callback);
+
+//function to check if a DMA transmit is still in progress for the given USART
+int uart_dma_busy(USART_TypeDef* USART);
+
+//function to start receiving into buffer with circular DMA, returns 0 if started and -1 if it couldn't be
+int uart_read_dma_start(USART_TypeDef* USART, uint8_t* buffer, size_t size, UART_RX_CALLBACK callback);
+
+//function to stop a circular DMA receive
+void uart_read_dma_stop(USART_TypeDef* USART);
+
+//function to return the receive counters for the given USART
+UART_RX_STATS uart_rx_stats(USART_TypeDef* USART);
+
+//function to hand everything received up to the given DMA position to the callback
+void uart_dma_rx_process(UART_DMA_RX* rx, uint16_t position);
 #endif /* UART_H_ */
@@ -0,0 +1,423 @@
+/**
+ ******************************************************************************
+ * @file           : dma.c
+ * @author         : Nubal Manhas
+ * @brief          : Main c file for DMA library
+ ******************************************************************************
+ * @purpose
+ *
+ * The purpose of this file is to define functions that will support DMA
+ * for the STM32F01RE MCU
+ *
+ ******************************************************************************
+ */
+#include "dma.h"
+#include <stddef.h>
+
+//all interrupt flags for one stream (FEIF, DMEIF, TEIF, HTIF, TCIF),
+//before being shifted into the stream's position
+//9.5.1 in Ref Manual
+#define DMA_STREAM_FLAGS	(DMA_LISR_FEIF0 | DMA_LISR_DMEIF0 | DMA_LISR_TEIF0 | DMA_LISR_HTIF0 | DMA_LISR_TCIF0)
+
+//function to return the bit position of a streams flags within LISR/HISR
+uint32_t dma_flag_shift(DMA_STREAM_NUM stream);
+
+//function to enable the DMA stream interrupt within the NVIC
+void dma_nvic_enable(DMA_CONFIG dma);
+
+//streams for each controller, in order of stream number
+static DMA_Stream_TypeDef* const DMA1_STREAMS[8] = {
+													DMA1_Stream0, DMA1_Stream1, DMA1_Stream2, DMA1_Stream3,
+													DMA1_Stream4, DMA1_Stream5, DMA1_Stream6, DMA1_Stream7
+												   };
+
+static DMA_Stream_TypeDef* const DMA2_STREAMS[8] = {
+													DMA2_Stream0, DMA2_Stream1, DMA2_Stream2, DMA2_Stream3,
+													DMA2_Stream4, DMA2_Stream5, DMA2_Stream6, DMA2_Stream7
+												   };
+
+//interrupt numbers for each stream, Table 38 in Ref Manual
+static const IRQn_Type DMA1_IRQS[8] = {
+									   DMA1_Stream0_IRQn, DMA1_Stream1_IRQn, DMA1_Stream2_IRQn, DMA1_Stream3_IRQn,
+									   DMA1_Stream4_IRQn, DMA1_Stream5_IRQn, DMA1_Stream6_IRQn, DMA1_Stream7_IRQn
+									  };
+
+static const IRQn_Type DMA2_IRQS[8] = {
+									   DMA2_Stream0_IRQn, DMA2_Stream1_IRQn, DMA2_Stream2_IRQn, DMA2_Stream3_IRQn,
+									   DMA2_Stream4_IRQn, DMA2_Stream5_IRQn, DMA2_Stream6_IRQn, DMA2_Stream7_IRQn
+									  };
+
+//callbacks and their context for each stream, [0] = DMA1, [1] = DMA2
+static DMA_CALLBACK dma_callbacks[2][8];
+static void* dma_contexts[2][8];
+
+/*
+ * Function to return the register block for the given stream
+ */
+DMA_Stream_TypeDef* dma_get_stream(DMA_CONFIG dma)
+{
+	if(dma.DMA == DMA1)
+	{
+		return DMA1_STREAMS[dma.STREAM];
+	}
+
+	return DMA2_STREAMS[dma.STREAM];
+}
+
+/*
+ * Function to return the position of the given streams flags.
+ *
+ * Streams 0-3 are in LISR/LIFCR and 4-7 are in HISR/HIFCR, but both
+ * use the same positions: 0, 6, 16, 22
+ *
+ * 9.5.1-9.5.4 in Ref Manual
+ */
+uint32_t dma_flag_shift(DMA_STREAM_NUM stream)
+{
+	switch(stream & 3)
+	{
+		case 0:
+			return 0;
+		case 1:
+			return 6;
+		case 2:
+			return 16;
+		default:
+			return 22;
+	}
+}
+
+/*
+ * Function to initialize a DMA stream with the given configuration
+ *
+ * The stream has to be disabled before any of its registers can
+ * be written, so that is done first. The stream is left disabled,
+ * dma_start() enables it.
+ *
+ * 9.3.17 in Ref Manual for the configuration procedure
+ */
+void dma_init(DMA_CONFIG dma)
+{
+	DMA_Stream_TypeDef* stream = dma_get_stream(dma);
+
+	//both DMA controllers are on the AHB1 bus
+	//6.3.9 in Ref Manual
+	if(dma.DMA == DMA1)
+	{
+		RCC->AHB1ENR |= RCC_AHB1ENR_DMA1EN;
+	}
+	else
+	{
+		RCC->AHB1ENR |= RCC_AHB1ENR_DMA2EN;
+	}
+
+	dma_stop(dma);
+	dma_clear_flags(dma);
+
+	//channel, priority, data sizes, increment, circular mode and direction
+	//9.5.5 in Ref Manual
+	stream->CR = (dma.CHANNEL << DMA_SxCR_CHSEL_Pos) |
+				 (dma.PRIORITY << DMA_SxCR_PL_Pos) |
+				 (dma.MEM_SIZE << DMA_SxCR_MSIZE_Pos) |
+				 (dma.PERIPH_SIZE << DMA_SxCR_PSIZE_Pos) |
+				 (dma.DIRECTION << DMA_SxCR_DIR_Pos);
+
+	if(dma.MEM_INCREMENT)
+	{
+		stream->CR |= DMA_SxCR_MINC;
+	}
+
+	if(dma.MODE == DMA_CIRCULAR)
+	{
+		stream->CR |= DMA_SxCR_CIRC;
+	}
+
+	//direct mode can only be used when both sides are the same size,
+	//otherwise the FIFO is needed to pack/unpack the data (half full threshold)
+	//9.3.13/9.5.10 in Ref Manual
+	if(dma.MEM_SIZE == dma.PERIPH_SIZE)
+	{
+		stream->FCR = 0;
+	}
+	else
+	{
+		stream->FCR = DMA_SxFCR_DMDIS | (1U << DMA_SxFCR_FTH_Pos);
+	}
+}
+
+/*
+ * Function to start a transfer
+ *
+ * For peripheral to memory, periphAddr is the source and memAddr the
+ * destination, for memory to peripheral it is the other way around.
+ * count is the number of items of PERIPH_SIZE to move.
+ *
+ * 9.5.6-9.5.8 in Ref Manual
+ */
+void dma_start(DMA_CONFIG dma, uint32_t periphAddr, uint32_t memAddr, uint16_t count)
+{
+	DMA_Stream_TypeDef* stream = dma_get_stream(dma);
+
+	dma_stop(dma);
+
+	//any flags left over from the last transfer have to be cleared
+	//before the stream can be enabled again
+	dma_clear_flags(dma);
+
+	stream->PAR = periphAddr;
+	stream->M0AR = memAddr;
+	stream->NDTR = count;
+
+	stream->CR |= DMA_SxCR_EN;
+}
+
+/*
+ * Function to disable a stream, EN only reads back as 0
+ * once the current transfer has finished
+ *
+ * 9.5.5 in Ref Manual
+ */
+void dma_stop(DMA_CONFIG dma)
+{
+	DMA_Stream_TypeDef* stream = dma_get_stream(dma);
+
+	stream->CR &= ~DMA_SxCR_EN;
+	while(stream->CR & DMA_SxCR_EN);
+}
+
+/*
+ * Function to check if a stream is still enabled, in normal mode
+ * the hardware clears EN once the transfer is complete
+ */
+int dma_busy(DMA_CONFIG dma)
+{
+	return (dma_get_stream(dma)->CR & DMA_SxCR_EN) ? 1 : 0;
+}
+
+/*
+ * Function to return the number of items left to transfer
+ *
+ * 9.5.6 in Ref Manual
+ */
+uint16_t dma_remaining(DMA_CONFIG dma)
+{
+	return (uint16_t)dma_get_stream(dma)->NDTR;
+}
+
+/*
+ * Function to clear every interrupt flag for a stream
+ *
+ * 9.5.3/9.5.4 in Ref Manual
+ */
+void dma_clear_flags(DMA_CONFIG dma)
+{
+	if(dma.STREAM < DMA_STREAM4)
+	{
+		dma.DMA->LIFCR = (DMA_STREAM_FLAGS << dma_flag_shift(dma.STREAM));
+	}
+	else
+	{
+		dma.DMA->HIFCR = (DMA_STREAM_FLAGS << dma_flag_shift(dma.STREAM));
+	}
+}
+
+/*
+ * Function to enable interrupts for a stream
+ *
+ * events is a mask of DMA_EVENT_x, an error event enables both
+ * the transfer error and direct mode error interrupts. The callback
+ * will be called from the interrupt with the events that happened.
+ *
+ * 9.5.5 in Ref Manual
+ */
+void dma_interrupt_enable(DMA_CONFIG dma, uint32_t events, DMA_CALLBACK callback, void* context)
+{
+	DMA_Stream_TypeDef* stream = dma_get_stream(dma);
+	int controller = (dma.DMA == DMA1) ? 0 : 1;
+
+	dma_callbacks[controller][dma.STREAM] = callback;
+	dma_contexts[controller][dma.STREAM] = context;
+
+	stream->CR &= ~(DMA_SxCR_HTIE | DMA_SxCR_TCIE | DMA_SxCR_TEIE | DMA_SxCR_DMEIE);
+
+	if(events & DMA_EVENT_HALF_TRANSFER)
+	{
+		stream->CR |= DMA_SxCR_HTIE;
+	}
+
+	if(events & DMA_EVENT_TRANSFER_COMPLETE)
+	{
+		stream->CR |= DMA_SxCR_TCIE;
+	}
+
+	if(events & DMA_EVENT_ERROR)
+	{
+		stream->CR |= (DMA_SxCR_TEIE | DMA_SxCR_DMEIE);
+	}
+
+	dma_nvic_enable(dma);
+}
+
+/*
+ * Function to disable all interrupts for a stream
+ */
+void dma_interrupt_disable(DMA_CONFIG dma)
+{
+	DMA_Stream_TypeDef* stream = dma_get_stream(dma);
+
+	stream->CR &= ~(DMA_SxCR_HTIE | DMA_SxCR_TCIE | DMA_SxCR_TEIE | DMA_SxCR_DMEIE);
+}
+
+/*
+ * Function for enabling the stream's global interrupt in the NVIC.
+ *
+ * The DMA stream interrupts are spread over the first three ISER
+ * registers (Table 38 in Ref Manual), so the register is picked with
+ * IRQn / 32 and the bit with IRQn % 32
+ *
+ * 4.2.1 in the Cortex-M4 User Guide
+ */
+void dma_nvic_enable(DMA_CONFIG dma)
+{
+	IRQn_Type irq;
+
+	if(dma.DMA == DMA1)
+	{
+		irq = DMA1_IRQS[dma.STREAM];
+	}
+	else
+	{
+		irq = DMA2_IRQS[dma.STREAM];
+	}
+
+	NVIC->ISER[irq >> 5] |= (1U << (irq & 0x1F));
+}
+
+/*
+ * Function to handle a stream interrupt
+ *
+ * The flags that are set get cleared, and the ones with their
+ * interrupt enabled are passed on to the registered callback
+ *
+ * 9.5.1-9.5.4 in Ref Manual
+ */
+void dma_irq_handler(DMA_TypeDef* DMA, DMA_STREAM_NUM stream)
+{
+	int controller = (DMA == DMA1) ? 0 : 1;
+	uint32_t shift = dma_flag_shift(stream);
+	uint32_t cr = (controller == 0) ? DMA1_STREAMS[stream]->CR : DMA2_STREAMS[stream]->CR;
+	uint32_t flags;
+	uint32_t events = 0;
+
+	if(stream < DMA_STREAM4)
+	{
+		flags = (DMA->LISR >> shift) & DMA_STREAM_FLAGS;
+		DMA->LIFCR = (flags << shift);
+	}
+	else
+	{
+		flags = (DMA->HISR >> shift) & DMA_STREAM_FLAGS;
+		DMA->HIFCR = (flags << shift);
+	}
+
+	if((flags & DMA_LISR_HTIF0) && (cr & DMA_SxCR_HTIE))
+	{
+		events |= DMA_EVENT_HALF_TRANSFER;
+	}
+
+	if((flags & DMA_LISR_TCIF0) && (cr & DMA_SxCR_TCIE))
+	{
+		events |= DMA_EVENT_TRANSFER_COMPLETE;
+	}
+
+	if((flags & (DMA_LISR_TEIF0 | DMA_LISR_DMEIF0)) && (cr & (DMA_SxCR_TEIE | DMA_SxCR_DMEIE)))
+	{
+		events |= DMA_EVENT_ERROR;
+	}
+
+	if(events && dma_callbacks[controller][stream] != NULL)
+	{
+		dma_callbacks[controller][stream](dma_contexts[controller][stream], events);
+	}
+}
+
+//interrupt request handlers, check Startup Folder -> startup_stm32f401retx.s for the vector table
+void DMA1_Stream0_IRQHandler(void)
+{
+	dma_irq_handler(DMA1, DMA_STREAM0);
+}
+
+void DMA1_Stream1_IRQHandler(void)
+{
+	dma_irq_handler(DMA1, DMA_STREAM1);
+}
+
+void DMA1_Stream2_IRQHandler(void)
+{
+	dma_irq_handler(DMA1, DMA_STREAM2);
+}
+
+void DMA1_Stream3_IRQHandler(void)
+{
+	dma_irq_handler(DMA1, DMA_STREAM3);
+}
+
+void DMA1_Stream4_IRQHandler(void)
+{
+	dma_irq_handler(DMA1, DMA_STREAM4);
+}
+
+void DMA1_Stream5_IRQHandler(void)
+{
+	dma_irq_handler(DMA1, DMA_STREAM5);
+}
+
+void DMA1_Stream6_IRQHandler(void)
+{
+	dma_irq_handler(DMA1, DMA_STREAM6);
+}
+
+void DMA1_Stream7_IRQHandler(void)
+{
+	dma_irq_handler(DMA1, DMA_STREAM7);
+}
+
+void DMA2_Stream0_IRQHandler(void)
+{
+	dma_irq_handler(DMA2, DMA_STREAM0);
+}
+
+void DMA2_Stream1_IRQHandler(void)
+{
+	dma_irq_handler(DMA2, DMA_STREAM1);
+}
+
+void DMA2_Stream2_IRQHandler(void)
+{
+	dma_irq_handler(DMA2, DMA_STREAM2);
+}
+
+void DMA2_Stream3_IRQHandler(void)
+{
+	dma_irq_handler(DMA2, DMA_STREAM3);
+}
+
+void DMA2_Stream4_IRQHandler(void)
+{
+	dma_irq_handler(DMA2, DMA_STREAM4);
+}
+
+void DMA2_Stream5_IRQHandler(void)
+{
+	dma_irq_handler(DMA2, DMA_STREAM5);
+}
+
+void DMA2_Stream6_IRQHandler(void)
+{
+	dma_irq_handler(DMA2, DMA_STREAM6);
+}
+
+void DMA2_Stream7_IRQHandler(void)
+{
+	dma_irq_handler(DMA2, DMA_STREAM7);
+}
@@ -0,0 +1,137 @@
+/**
+ ******************************************************************************
+ * @file           : dwt.c
+ * @author         : Nubal Manhas
+ * @brief          : Main c file for DWT cycle counter library
+ ******************************************************************************
+ * @purpose
+ *
+ * The purpose of this file is to define functions that will support
+ * timing with the DWT cycle counter for the STM32F01RE MCU
+ *
+ ******************************************************************************
+ */
+#include "dwt.h"
+#include "rcc.h"
+#include "stm32f4xx.h"
+
+//number of cycles in 1us at the current HCLK, set by dwt_init()
+static uint32_t dwt_cycles_per_us = RCC_HSI_FREQ / 1000000;
+
+//SystemCoreClock when dwt_init() was last called, 0 before then. A
+//debugger can have CYCCNT running already, so CYCCNTENA can't be used
+//to tell if dwt_cycles_per_us has been worked out
+static uint32_t dwt_clock = 0;
+
+//longest delay done in one go by delay_us(), in us,
+//so the cycle count can't overflow 32 bits (51s at 84MHz)
+#define DWT_MAX_DELAY_US	1000000
+
+/*
+ * Function to start the cycle counter
+ *
+ * CYCCNT counts every HCLK cycle and wraps around every 2^32
+ * cycles (51s at 84MHz). The DWT is part of the debug logic,
+ * so it has to be turned on with TRCENA first.
+ *
+ * The counter isn't reset, so anything already timing with it
+ * isn't thrown off.
+ *
+ * C1.6.5/C1.8 in ARMv7-M Architecture Reference Manual
+ */
+void dwt_init(void)
+{
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+	dwt_cycles_per_us = rcc_get_hclk() / 1000000;
+	dwt_clock = SystemCoreClock;
+}
+
+/*
+ * Function to return the current cycle count
+ */
+uint32_t cycles_now(void)
+{
+	return DWT->CYCCNT;
+}
+
+/*
+ * Function to return the cycles since start
+ *
+ * Unsigned subtraction wraps the same way the counter does,
+ * so this is correct as long as less than 2^32 cycles have past
+ */
+uint32_t cycles_elapsed(uint32_t start)
+{
+	return DWT->CYCCNT - start;
+}
+
+/*
+ * Function to return the cycles from start to end, see cycles_elapsed()
+ */
+uint32_t cycles_between(uint32_t start, uint32_t end)
+{
+	return end - start;
+}
+
+/*
+ * Function to convert cycles to microseconds (rounded down)
+ */
+uint32_t cycles_to_us(uint32_t cycles)
+{
+	return cycles / dwt_cycles_per_us;
+}
+
+/*
+ * Function to convert microseconds to cycles
+ */
+uint32_t us_to_cycles(uint32_t us)
+{
+	return us * dwt_cycles_per_us;
+}
+
+/*
+ * Function to wait for the given number of cycles
+ *
+ * The cycle counter is started here if dwt_init() hasn't been called
+ * yet. Reading the counter and looping takes a few cycles, so very short
+ * delays will run slightly long.
+ */
+void delay_cycles(uint32_t cycles)
+{
+	uint32_t start;
+
+	if(dwt_clock == 0)
+	{
+		dwt_init();
+	}
+
+	start = DWT->CYCCNT;
+
+	while((DWT->CYCCNT - start) < cycles);
+}
+
+/*
+ * Function to wait for the given number of microseconds, long
+ * delays are split up so the cycle count can't overflow
+ *
+ * rcc.c updates SystemCoreClock whenever HCLK changes, so the
+ * conversion is worked out again after a switch to the PLL
+ */
+void delay_us(uint32_t us)
+{
+	//started before converting, so the conversion uses the current HCLK
+	if(dwt_clock != SystemCoreClock)
+	{
+		dwt_init();
+	}
+
+	while(us > DWT_MAX_DELAY_US)
+	{
+		delay_cycles(us_to_cycles(DWT_MAX_DELAY_US));
+		us -= DWT_MAX_DELAY_US;
+	}
+
+	delay_cycles(us_to_cycles(us));
+}
@@ -13,33 +13,243 @@
  */
 #include "gpio.h"
 #include "i2c.h"
+#include "rcc.h"
+#include "dwt.h"
 
-//clock control value for the master mode clock configuration
-//see i2c_init() to see the math behind it
-#define CRR_VAL 			80
+//max rise time for SCL in standard/fast mode, in ns
+//Table 59. in Datasheet
+#define MAX_RISE_TIME_NS		1000
+#define FAST_MAX_RISE_TIME_NS	300
 
-//max rise time for SCL
-//see i2c_init() to see the math behind it
-#define MAX_TRISE			17
+//min low/high time of SCL in standard/fast mode, in ns
+//Table 59. in Datasheet
+#define MIN_LOW_NS				4700
+#define MIN_HIGH_NS				4000
+#define FAST_MIN_LOW_NS			1300
+#define FAST_MIN_HIGH_NS		600
+
+//fast mode needs at least 4MHz on APB1
+//18.6.2 in Ref Manual
+#define MIN_FAST_PERIPH_FREQ	4
+
+//CCR is 12 bits, and can't be below 4 except with a 16:9 duty
+//18.6.8 in Ref Manual
+#define MAX_CCR					0xFFF
+#define MIN_CCR					4
+
+//half of an SCL period when the bus is clocked by hand in i2c_recover(), 100KHz
+#define RECOVERY_HALF_PERIOD_US	5
+
+//SCL clocks per byte on the bus, 8 bits + ACK
+#define CLOCKS_PER_BYTE			9
+
+//SCL clocks i2c_async_finish() waits for a stop to go out before
+//leaving it to i2c_timeout_poll(), it is at most a clock away
+#define STOP_WAIT_CLOCKS		2
 
 //maximum allowed peripheral clock frequency
-const int MAX_PERIPH_FREQ = 50;
+const uint32_t MAX_PERIPH_FREQ = 50;
 
 //minimum allowed peripheral clock frequency
-const int MIN_PERIPH_FREQ = 2;
+const uint32_t MIN_PERIPH_FREQ = 2;
 
 //function to initialize pins for SCL and SDA
 void i2c_gpio_init(I2C_CONFIG i2c);
+void i2c_nvic_enable(I2C_TypeDef* I2C);
+int i2c_wait(I2C_CONFIG i2c, uint32_t flag);
+uint32_t i2c_bytes_us(I2C_CONFIG i2c, uint32_t bytes);
+uint32_t i2c_clocks_us(I2C_CONFIG i2c, uint32_t clocks);
+I2C_ASYNC* i2c_async_get(I2C_TypeDef* I2C);
+void i2c_async_abort(I2C_ASYNC* async);
+void i2c_async_start(I2C_ASYNC* async);
+void i2c_async_read_start(I2C_ASYNC* async);
+void i2c_async_address(I2C_ASYNC* async);
+void i2c_async_tx(I2C_ASYNC* async, uint32_t sr1);
+void i2c_async_rx(I2C_ASYNC* async, uint32_t sr1);
+void i2c_async_finish(I2C_ASYNC* async, I2C_STATUS status);
+void i2c_async_next(I2C_ASYNC* async);
+void i2c_async_dma_rx_callback(void* context, uint32_t events);
+
+/*
+ * DMA transmit and receive streams for I2C1, I2C2, and I2C3
+ *
+ * I2C1_TX = DMA1 Stream7 Channel1 (Stream6 is taken by USART2_TX)
+ * I2C1_RX = DMA1 Stream0 Channel1 (Stream5 is taken by USART2_RX)
+ * I2C2_TX = DMA1 Stream7 Channel7
+ * I2C2_RX = DMA1 Stream3 Channel7
+ * I2C3_TX = DMA1 Stream4 Channel3
+ * I2C3_RX = DMA1 Stream2 Channel3
+ *
+ * I2C1_TX and I2C2_TX share Stream7 (I2C2_TX has no other stream), so
+ * only one of them can write with DMA at a time. Whichever finds the
+ * stream busy sends its bytes from the event interrupt instead, see
+ * i2c_async_address().
+ *
+ * Receiving gets a higher priority than transmitting,
+ * same as the USART streams in uart.c
+ *
+ * Table 27 in Ref Manual
+ */
+static I2C_ASYNC i2c1_async = {
+							   I2C1,
+							   {DMA1, DMA_STREAM7, DMA_CH1, DMA_MEMORY_TO_PERIPH, DMA_SIZE_BYTE, DMA_SIZE_BYTE, DMA_PRIORITY_MEDIUM, DMA_NORMAL, 1},
+							   {DMA1, DMA_STREAM0, DMA_CH1, DMA_PERIPH_TO_MEMORY, DMA_SIZE_BYTE, DMA_SIZE_BYTE, DMA_PRIORITY_HIGH, DMA_NORMAL, 1}
+							  };
+
+static I2C_ASYNC i2c2_async = {
+							   I2C2,
+							   {DMA1, DMA_STREAM7, DMA_CH7, DMA_MEMORY_TO_PERIPH, DMA_SIZE_BYTE, DMA_SIZE_BYTE, DMA_PRIORITY_MEDIUM, DMA_NORMAL, 1},
+							   {DMA1, DMA_STREAM3, DMA_CH7, DMA_PERIPH_TO_MEMORY, DMA_SIZE_BYTE, DMA_SIZE_BYTE, DMA_PRIORITY_HIGH, DMA_NORMAL, 1}
+							  };
+
+static I2C_ASYNC i2c3_async = {
+							   I2C3,
+							   {DMA1, DMA_STREAM4, DMA_CH3, DMA_MEMORY_TO_PERIPH, DMA_SIZE_BYTE, DMA_SIZE_BYTE, DMA_PRIORITY_MEDIUM, DMA_NORMAL, 1},
+							   {DMA1, DMA_STREAM2, DMA_CH3, DMA_PERIPH_TO_MEMORY, DMA_SIZE_BYTE, DMA_SIZE_BYTE, DMA_PRIORITY_HIGH, DMA_NORMAL, 1}
+							  };
+
+/*
+ * Function to work out the SCL timing registers for the
+ * given APB1 clock and SCL frequency, both in Hz
+ *
+ * The SCL period is made up of a number of PCLK1 periods for the
+ * high and low time, that number being CCR times the duty ratio
+ * (18.6.8 in Ref Manual):
+ *
+ *	standard mode:		T(high) = CCR * T(PCLK1),		T(low) = CCR * T(PCLK1)
+ *	fast mode 2:1:		T(high) = CCR * T(PCLK1),		T(low) = 2 * CCR * T(PCLK1)
+ *	fast mode 16:9:		T(high) = 9 * CCR * T(PCLK1),	T(low) = 16 * CCR * T(PCLK1)
+ *
+ * so CCR = PCLK1 / (speed * (high + low)), rounded up so SCL is never
+ * faster than asked for (80 at 16MHz/100KHz, 35 at 42MHz/400KHz 2:1).
+ *
+ * TRISE is the max SCL rise time in PCLK1 periods + 1, 1000ns in standard
+ * mode and 300ns in fast mode (18.6.9 in Ref Manual), so PCLK1 in MHz + 1
+ * in standard mode (17 at 16MHz, 43 at 42MHz)
+ *
+ * -1 is returned if PCLK1 is out of the 2-50MHz range of FREQ (4MHz for
+ * fast mode), the speed is above fast mode, CCR doesn't fit in 12 bits,
+ * or the high/low times end up shorter than Table 59. in Datasheet
+ */
+int i2c_timing(uint32_t pclk1, uint32_t speed, I2C_DUTY duty, I2C_TIMING* timing)
+{
+	uint32_t freqMHz = pclk1 / 1000000;
+	uint32_t highCycles, lowCycles, riseNs, minLowNs, minHighNs;
+	uint32_t ccr, ccrReg;
+
+	if(speed == 0 || speed > I2C_FAST_MODE_FREQ)
+	{
+		return -1;
+	}
+
+	if(freqMHz < MIN_PERIPH_FREQ || freqMHz > MAX_PERIPH_FREQ)
+	{
+		return -1;
+	}
+
+	if(speed <= I2C_STANDARD_MODE_FREQ)
+	{
+		highCycles = 1;
+		lowCycles = 1;
+		riseNs = MAX_RISE_TIME_NS;
+		minLowNs = MIN_LOW_NS;
+		minHighNs = MIN_HIGH_NS;
+		ccrReg = 0;
+	}
+	else
+	{
+		if(freqMHz < MIN_FAST_PERIPH_FREQ)
+		{
+			return -1;
+		}
+
+		if(duty == I2C_DUTY_16_9)
+		{
+			highCycles = 9;
+			lowCycles = 16;
+			ccrReg = I2C_CCR_FS | I2C_CCR_DUTY;
+		}
+		else
+		{
+			highCycles = 1;
+			lowCycles = 2;
+			ccrReg = I2C_CCR_FS;
+		}
+
+		riseNs = FAST_MAX_RISE_TIME_NS;
+		minLowNs = FAST_MIN_LOW_NS;
+		minHighNs = FAST_MIN_HIGH_NS;
+	}
+
+	ccr = (pclk1 + (speed * (highCycles + lowCycles)) - 1) / (speed * (highCycles + lowCycles));
+
+	if(ccr < MIN_CCR && ccrReg != (I2C_CCR_FS | I2C_CCR_DUTY))
+	{
+		ccr = MIN_CCR;
+	}
+
+	if(ccr > MAX_CCR)
+	{
+		return -1;
+	}
+
+	//check the high/low times in ns against the spec, a rounded up
+	//CCR only makes them longer, but the 2:1 duty at 400KHz has little margin
+	if(((uint64_t)ccr * lowCycles * 1000000000) / pclk1 < minLowNs)
+	{
+		return -1;
+	}
+
+	if(((uint64_t)ccr * highCycles * 1000000000) / pclk1 < minHighNs)
+	{
+		return -1;
+	}
+
+	timing->FREQ = freqMHz;
+	timing->CCR = ccrReg | ccr;
+	timing->TRISE = ((freqMHz * riseNs) / 1000) + 1;
+
+	return 0;
+}
 
 /*
  * Function to initialize I2C on the given
  * I2C interface, SCL pin, and SDA pin.
  * This will initialize in Master Mode.
  *
+ * The SCL timing is worked out from the APB1 clock, so this has to
+ * be called again if the clock changes. Nothing is touched and -1 is
+ * returned if the SCL frequency can't be made (see i2c_timing()).
+ *
+ * The timeouts are timed with the DWT cycle counter, which is started
+ * here, so they work from interrupts as well.
+ *
  * Following 18.3.3 in Ref Manual
  */
-void i2c_init(I2C_CONFIG i2c)
+int i2c_init(I2C_CONFIG i2c)
 {
+	I2C_ASYNC* async = i2c_async_get(i2c.I2C);
+	I2C_TIMING timing;
+	uint32_t speed = i2c.SPEED_HZ;
+
+	if(speed == 0)
+	{
+		speed = I2C_STANDARD_MODE_FREQ;
+	}
+
+	if(i2c_timing(rcc_get_pclk1(), speed, i2c.DUTY, &timing) != 0)
+	{
+		return -1;
+	}
+
+	//kept for i2c_recover() from i2c_timeout_poll()
+	if(async != NULL)
+	{
+		async->CONFIG = i2c;
+	}
+
+	dwt_init();
+
 	i2c_gpio_init(i2c);
 
 	//enable clock access for the given I2C (on APB1 bus)
@@ -64,41 +274,52 @@ void i2c_init(I2C_CONFIG i2c)
 	i2c.I2C->CR1 |= I2C_CR1_SWRST_Msk;
 	i2c.I2C->CR1 &= ~I2C_CR1_SWRST_Msk; //come out of reset after
 
-	//set peripheral clock frequency
-	//the APB1 is limited to 50MHz, a
-	//the minimum allowed frequenecy
-	//is 2MHz
+	//set peripheral clock frequency, this has to match the
+	//APB1 clock (in MHz) that the I2C is running on
 	//18.6.2 in Ref Manual
-	if(i2c.FREQ_IN_MHz > MAX_PERIPH_FREQ)
-	{
-		i2c.FREQ_IN_MHz = MAX_PERIPH_FREQ;
-	}
-
-	if(i2c.FREQ_IN_MHz < MIN_PERIPH_FREQ)
-	{
-		i2c.FREQ_IN_MHz = MIN_PERIPH_FREQ;
-	}
-
-	i2c.I2C->CR2 |= (i2c.FREQ_IN_MHz << I2C_CR2_FREQ_Pos);
+	i2c.I2C->CR2 = (i2c.I2C->CR2 & ~I2C_CR2_FREQ_Msk) | (timing.FREQ << I2C_CR2_FREQ_Pos);
 
-	//CCR is the clock control, and bits 0 to 11 setup the
-	//SCL clock in master mode. This library will stick to
-	//standard mode, and uses T(high) = tr(SCL) + tw(SCLH).
-	//The 't(SCL)' values can be found in Table 59. in the datasheet.
-	//tw(SCLH) = 4us = 4000ns, tr(SCL) = 1000ns, default PCLK1 = 16MHz
-	//based on 18.6.8 in Ref Manual, T(high)/T(PCLK1) = CCR
-	//							     5000ns/(1/16MHz) = 80
-	i2c.I2C->CCR |= CRR_VAL;
+	//SCL clock control (mode, duty and high/low time), this can only
+	//be written while the peripheral is disabled
+	//18.6.8 in Ref Manual
+	i2c.I2C->CCR = timing.CCR;
 
-	//TRISE is the max duration of the SCL feedback loop in master
-	// mode. this boils down to (T/T(PCLK1)) + 1 = TRISE, so
-	//(1000ns/(1/16MHz)) + 1 = 17 = TRISE
-	//18.5.9 in Ref Manual
-	i2c.I2C->TRISE = MAX_TRISE;
+	//max duration of the SCL feedback loop in master mode
+	//18.6.9 in Ref Manual
+	i2c.I2C->TRISE = timing.TRISE;
 
 	//enable I2C peripheral in CR1
 	//18.6.1 in Ref Manual
 	i2c.I2C->CR1 |= I2C_CR1_PE_Msk;
+
+	//the interrupts themselves are only turned on in CR2
+	//while i2c_transfer() has something on the bus
+	i2c_nvic_enable(i2c.I2C);
+
+	return 0;
+}
+
+/*
+ * Function to enable the event and error interrupts
+ * for the given I2C in the NVIC
+ *
+ * Table 38. in Ref Manual for the positions
+ */
+void i2c_nvic_enable(I2C_TypeDef* I2C)
+{
+	if(I2C == I2C1)
+	{
+		NVIC->ISER[0] |= (1U << I2C1_EV_IRQn);
+		NVIC->ISER[1] |= (1U << (I2C1_ER_IRQn - 32));
+	}
+	else if(I2C == I2C2)
+	{
+		NVIC->ISER[1] |= (1U << (I2C2_EV_IRQn - 32)) | (1U << (I2C2_ER_IRQn - 32));
+	}
+	else if(I2C == I2C3)
+	{
+		NVIC->ISER[2] |= (1U << (I2C3_EV_IRQn - 64)) | (1U << (I2C3_ER_IRQn - 64));
+	}
 }
 
 /*
@@ -106,14 +327,14 @@ void i2c_init(I2C_CONFIG i2c)
  *
  * Following 18.3.3 in Ref Manual
  */
-void i2c_start(I2C_CONFIG i2c)
+int i2c_start(I2C_CONFIG i2c)
 {
 	//start generation
 	i2c.I2C->CR1 |= I2C_CR1_START_Msk;
 
 	//wait for start condition, when it is generated SB = 1
 	//18.6.6 in Ref Manual
-	while(!(i2c.I2C->SR1 & I2C_SR1_SB_Msk));
+	return i2c_wait(i2c, I2C_SR1_SB_Msk);
 }
 
 /*
@@ -121,11 +342,14 @@ void i2c_start(I2C_CONFIG i2c)
  *
  * Following Figure 164. in Ref Manual
  */
-void i2c_write(I2C_CONFIG i2c, uint8_t data)
+int i2c_write(I2C_CONFIG i2c, uint8_t data)
 {
 	//wait for TXE (transmitter data register) to be empty (TXE = 1)
 	//18.6.6 in Ref Manual
-	while(!(i2c.I2C->SR1 & I2C_SR1_TXE_Msk));
+	if(i2c_wait(i2c, I2C_SR1_TXE_Msk) != 0)
+	{
+		return -1;
+	}
 
 	//transmit byte to the data register
 	//18.6.5 in Ref Manual
@@ -134,7 +358,7 @@ void i2c_write(I2C_CONFIG i2c, uint8_t data)
 	//wait for byte transfer to finish. the byte transfer flag (BTF)
 	//will go high when this happens
 	//18.6.6 in Ref Manual
-	while(!(i2c.I2C->SR1 & I2C_SR1_BTF_Msk));
+	return i2c_wait(i2c, I2C_SR1_BTF_Msk);
 }
 
 /*
@@ -142,16 +366,23 @@ void i2c_write(I2C_CONFIG i2c, uint8_t data)
  *
  * Following 18.3.3 in Ref Manual
  */
-void i2c_send_address(I2C_CONFIG i2c, uint8_t saddr)
+int i2c_send_address(I2C_CONFIG i2c, uint8_t saddr)
 {
 	//send slave address to the data register (7 bit address)
 	i2c.I2C->DR = saddr << 1;
-	//wait for address (ADDR) to be matched/received
+	//wait for address (ADDR) to be matched/received, a slave that
+	//isn't there gives a NACK (AF) instead
 	//18.6.6 in Ref Manual
-	while(!(i2c.I2C->SR1 & I2C_SR1_ADDR_Msk));
+	if(i2c_wait(i2c, I2C_SR1_ADDR_Msk) != 0)
+	{
+		return -1;
+	}
 	//according to Figure 164. in Ref Manual, ADDR can be reset
 	//by reading the SR1 register, followed by the SR2 register
 	uint8_t tmp = i2c.I2C->SR1 | i2c.I2C->SR2;
+	(void)tmp;
+
+	return 0;
 }
 
 /*
@@ -167,65 +398,1267 @@ void i2c_stop(I2C_CONFIG i2c)
 /*
  * Function to transmit multiple bytes of data, with the given size
  */
-void i2c_burst_write(I2C_CONFIG i2c, uint8_t *data, uint8_t size)
+int i2c_burst_write(I2C_CONFIG i2c, uint8_t *data, uint8_t size)
 {
-	//wait for TXE (transmitter data register) to be empty (TXE = 1)
-	//18.6.6 in Ref Manual
-	while(!(i2c.I2C->SR1 & I2C_SR1_TXE_Msk));
-
-	//following Figure 164. in Ref Manual. data is transmitted, then
-	//wait for TXE to be empty. continue this until all data is sent,
+	//following Figure 164. in Ref Manual. wait for TXE to be empty,
+	//then data is transmitted. continue this until all data is sent,
 	//then wait for the byte transfer flag
+	//18.6.6 in Ref Manual
 	while(size)
 	{
-		while(!(i2c.I2C->SR1 & I2C_SR1_TXE_Msk));
+		if(i2c_wait(i2c, I2C_SR1_TXE_Msk) != 0)
+		{
+			return -1;
+		}
 
 		i2c.I2C->DR = (volatile uint32_t)*data++;
 
 		size--;
 	}
 
-	while(!(i2c.I2C->SR1 & I2C_SR1_BTF_Msk));
+	return i2c_wait(i2c, I2C_SR1_BTF_Msk);
 }
 
 /*
- * Function to initialize both SCL and SDA
- * pins in alternate function mode with the
- * appropriate AF bits set, open drain output,
- * and with pull-ups enabled
+ * Function for master receiver, reads size bytes from the
+ * slave and then generates a stop
+ *
+ * If the last transfer on the bus was a write that hasn't been
+ * stopped, the start here is a repeated start (see i2c_write_read())
+ *
+ * The end of the read has to be set up before the last byte comes in,
+ * the slave is sent ACK for every byte but the last one, which gets
+ * a NACK followed by the stop. How early that can be done depends on
+ * the number of bytes, following 18.3.3 (Closing the communication)
+ * and Figure 165. in Ref Manual:
+ *
+ * - 1 byte:  ACK cleared before ADDR is, STOP straight after
+ * - 2 bytes: POS set so ACK = 0 lands on the second byte, then
+ *            wait for both to be in (BTF) before STOP
+ * - N bytes: read until 3 are left, wait for BTF (N-2 in DR, N-1 in
+ *            the shift register), clear ACK, read N-2, STOP, then
+ *            read N-1 and N
+ *
+ * Interrupts are turned off in between the steps that can't have a gap,
+ * otherwise the last byte could start before ACK/STOP are in place
  */
-void i2c_gpio_init(I2C_CONFIG i2c)
+int i2c_read(I2C_CONFIG i2c, uint8_t saddr, uint8_t* data, uint16_t size)
 {
-	//configure SCL pin, I2C is open drain by
-	//definition, need pull-ups, and requires
-	//alternate function mode with bit AF04 for
-	//all SCL's. Table.9 in Datasheet for the mapping
-	GPIOx_PIN_CONFIG sclPin;
-	sclPin.OTYPER_MODE = GPIOx_OTYPER_OPEN_DRAIN;
-	sclPin.PIN_MODE = GPIOx_PIN_ALTERNATE;
-	sclPin.PUPDR_MODE = GPIOx_PUPDR_PULL_UP;
-	sclPin.ALT_FUNC = GPIOx_ALT_AF4;
-	sclPin.PIN_NUM = i2c.SCL_CONFIG.SCL_PIN;
-	gpio_init(i2c.SCL_CONFIG.GPIO_PORT, sclPin);
+	I2C_TypeDef* I2C = i2c.I2C;
+	volatile uint32_t tmp;
+	uint32_t primask;
 
-	//do the same for the SDA pin, but some of the
-	//pins require AF09 instead of AF04, so check
-	//for those pins
-	GPIOx_PIN_CONFIG sdaPin;
-	sdaPin.OTYPER_MODE = GPIOx_OTYPER_OPEN_DRAIN;
-	sdaPin.PIN_MODE = GPIOx_PIN_ALTERNATE;
-	sdaPin.PUPDR_MODE = GPIOx_PUPDR_PULL_UP;
-	sdaPin.PIN_NUM = i2c.SDA_CONFIG.SDA_PIN;
+	if(size == 0)
+	{
+		return 0;
+	}
 
-	if(i2c.SDA_CONFIG.SDA_PIN == I2C3_SDA_PB4 && i2c.SDA_CONFIG.GPIO_PORT == GPIOB)
+	//POS has to be in place before the address is sent
+	//18.6.1 in Ref Manual
+	if(size == 2)
 	{
-		sdaPin.ALT_FUNC = GPIOx_ALT_AF9;
+		I2C->CR1 |= I2C_CR1_POS;
 	}
 	else
 	{
-		sdaPin.ALT_FUNC = GPIOx_ALT_AF4;
+		I2C->CR1 &= ~I2C_CR1_POS;
 	}
 
-	gpio_init(i2c.SDA_CONFIG.GPIO_PORT, sdaPin);
+	I2C->CR1 |= I2C_CR1_ACK;
+
+	if(i2c_start(i2c) != 0)
+	{
+		return -1;
+	}
+
+	//send slave address with bit 0 set for a read
+	I2C->DR = (saddr << 1) | 1;
+
+	if(i2c_wait(i2c, I2C_SR1_ADDR) != 0)
+	{
+		return -1;
+	}
+
+	if(size == 1)
+	{
+		I2C->CR1 &= ~I2C_CR1_ACK;
+
+		primask = __get_PRIMASK();
+		__disable_irq();
+		tmp = I2C->SR1;
+		tmp = I2C->SR2;
+		I2C->CR1 |= I2C_CR1_STOP;
+		__set_PRIMASK(primask);
+
+		if(i2c_wait(i2c, I2C_SR1_RXNE) != 0)
+		{
+			return -1;
+		}
+
+		*data = I2C->DR;
+	}
+	else if(size == 2)
+	{
+		primask = __get_PRIMASK();
+		__disable_irq();
+		tmp = I2C->SR1;
+		tmp = I2C->SR2;
+		I2C->CR1 &= ~I2C_CR1_ACK;
+		__set_PRIMASK(primask);
+
+		if(i2c_wait(i2c, I2C_SR1_BTF) != 0)
+		{
+			return -1;
+		}
+
+		primask = __get_PRIMASK();
+		__disable_irq();
+		I2C->CR1 |= I2C_CR1_STOP;
+		*data++ = I2C->DR;
+		__set_PRIMASK(primask);
+
+		*data = I2C->DR;
+
+		I2C->CR1 &= ~I2C_CR1_POS;
+	}
+	else
+	{
+		tmp = I2C->SR1;
+		tmp = I2C->SR2;
+
+		while(size > 3)
+		{
+			if(i2c_wait(i2c, I2C_SR1_RXNE) != 0)
+			{
+				return -1;
+			}
+
+			*data++ = I2C->DR;
+			size--;
+		}
+
+		if(i2c_wait(i2c, I2C_SR1_BTF) != 0)
+		{
+			return -1;
+		}
+
+		I2C->CR1 &= ~I2C_CR1_ACK;
+
+		primask = __get_PRIMASK();
+		__disable_irq();
+		*data++ = I2C->DR;
+		I2C->CR1 |= I2C_CR1_STOP;
+		__set_PRIMASK(primask);
+
+		*data++ = I2C->DR;
+
+		if(i2c_wait(i2c, I2C_SR1_RXNE) != 0)
+		{
+			return -1;
+		}
+
+		*data = I2C->DR;
+	}
+
+	(void)tmp;
+
+	return 0;
+}
+
+/*
+ * Function to write to a slave and read back from it in one transaction,
+ * the read starts with a repeated start instead of a stop and a start, so
+ * no other master can take the bus in between. This is how most sensors
+ * are read, the write selects the register.
+ *
+ * With rxSize = 0 this is a plain write followed by a stop
+ */
+int i2c_write_read(I2C_CONFIG i2c, uint8_t saddr, const uint8_t* txData, uint16_t txSize, uint8_t* rxData, uint16_t rxSize)
+{
+	if(i2c_start(i2c) != 0 || i2c_send_address(i2c, saddr) != 0)
+	{
+		return -1;
+	}
+
+	//same as i2c_burst_write(), but without the 255 byte limit
+	while(txSize)
+	{
+		if(i2c_wait(i2c, I2C_SR1_TXE_Msk) != 0)
+		{
+			return -1;
+		}
+
+		i2c.I2C->DR = *txData++;
+
+		txSize--;
+	}
+
+	if(i2c_wait(i2c, I2C_SR1_BTF_Msk) != 0)
+	{
+		return -1;
+	}
+
+	if(rxSize == 0)
+	{
+		i2c_stop(i2c);
+		return 0;
+	}
+
+	return i2c_read(i2c, saddr, rxData, rxSize);
+}
+
+/*
+ * Function to read size bytes from a slave starting at the given
+ * register, for slaves that move to the next register on their own
+ */
+int i2c_read_register(I2C_CONFIG i2c, uint8_t saddr, uint8_t reg, uint8_t* data, uint16_t size)
+{
+	return i2c_write_read(i2c, saddr, &reg, 1, data, size);
+}
+
+/*
+ * Function to read one register of a slave, the value
+ * comes back as 0-255 so -1 can be given for an error
+ */
+int i2c_read_register_byte(I2C_CONFIG i2c, uint8_t saddr, uint8_t reg)
+{
+	uint8_t value;
+
+	if(i2c_write_read(i2c, saddr, &reg, 1, &value, 1) != 0)
+	{
+		return -1;
+	}
+
+	return value;
+}
+
+/*
+ * Function for master receiver using DMA
+ *
+ * The DMA moves every byte out of the data register, and with LAST
+ * set the I2C sends a NACK on the byte that brings the stream's count
+ * to 0, so the read closes itself without having to be caught in
+ * time by the CPU. Once the stream is done the stop is sent.
+ * 18.3.7 (Reception using DMA) and 18.6.2 in Ref Manual
+ *
+ * DMA can't close a 1 byte read (the NACK has to be set up before
+ * ADDR is cleared), so -1 is returned for size < 2, use i2c_read().
+ *
+ * The stream gets the time its bytes take at the bus speed (twice
+ * over, for clock stretching) + I2C_TIMEOUT_US to finish, after that
+ * the bus is recovered and -1 is returned.
+ */
+int i2c_read_dma(I2C_CONFIG i2c, uint8_t saddr, uint8_t* data, uint16_t size)
+{
+	I2C_ASYNC* async = i2c_async_get(i2c.I2C);
+	I2C_TypeDef* I2C = i2c.I2C;
+	volatile uint32_t tmp;
+	uint32_t start, timeout;
+
+	if(async == NULL || size < 2)
+	{
+		return -1;
+	}
+
+	dma_init(async->RX_DMA);
+	dma_start(async->RX_DMA, (uint32_t)&I2C->DR, (uint32_t)data, size);
+
+	I2C->CR1 &= ~I2C_CR1_POS;
+	I2C->CR1 |= I2C_CR1_ACK;
+	I2C->CR2 |= I2C_CR2_DMAEN | I2C_CR2_LAST;
+
+	if(i2c_start(i2c) != 0)
+	{
+		dma_stop(async->RX_DMA);
+		I2C->CR2 &= ~(I2C_CR2_DMAEN | I2C_CR2_LAST);
+		return -1;
+	}
+
+	//send slave address with bit 0 set for a read
+	I2C->DR = (saddr << 1) | 1;
+
+	if(i2c_wait(i2c, I2C_SR1_ADDR) != 0)
+	{
+		dma_stop(async->RX_DMA);
+		I2C->CR2 &= ~(I2C_CR2_DMAEN | I2C_CR2_LAST);
+		return -1;
+	}
+
+	tmp = I2C->SR1;
+	tmp = I2C->SR2;
+
+	//the stream turns itself off once its count reaches 0
+	start = cycles_now();
+	timeout = us_to_cycles(I2C_TIMEOUT_US + 2 * i2c_bytes_us(i2c, size));
+
+	while(dma_busy(async->RX_DMA))
+	{
+		if(cycles_elapsed(start) > timeout)
+		{
+			dma_stop(async->RX_DMA);
+			async->ERROR = I2C_STATUS_TIMEOUT;
+			i2c_recover(i2c);
+			return -1;
+		}
+	}
+
+	I2C->CR1 |= I2C_CR1_STOP;
+	I2C->CR2 &= ~(I2C_CR2_DMAEN | I2C_CR2_LAST);
+
+	(void)tmp;
+
+	return 0;
 }
 
+/*
+ * Function to wait for a flag in SR1, with a timeout
+ *
+ * The wait also ends if the slave doesn't acknowledge (AF), there is a
+ * bus error (BERR) or arbitration is lost (ARLO), since the flag isn't
+ * coming then. After a NACK or bus error the master still has the bus,
+ * so a stop is sent to free it. If nothing happens for I2C_TIMEOUT_US
+ * the bus is taken to be hung (usually a slave holding SDA low) and
+ * it is recovered with i2c_recover().
+ *
+ * The error flags are cleared by writing 0 to them, 18.6.6 in Ref Manual.
+ * Writing 1 to the rest leaves them alone, a read-modify-write could
+ * clear an error that came in between.
+ * The reason for a -1 is kept for i2c_error().
+ */
+int i2c_wait(I2C_CONFIG i2c, uint32_t flag)
+{
+	I2C_ASYNC* async = i2c_async_get(i2c.I2C);
+	uint32_t start = cycles_now();
+	uint32_t timeout = us_to_cycles(I2C_TIMEOUT_US);
+	uint32_t sr1;
+	I2C_STATUS status;
+
+	while(1)
+	{
+		sr1 = i2c.I2C->SR1;
+
+		if(sr1 & flag)
+		{
+			return 0;
+		}
+
+		if((sr1 & (I2C_SR1_AF | I2C_SR1_BERR | I2C_SR1_ARLO)) || cycles_elapsed(start) > timeout)
+		{
+			break;
+		}
+	}
+
+	i2c.I2C->SR1 = ~(I2C_SR1_AF | I2C_SR1_BERR | I2C_SR1_ARLO);
+
+	if(sr1 & I2C_SR1_ARLO)
+	{
+		status = I2C_STATUS_ARB_LOST;
+	}
+	else if(sr1 & I2C_SR1_BERR)
+	{
+		status = I2C_STATUS_BUS_ERROR;
+		i2c_stop(i2c);
+	}
+	else if(sr1 & I2C_SR1_AF)
+	{
+		status = I2C_STATUS_NACK;
+		i2c_stop(i2c);
+	}
+	else
+	{
+		status = I2C_STATUS_TIMEOUT;
+		i2c_recover(i2c);
+	}
+
+	if(async != NULL)
+	{
+		async->ERROR = status;
+	}
+
+	return -1;
+}
+
+/*
+ * Function to return why the last blocking function on
+ * the given I2C returned -1
+ */
+I2C_STATUS i2c_error(I2C_TypeDef* I2C)
+{
+	I2C_ASYNC* async = i2c_async_get(I2C);
+
+	if(async == NULL)
+	{
+		return I2C_STATUS_OK;
+	}
+
+	return async->ERROR;
+}
+
+/*
+ * Function to return the time the given number of bytes take
+ * on the bus in us, at the speed in the config
+ */
+uint32_t i2c_bytes_us(I2C_CONFIG i2c, uint32_t bytes)
+{
+	return i2c_clocks_us(i2c, bytes * CLOCKS_PER_BYTE);
+}
+
+/*
+ * Function to return the time the given number of SCL clocks
+ * take in us, at the speed in the config
+ */
+uint32_t i2c_clocks_us(I2C_CONFIG i2c, uint32_t clocks)
+{
+	uint32_t speed = i2c.SPEED_HZ;
+
+	if(speed == 0)
+	{
+		speed = I2C_STANDARD_MODE_FREQ;
+	}
+
+	return (clocks * 1000000) / speed;
+}
+
+/*
+ * Function to free a bus that a slave is holding
+ *
+ * A slave that lost clocks part way through sending a byte (the master
+ * was reset, or noise) keeps holding SDA low waiting for the rest of
+ * them, and the I2C can't make a start condition while SDA is low. The
+ * pins are taken over as GPIO and SCL is clocked by hand (up to
+ * I2C_RECOVERY_CLOCKS times, until SDA is let go), then a stop condition
+ * puts every slave back to idle. i2c_init() then resets the I2C with SWRST,
+ * since it can be left thinking the bus is busy (18.6.1 in Ref Manual),
+ * and gives the pins back to it.
+ *
+ * SCL runs at about 100KHz, so this takes around 120us.
+ *
+ * -1 is returned if SDA is still low after all the clocks
+ * (the slave is stuck for good), or if i2c_init() fails.
+ */
+int i2c_recover(I2C_CONFIG i2c)
+{
+	I2C_ASYNC* async = i2c_async_get(i2c.I2C);
+	GPIO_TypeDef* sclPort = i2c.SCL_CONFIG.GPIO_PORT;
+	GPIO_TypeDef* sdaPort = i2c.SDA_CONFIG.GPIO_PORT;
+	int released;
+
+	//open drain with pull-ups like the I2C pins, so
+	//writing 1 lets the line go instead of driving it
+	GPIOx_PIN_CONFIG sclPin;
+	sclPin.PIN_NUM = i2c.SCL_CONFIG.SCL_PIN;
+	sclPin.PIN_MODE = GPIOx_PIN_OUTPUT;
+	sclPin.ALT_FUNC = GPIOx_ALT_AF0;
+	sclPin.PUPDR_MODE = GPIOx_PUPDR_PULL_UP;
+	sclPin.OTYPER_MODE = GPIOx_OTYPER_OPEN_DRAIN;
+
+	GPIOx_PIN_CONFIG sdaPin = sclPin;
+	sdaPin.PIN_NUM = i2c.SDA_CONFIG.SDA_PIN;
+
+	//both lines are set to 1 before the pins are moved over,
+	//so nothing moves on the bus until the clocks start
+	gpio_output_bit_setreset(sclPort, sclPin, GPIOx_BSRR_SET);
+	gpio_output_bit_setreset(sdaPort, sdaPin, GPIOx_BSRR_SET);
+
+	i2c.I2C->CR1 &= ~I2C_CR1_PE;
+
+	gpio_init(sclPort, sclPin);
+	gpio_init(sdaPort, sdaPin);
+	delay_us(RECOVERY_HALF_PERIOD_US);
+
+	for(int i = 0; i < I2C_RECOVERY_CLOCKS && !gpio_input_read(sdaPort, sdaPin); i++)
+	{
+		gpio_output_bit_setreset(sclPort, sclPin, GPIOx_BSRR_RESET);
+		delay_us(RECOVERY_HALF_PERIOD_US);
+		gpio_output_bit_setreset(sclPort, sclPin, GPIOx_BSRR_SET);
+		delay_us(RECOVERY_HALF_PERIOD_US);
+	}
+
+	//stop condition, SDA going high while SCL is high
+	gpio_output_bit_setreset(sclPort, sclPin, GPIOx_BSRR_RESET);
+	delay_us(RECOVERY_HALF_PERIOD_US);
+	gpio_output_bit_setreset(sdaPort, sdaPin, GPIOx_BSRR_RESET);
+	delay_us(RECOVERY_HALF_PERIOD_US);
+	gpio_output_bit_setreset(sclPort, sclPin, GPIOx_BSRR_SET);
+	delay_us(RECOVERY_HALF_PERIOD_US);
+	gpio_output_bit_setreset(sdaPort, sdaPin, GPIOx_BSRR_SET);
+	delay_us(RECOVERY_HALF_PERIOD_US);
+
+	released = gpio_input_read(sdaPort, sdaPin);
+
+	if(async != NULL)
+	{
+		async->RECOVERIES++;
+	}
+
+	if(i2c_init(i2c) != 0 || !released)
+	{
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Function to initialize both SCL and SDA
+ * pins in alternate function mode with the
+ * appropriate AF bits set, open drain output,
+ * and with pull-ups enabled
+ */
+void i2c_gpio_init(I2C_CONFIG i2c)
+{
+	//configure SCL pin, I2C is open drain by
+	//definition, need pull-ups, and requires
+	//alternate function mode with bit AF04 for
+	//all SCL's. Table.9 in Datasheet for the mapping
+	GPIOx_PIN_CONFIG sclPin;
+	sclPin.OTYPER_MODE = GPIOx_OTYPER_OPEN_DRAIN;
+	sclPin.PIN_MODE = GPIOx_PIN_ALTERNATE;
+	sclPin.PUPDR_MODE = GPIOx_PUPDR_PULL_UP;
+	sclPin.ALT_FUNC = GPIOx_ALT_AF4;
+	sclPin.PIN_NUM = i2c.SCL_CONFIG.SCL_PIN;
+	gpio_init(i2c.SCL_CONFIG.GPIO_PORT, sclPin);
+
+	//do the same for the SDA pin, but some of the
+	//pins require AF09 instead of AF04, so check
+	//for those pins
+	GPIOx_PIN_CONFIG sdaPin;
+	sdaPin.OTYPER_MODE = GPIOx_OTYPER_OPEN_DRAIN;
+	sdaPin.PIN_MODE = GPIOx_PIN_ALTERNATE;
+	sdaPin.PUPDR_MODE = GPIOx_PUPDR_PULL_UP;
+	sdaPin.PIN_NUM = i2c.SDA_CONFIG.SDA_PIN;
+
+	if(i2c.SDA_CONFIG.SDA_PIN == I2C3_SDA_PB4 && i2c.SDA_CONFIG.GPIO_PORT == GPIOB)
+	{
+		sdaPin.ALT_FUNC = GPIOx_ALT_AF9;
+	}
+	else
+	{
+		sdaPin.ALT_FUNC = GPIOx_ALT_AF4;
+	}
+
+	gpio_init(i2c.SDA_CONFIG.GPIO_PORT, sdaPin);
+}
+
+/*
+ * Function to return the interrupt driven state that
+ * belongs to the given I2C, NULL if there isn't one
+ */
+I2C_ASYNC* i2c_async_get(I2C_TypeDef* I2C)
+{
+	if(I2C == I2C1)
+	{
+		return &i2c1_async;
+	}
+	else if(I2C == I2C2)
+	{
+		return &i2c2_async;
+	}
+	else if(I2C == I2C3)
+	{
+		return &i2c3_async;
+	}
+
+	return NULL;
+}
+
+/*
+ * Function to queue a transfer without blocking
+ *
+ * The transfer is added to the end of the queue for the given I2C and
+ * started straight away if the bus is free. Everything after that is
+ * done from the event/error interrupts, following the same master
+ * sequences as the blocking functions (Figure 164./Figure 165. in Ref
+ * Manual), and once the stop condition has gone out STATUS is set and
+ * the callback is called from the interrupt. The next queued transfer
+ * is started before the callback, so the bus doesn't wait on it.
+ *
+ * Only a stop held up by a slave stretching SCL leaves the next transfer
+ * waiting on i2c_timeout_poll() (see i2c_async_finish()).
+ *
+ * A write or read of I2C_DMA_THRESHOLD bytes or more is moved by DMA,
+ * so a long transfer only costs the interrupts for the start, address
+ * and end.
+ *
+ * Each transfer gets TIMEOUT_US on the bus (see I2C_TRANSFER), once
+ * that runs out i2c_timeout_poll() stops it with I2C_STATUS_TIMEOUT
+ * and recovers the bus, so a hung bus can't hold up the queue.
+ *
+ * i2c_init() has to have been called first, and the blocking functions
+ * shouldn't be used on the same I2C while i2c_busy() is set.
+ *
+ * -1 is returned without queueing anything if there is no such I2C
+ * or a size is set without its buffer
+ */
+int i2c_transfer(I2C_TypeDef* I2C, I2C_TRANSFER* transfer)
+{
+	I2C_ASYNC* async = i2c_async_get(I2C);
+	uint32_t primask;
+
+	if(async == NULL || transfer == NULL)
+	{
+		return -1;
+	}
+
+	if((transfer->TX_SIZE != 0 && transfer->TX_DATA == NULL) || (transfer->RX_SIZE != 0 && transfer->RX_DATA == NULL))
+	{
+		return -1;
+	}
+
+	transfer->NEXT = NULL;
+	transfer->STATUS = I2C_STATUS_BUSY;
+
+	//the interrupt takes transfers off the front of the queue
+	primask = __get_PRIMASK();
+	__disable_irq();
+
+	//while the last stop is going out i2c_timeout_poll() starts it
+	if(async->HEAD == NULL)
+	{
+		async->HEAD = transfer;
+		async->TAIL = transfer;
+
+		if(!async->STOPPING)
+		{
+			i2c_async_start(async);
+		}
+	}
+	else
+	{
+		async->TAIL->NEXT = transfer;
+		async->TAIL = transfer;
+	}
+
+	__set_PRIMASK(primask);
+
+	return 0;
+}
+
+/*
+ * Function to check if there are transfers queued or on the bus
+ *
+ * The transfer on the bus is checked for a timeout first, so
+ * waiting on this can't go on forever
+ */
+int i2c_busy(I2C_TypeDef* I2C)
+{
+	I2C_ASYNC* async = i2c_async_get(I2C);
+
+	if(async == NULL)
+	{
+		return 0;
+	}
+
+	i2c_timeout_poll(I2C);
+
+	return async->HEAD != NULL || async->STOPPING;
+}
+
+/*
+ * Function to move the queue on from outside of the I2C interrupts
+ *
+ * Once the stop of the last transfer has gone out the next one is
+ * started. A slave holding SCL or SDA low means the interrupt that would
+ * move a transfer on (or the stop) never comes, so this has to be called
+ * from outside of it, from the main loop (i2c_busy() does) or a timer
+ * interrupt. On a timeout the bus is recovered with i2c_recover(), with
+ * interrupts on since that takes around 120us, the transfer ends with
+ * I2C_STATUS_TIMEOUT and the next one is started.
+ */
+void i2c_timeout_poll(I2C_TypeDef* I2C)
+{
+	I2C_ASYNC* async = i2c_async_get(I2C);
+	uint32_t primask;
+	int recover = 0;
+	int timedOut = 0;
+
+	if(async == NULL)
+	{
+		return;
+	}
+
+	//the interrupts also move the queue on
+	primask = __get_PRIMASK();
+	__disable_irq();
+
+	if(async->RECOVERING)
+	{
+		//already being recovered by whatever this interrupted
+	}
+	else if(async->STOPPING && !(I2C->CR1 & I2C_CR1_STOP))
+	{
+		i2c_async_next(async);
+	}
+	else if(async->STOPPING && cycles_elapsed(async->START_CYCLES) > async->TIMEOUT_CYCLES)
+	{
+		recover = 1;
+	}
+	else if(!async->STOPPING && async->HEAD != NULL && cycles_elapsed(async->START_CYCLES) > async->TIMEOUT_CYCLES)
+	{
+		//with its interrupts off the transfer is left alone
+		//until the bus has been recovered
+		i2c_async_abort(async);
+		async->STOPPING = 1;
+		recover = 1;
+		timedOut = 1;
+	}
+
+	async->RECOVERING = recover;
+
+	__set_PRIMASK(primask);
+
+	if(!recover)
+	{
+		return;
+	}
+
+	i2c_recover(async->CONFIG);
+
+	primask = __get_PRIMASK();
+	__disable_irq();
+
+	async->RECOVERING = 0;
+
+	if(timedOut)
+	{
+		i2c_async_finish(async, I2C_STATUS_TIMEOUT);
+	}
+	else
+	{
+		i2c_async_next(async);
+	}
+
+	__set_PRIMASK(primask);
+}
+
+/*
+ * Function to put the transfer at the front of the queue on the bus
+ *
+ * ITEVTEN/ITERREN turn on the event and error interrupts, ITBUFEN
+ * (TXE/RXNE) is only turned on when bytes are moved from the interrupt
+ * 18.6.2 in Ref Manual
+ */
+void i2c_async_start(I2C_ASYNC* async)
+{
+	I2C_TRANSFER* transfer = async->HEAD;
+	uint32_t timeoutUs = transfer->TIMEOUT_US;
+
+	async->INDEX = 0;
+	async->READING = 0;
+	async->DMA_ACTIVE = 0;
+
+	//the address + repeated start address take a byte each on top of the data
+	if(timeoutUs == 0)
+	{
+		timeoutUs = I2C_TIMEOUT_US + 2 * i2c_bytes_us(async->CONFIG, transfer->TX_SIZE + transfer->RX_SIZE + 2);
+	}
+
+	async->START_CYCLES = cycles_now();
+	async->TIMEOUT_CYCLES = us_to_cycles(timeoutUs);
+
+	async->I2C->CR2 |= I2C_CR2_ITEVTEN | I2C_CR2_ITERREN;
+
+	//a transfer with nothing to write goes straight to its read
+	if(transfer->TX_SIZE == 0 && transfer->RX_SIZE != 0)
+	{
+		i2c_async_read_start(async);
+	}
+	else
+	{
+		async->I2C->CR1 |= I2C_CR1_START;
+	}
+}
+
+/*
+ * Function to start (or restart) the transfer in receiver mode
+ *
+ * ACK is set so every byte but the last gets acknowledged, and for a
+ * 2 byte read POS makes the ACK bit apply to the second byte instead
+ * of the first, as in 18.3.3 (Closing the communication) in Ref Manual.
+ * A DMA read uses LAST instead, same as i2c_read_dma()
+ */
+void i2c_async_read_start(I2C_ASYNC* async)
+{
+	async->INDEX = 0;
+	async->READING = 1;
+
+	if(async->HEAD->RX_SIZE >= I2C_DMA_THRESHOLD)
+	{
+		async->I2C->CR1 &= ~I2C_CR1_POS;
+		async->I2C->CR2 |= I2C_CR2_LAST;
+	}
+	else if(async->HEAD->RX_SIZE == 2)
+	{
+		async->I2C->CR1 |= I2C_CR1_POS;
+	}
+	else
+	{
+		async->I2C->CR1 &= ~I2C_CR1_POS;
+	}
+
+	async->I2C->CR1 |= I2C_CR1_ACK | I2C_CR1_START;
+}
+
+/*
+ * Function called once the slave has acknowledged its address
+ *
+ * Whatever has to be set up for the data goes in before ADDR is cleared
+ * (reading SR1 then SR2), since the clock is held low until then.
+ *
+ * Receiving has to close differently depending on the number of bytes,
+ * since the ACK/STOP bits have to be in place before the last byte
+ * starts coming in, 18.3.3 in Ref Manual:
+ *
+ * - DMA:     the stream is started, LAST NACKs the final byte and the
+ *            stop is sent from i2c_async_dma_rx_callback()
+ * - 1 byte:  ACK is cleared before ADDR, and STOP straight after
+ * - 2 bytes: ACK is cleared after ADDR (POS is set), then BTF is waited on
+ * - more:    ACK stays on until 3 bytes are left, see i2c_async_rx()
+ */
+void i2c_async_address(I2C_ASYNC* async)
+{
+	I2C_TypeDef* I2C = async->I2C;
+	I2C_TRANSFER* transfer = async->HEAD;
+	volatile uint32_t tmp;
+	uint32_t primask;
+
+	if(!async->READING)
+	{
+		//the other I2C's event interrupt could be after the same stream
+		primask = __get_PRIMASK();
+		__disable_irq();
+
+		if(transfer->TX_SIZE >= I2C_DMA_THRESHOLD && !dma_busy(async->TX_DMA))
+		{
+			//DMAEN lets TXE make the DMA requests, 18.3.7 in Ref Manual
+			async->DMA_ACTIVE = 1;
+			dma_init(async->TX_DMA);
+			dma_start(async->TX_DMA, (uint32_t)&I2C->DR, (uint32_t)transfer->TX_DATA, transfer->TX_SIZE);
+			I2C->CR2 |= I2C_CR2_DMAEN;
+		}
+		else if(transfer->TX_SIZE != 0)
+		{
+			I2C->CR2 |= I2C_CR2_ITBUFEN;
+		}
+
+		__set_PRIMASK(primask);
+
+		tmp = I2C->SR1;
+		tmp = I2C->SR2;
+
+		//nothing to write or read, only checking the slave is there
+		if(transfer->TX_SIZE == 0)
+		{
+			I2C->CR1 |= I2C_CR1_STOP;
+			i2c_async_finish(async, I2C_STATUS_OK);
+		}
+	}
+	else if(transfer->RX_SIZE >= I2C_DMA_THRESHOLD)
+	{
+		async->DMA_ACTIVE = 1;
+		dma_init(async->RX_DMA);
+		dma_interrupt_enable(async->RX_DMA, DMA_EVENT_TRANSFER_COMPLETE | DMA_EVENT_ERROR, i2c_async_dma_rx_callback, async);
+		dma_start(async->RX_DMA, (uint32_t)&I2C->DR, (uint32_t)transfer->RX_DATA, transfer->RX_SIZE);
+		I2C->CR2 |= I2C_CR2_DMAEN;
+
+		tmp = I2C->SR1;
+		tmp = I2C->SR2;
+	}
+	else if(transfer->RX_SIZE == 1)
+	{
+		I2C->CR1 &= ~I2C_CR1_ACK;
+		tmp = I2C->SR1;
+		tmp = I2C->SR2;
+		I2C->CR1 |= I2C_CR1_STOP;
+		I2C->CR2 |= I2C_CR2_ITBUFEN;
+	}
+	else if(transfer->RX_SIZE == 2)
+	{
+		tmp = I2C->SR1;
+		tmp = I2C->SR2;
+		I2C->CR1 &= ~I2C_CR1_ACK;
+	}
+	else
+	{
+		tmp = I2C->SR1;
+		tmp = I2C->SR2;
+
+		//with exactly 3 bytes the first BTF is already the end, see i2c_async_rx()
+		if(transfer->RX_SIZE > 3)
+		{
+			I2C->CR2 |= I2C_CR2_ITBUFEN;
+		}
+	}
+
+	(void)tmp;
+}
+
+/*
+ * Function to move the write forward from the event interrupt
+ *
+ * Each TXE gets the next byte until they have all been given to the
+ * data register, then BTF means the last one has gone out on the bus
+ * and the transfer either restarts for its read or sends a stop
+ * Figure 164. in Ref Manual
+ */
+void i2c_async_tx(I2C_ASYNC* async, uint32_t sr1)
+{
+	I2C_TypeDef* I2C = async->I2C;
+	I2C_TRANSFER* transfer = async->HEAD;
+
+	if(!async->DMA_ACTIVE && (sr1 & I2C_SR1_TXE) && async->INDEX < transfer->TX_SIZE)
+	{
+		I2C->DR = transfer->TX_DATA[async->INDEX++];
+
+		if(async->INDEX == transfer->TX_SIZE)
+		{
+			I2C->CR2 &= ~I2C_CR2_ITBUFEN;
+		}
+
+		return;
+	}
+
+	if(!(sr1 & I2C_SR1_BTF))
+	{
+		return;
+	}
+
+	//with DMA, the write is done once the stream has nothing left,
+	//the DMA interrupt isn't used so there is nothing to race with
+	if(async->DMA_ACTIVE)
+	{
+		if(dma_remaining(async->TX_DMA) != 0)
+		{
+			return;
+		}
+
+		I2C->CR2 &= ~I2C_CR2_DMAEN;
+		dma_stop(async->TX_DMA);
+		async->DMA_ACTIVE = 0;
+		async->INDEX = transfer->TX_SIZE;
+	}
+
+	if(async->INDEX < transfer->TX_SIZE)
+	{
+		return;
+	}
+
+	//a START/STOP clears BTF, 18.6.6 in Ref Manual
+	if(transfer->RX_SIZE != 0)
+	{
+		i2c_async_read_start(async);
+	}
+	else
+	{
+		I2C->CR1 |= I2C_CR1_STOP;
+		i2c_async_finish(async, I2C_STATUS_OK);
+	}
+}
+
+/*
+ * Function to move the read forward from the event interrupt
+ *
+ * Bytes are taken on RXNE until 3 are left, then only BTF is used
+ * (data register and shift register both full, clock held low) so
+ * ACK and STOP land in the right place, 18.3.3 in Ref Manual:
+ *
+ * - 3 left: clear ACK, read one (the last byte will be NACKed)
+ * - 2 left: STOP, read both
+ *
+ * A 2 byte read only ever sees the second case, and a 1 byte read
+ * already has STOP set, so its one byte is taken on RXNE.
+ */
+void i2c_async_rx(I2C_ASYNC* async, uint32_t sr1)
+{
+	I2C_TypeDef* I2C = async->I2C;
+	I2C_TRANSFER* transfer = async->HEAD;
+	uint16_t remaining = transfer->RX_SIZE - async->INDEX;
+
+	//the DMA callback ends a DMA read
+	if(async->DMA_ACTIVE)
+	{
+		return;
+	}
+
+	if(transfer->RX_SIZE == 1)
+	{
+		if(sr1 & I2C_SR1_RXNE)
+		{
+			transfer->RX_DATA[async->INDEX++] = I2C->DR;
+			i2c_async_finish(async, I2C_STATUS_OK);
+		}
+
+		return;
+	}
+
+	if(remaining > 3)
+	{
+		if(sr1 & I2C_SR1_RXNE)
+		{
+			transfer->RX_DATA[async->INDEX++] = I2C->DR;
+
+			if(remaining - 1 == 3)
+			{
+				I2C->CR2 &= ~I2C_CR2_ITBUFEN;
+			}
+		}
+
+		return;
+	}
+
+	if(!(sr1 & I2C_SR1_BTF))
+	{
+		return;
+	}
+
+	if(remaining == 3)
+	{
+		I2C->CR1 &= ~I2C_CR1_ACK;
+		transfer->RX_DATA[async->INDEX++] = I2C->DR;
+		return;
+	}
+
+	I2C->CR1 |= I2C_CR1_STOP;
+	transfer->RX_DATA[async->INDEX++] = I2C->DR;
+	transfer->RX_DATA[async->INDEX++] = I2C->DR;
+	i2c_async_finish(async, I2C_STATUS_OK);
+}
+
+/*
+ * Function to turn off the interrupts and DMA of the transfer on the bus
+ */
+void i2c_async_abort(I2C_ASYNC* async)
+{
+	async->I2C->CR2 &= ~(I2C_CR2_ITEVTEN | I2C_CR2_ITBUFEN | I2C_CR2_ITERREN | I2C_CR2_DMAEN | I2C_CR2_LAST);
+
+	if(async->DMA_ACTIVE && async->READING)
+	{
+		dma_interrupt_disable(async->RX_DMA);
+		dma_stop(async->RX_DMA);
+	}
+	else if(async->DMA_ACTIVE)
+	{
+		dma_stop(async->TX_DMA);
+	}
+
+	async->DMA_ACTIVE = 0;
+}
+
+/*
+ * Function to end the transfer on the bus and start the next one
+ *
+ * The caller has already asked for the stop (if there should be one),
+ * STOP is cleared by hardware once it has been sent, and CR1 isn't
+ * written again before then (18.6.1 in Ref Manual). The last byte is
+ * already over by the time this is called, so the stop goes out within
+ * a clock and is waited on for up to STOP_WAIT_CLOCKS (5us at 400KHz,
+ * 20us at 100KHz). Only if a slave is stretching SCL is STOPPING set
+ * instead, and i2c_timeout_poll() starts the next transfer, or recovers
+ * the bus if the stop doesn't go out within I2C_TIMEOUT_US.
+ */
+void i2c_async_finish(I2C_ASYNC* async, I2C_STATUS status)
+{
+	I2C_TRANSFER* transfer = async->HEAD;
+	uint32_t start = cycles_now();
+	uint32_t timeout = us_to_cycles(i2c_clocks_us(async->CONFIG, STOP_WAIT_CLOCKS) + 1);
+
+	i2c_async_abort(async);
+
+	while((async->I2C->CR1 & I2C_CR1_STOP) && cycles_elapsed(start) < timeout);
+
+	async->HEAD = transfer->NEXT;
+
+	if(async->HEAD == NULL)
+	{
+		async->TAIL = NULL;
+	}
+
+	if(async->I2C->CR1 & I2C_CR1_STOP)
+	{
+		async->STOPPING = 1;
+		async->START_CYCLES = cycles_now();
+		async->TIMEOUT_CYCLES = us_to_cycles(I2C_TIMEOUT_US);
+	}
+	else
+	{
+		i2c_async_next(async);
+	}
+
+	transfer->NEXT = NULL;
+	transfer->STATUS = status;
+
+	if(transfer->CALLBACK != NULL)
+	{
+		transfer->CALLBACK(transfer->CONTEXT, status);
+	}
+}
+
+/*
+ * Function to start the transfer at the front of the queue (if there
+ * is one) once the bus is free, POS is left over from a 2 byte read
+ */
+void i2c_async_next(I2C_ASYNC* async)
+{
+	async->STOPPING = 0;
+	async->I2C->CR1 &= ~I2C_CR1_POS;
+
+	if(async->HEAD != NULL)
+	{
+		i2c_async_start(async);
+	}
+}
+
+/*
+ * Function called from the DMA interrupt once a DMA read is over
+ *
+ * Transfer complete means the last byte (already NACKed because of
+ * LAST) has been moved out of the data register, so only the stop is
+ * left. On a stream error the hardware has already disabled the stream.
+ */
+void i2c_async_dma_rx_callback(void* context, uint32_t events)
+{
+	I2C_ASYNC* async = (I2C_ASYNC*)context;
+
+	if(async->HEAD == NULL || !async->DMA_ACTIVE)
+	{
+		return;
+	}
+
+	async->I2C->CR1 |= I2C_CR1_STOP;
+
+	if(events & DMA_EVENT_ERROR)
+	{
+		i2c_async_finish(async, I2C_STATUS_DMA_ERROR);
+	}
+	else
+	{
+		async->INDEX = async->HEAD->RX_SIZE;
+		i2c_async_finish(async, I2C_STATUS_OK);
+	}
+}
+
+/*
+ * Function to handle an I2C event interrupt
+ *
+ * SB/ADDR/BTF/TXE/RXNE, 18.4 in Ref Manual
+ */
+void i2c_ev_irq_handler(I2C_TypeDef* I2C)
+{
+	I2C_ASYNC* async = i2c_async_get(I2C);
+	uint32_t sr1;
+
+	if(async == NULL)
+	{
+		return;
+	}
+
+	//nothing should be on the bus, don't keep coming back here
+	if(async->HEAD == NULL)
+	{
+		I2C->CR2 &= ~(I2C_CR2_ITEVTEN | I2C_CR2_ITBUFEN);
+		return;
+	}
+
+	sr1 = I2C->SR1;
+
+	//start condition sent, SB is cleared by reading SR1 then writing
+	//the address to DR (bit 0 set for a read)
+	//18.3.3 in Ref Manual
+	if(sr1 & I2C_SR1_SB)
+	{
+		I2C->DR = (async->HEAD->ADDRESS << 1) | (async->READING ? 1 : 0);
+	}
+	else if(sr1 & I2C_SR1_ADDR)
+	{
+		i2c_async_address(async);
+	}
+	else if(async->READING)
+	{
+		i2c_async_rx(async, sr1);
+	}
+	else
+	{
+		i2c_async_tx(async, sr1);
+	}
+}
+
+/*
+ * Function to handle an I2C error interrupt
+ *
+ * The error flags are cleared by writing 0 to them, 18.6.6 in Ref Manual.
+ * Writing 1 to the rest leaves them alone, a read-modify-write could
+ * clear an error that came in between.
+ * After a NACK or bus error the master still owns the bus, so a stop is
+ * sent. After arbitration lost the interface has already dropped back
+ * to slave mode and the bus belongs to the other master.
+ */
+void i2c_er_irq_handler(I2C_TypeDef* I2C)
+{
+	I2C_ASYNC* async = i2c_async_get(I2C);
+	uint32_t sr1 = I2C->SR1;
+	I2C_STATUS status;
+
+	I2C->SR1 = ~(I2C_SR1_AF | I2C_SR1_BERR | I2C_SR1_ARLO | I2C_SR1_OVR);
+
+	if(async == NULL || async->HEAD == NULL)
+	{
+		return;
+	}
+
+	if(sr1 & I2C_SR1_ARLO)
+	{
+		status = I2C_STATUS_ARB_LOST;
+	}
+	else if(sr1 & I2C_SR1_BERR)
+	{
+		status = I2C_STATUS_BUS_ERROR;
+		I2C->CR1 |= I2C_CR1_STOP;
+	}
+	else if(sr1 & I2C_SR1_AF)
+	{
+		status = I2C_STATUS_NACK;
+		I2C->CR1 |= I2C_CR1_STOP;
+	}
+	else if(sr1 & I2C_SR1_OVR)
+	{
+		status = I2C_STATUS_OVERRUN;
+		I2C->CR1 |= I2C_CR1_STOP;
+	}
+	else
+	{
+		return;
+	}
+
+	i2c_async_finish(async, status);
+}
+
+//interrupt request handlers, check Startup Folder -> startup_stm32f401retx.s for the vector table
+void I2C1_EV_IRQHandler(void)
+{
+	i2c_ev_irq_handler(I2C1);
+}
+
+void I2C1_ER_IRQHandler(void)
+{
+	i2c_er_irq_handler(I2C1);
+}
+
+void I2C2_EV_IRQHandler(void)
+{
+	i2c_ev_irq_handler(I2C2);
+}
+
+void I2C2_ER_IRQHandler(void)
+{
+	i2c_er_irq_handler(I2C2);
+}
+
+void I2C3_EV_IRQHandler(void)
+{
+	i2c_ev_irq_handler(I2C3);
+}
+
+void I2C3_ER_IRQHandler(void)
+{
+	i2c_er_irq_handler(I2C3);
+}
@@ -14,17 +14,144 @@
 #include "uart.h"
 #include "i2c.h"
 #include "lcd.h"
+#include "dwt.h"
 #include <stdio.h>
 #include <stdint.h>
 
+/* TESTS: */
+//#define I2C_ASYNC_TEST //un-comment this to write to the LCD with queued transfers from interrupts/DMA, view results with live expressions
+//#define I2C_TIMING_TEST //un-comment this to check the SCL timing worked out for APB1 clocks from 2 to 42MHz, view results with live expressions
+//#define I2C_READ_TEST //un-comment this to read back from the LCD with every receive sequence (1, 2, N bytes and DMA), view results with live expressions
+//#define I2C_RECOVERY_TEST //un-comment this to check the timeouts and bus recovery end in bounded time, view results with live expressions
+//#define LCD_FRAMEBUFFER_TEST //un-comment this to time a full redraw and a one character update of the LCD framebuffer, view results with live expressions
+//#define LCD_GLYPH_TEST //un-comment this to upload custom characters and draw them on both lines, check the LCD and view results with live expressions
+//#define LCD_RENDER_TEST //un-comment this to queue a counter to the LCD much faster than it can be drawn, check the LCD and view results with live expressions
+
+#ifdef I2C_ASYNC_TEST
+	volatile uint32_t transfersDone = 0; //number of finished transfers
+	volatile uint32_t transfersNacked = 0; //number of transfers that got a NACK
+	volatile uint32_t mainLoops = 0; //keeps counting while the transfers run, shows the CPU isn't blocked
+
+	//callback for each finished transfer
+	void transfer_done(void* context, I2C_STATUS status)
+	{
+		transfersDone++;
+
+		if(status == I2C_STATUS_NACK)
+		{
+			transfersNacked++;
+		}
+	}
+#endif
+
+#ifdef I2C_TIMING_TEST
+	volatile uint32_t timingChecked = 0; //number of APB1 clock/mode pairs checked
+	volatile uint32_t timingErrors = 0; //number that didn't meet the spec, or were wrongly accepted/rejected
+
+	//checks the registers i2c_timing() gives back against Table 59. in Datasheet,
+	//high/low are the number of CCR's in the high/low time
+	void check_timing(uint32_t pclk1, uint32_t speed, I2C_DUTY duty, uint32_t high, uint32_t low, uint32_t minHighNs, uint32_t minLowNs)
+	{
+		I2C_TIMING timing;
+		int shouldWork = !(speed > I2C_STANDARD_MODE_FREQ && pclk1 < 4000000); //fast mode needs 4MHz
+		int works = (i2c_timing(pclk1, speed, duty, &timing) == 0);
+
+		timingChecked++;
+
+		if(works != shouldWork)
+		{
+			timingErrors++;
+			return;
+		}
+
+		if(!works)
+		{
+			return;
+		}
+
+		uint32_t ccr = timing.CCR & I2C_CCR_CCR;
+
+		//SCL can't be faster than asked for
+		if(pclk1 / (ccr * (high + low)) > speed)
+		{
+			timingErrors++;
+		}
+
+		if(((uint64_t)ccr * high * 1000000000) / pclk1 < minHighNs || ((uint64_t)ccr * low * 1000000000) / pclk1 < minLowNs)
+		{
+			timingErrors++;
+		}
+
+		//FREQ has to be PCLK1 in MHz, and TRISE has to cover the max rise time
+		if(timing.FREQ != pclk1 / 1000000 || (timing.TRISE - 1) * 1000 > timing.FREQ * ((speed > I2C_STANDARD_MODE_FREQ) ? 300 : 1000))
+		{
+			timingErrors++;
+		}
+	}
+#endif
+
+#ifdef I2C_READ_TEST
+	volatile uint8_t lcdStatus = 0; //busy flag (bit 7) and address counter, control byte 0x00 selects it
+	uint8_t readOne[1]; //1 byte receive
+	uint8_t readTwo[2]; //2 byte receive (POS)
+	uint8_t readMany[5]; //N byte receive
+	uint8_t readDma[16]; //DMA receive (LAST)
+	volatile int readDmaResult = -1;
+#endif
+
+#ifdef I2C_RECOVERY_TEST
+	volatile int nackResult = 0; //i2c_read() from an address with nothing on it
+	volatile I2C_STATUS nackError = I2C_STATUS_OK;
+	volatile uint32_t nackUs = 0;
+	volatile int recoverResult = -1; //i2c_recover() on an idle bus
+	volatile uint32_t recoverUs = 0;
+	volatile I2C_STATUS timeoutStatus = I2C_STATUS_OK; //async transfer given 1us
+	volatile uint32_t timeoutUs = 0;
+	volatile int afterResult = -1; //normal read once everything above is done
+	volatile uint8_t lcdStatus = 0;
+
+	//callback for the transfer that runs out of time
+	void timeout_done(void* context, I2C_STATUS status)
+	{
+		timeoutStatus = status;
+	}
+#endif
+
+#ifdef LCD_FRAMEBUFFER_TEST
+	LCD_FRAMEBUFFER fb;
+	volatile uint32_t writeUs = 0; //lcd_write() of 8 characters
+	volatile uint32_t redrawUs = 0; //both lines changed
+	volatile uint32_t updateUs = 0; //one character changed
+	volatile uint32_t unchangedUs = 0; //nothing changed, so nothing sent
+	volatile int flushResult = -1;
+#endif
+
+#ifdef LCD_GLYPH_TEST
+	//a smiley and a heart
+	const uint8_t glyphs[2][LCD_GLYPH_ROWS] = {
+												{0x00, 0x0A, 0x0A, 0x00, 0x11, 0x0E, 0x00, 0x00},
+												{0x00, 0x0A, 0x1F, 0x1F, 0x0E, 0x04, 0x00, 0x00}
+											  };
+	LCD_FRAMEBUFFER glyphFb;
+	volatile int loadResult = -1;
+	volatile int badLoadResult = 0; //glyph 7 + 2 doesn't fit in CGRAM
+	volatile int badCursorResult = 0; //line 2 doesn't exist
+	volatile uint32_t loadUs = 0;
+#endif
+
+#ifdef LCD_RENDER_TEST
+	LCD_RENDER render;
+	volatile uint32_t printfMaxUs = 0; //longest lcd_printf() + lcd_render_poll(), neither should wait on the LCD
+	volatile uint32_t loops = 0;
+#endif
+
 int main(void)
 {
 
-	/*configure i2c, SCL = PB8, SDA = PB9, at 16MHz*/
+	/*configure i2c, SCL = PB8, SDA = PB9, clocked from APB1 (16MHz by default)*/
 
 	//struct configure i2c
 	I2C_CONFIG i2c;
-	i2c.FREQ_IN_MHz = 16;
 	i2c.I2C = I2C3;
 
 	//configure SCL for PB8
@@ -35,13 +162,205 @@ int main(void)
 	I2C_SDA_CONFIG sda = {I2C3_SDA_PB4, GPIOB};
 	i2c.SDA_CONFIG = sda;
 
+	//fast mode, 400KHz (the most the LCD's I2C takes), so a full
+	//framebuffer redraw takes ~0.7ms instead of ~2.7ms in standard mode
+	i2c.SPEED_HZ = I2C_FAST_MODE_FREQ;
+	i2c.DUTY = I2C_DUTY_2;
+
 	//init i2c
 	i2c_init(i2c);
 
 	//init lcd
 	lcd_init(i2c);
 
-	//write to the lcd, up to 8 characters
+	//write to the lcd, 8 characters per line
 	lcd_write(i2c, "HELLO");
+	lcd_set_cursor(i2c, 1, 0);
+	lcd_write(i2c, "WORLD");
+
+	#ifdef I2C_TIMING_TEST
+		for(uint32_t pclk1 = 2000000; pclk1 <= 42000000; pclk1 += 1000000)
+		{
+			check_timing(pclk1, I2C_STANDARD_MODE_FREQ, I2C_DUTY_2, 1, 1, 4000, 4700);
+			check_timing(pclk1, I2C_FAST_MODE_FREQ, I2C_DUTY_2, 1, 2, 600, 1300);
+			check_timing(pclk1, I2C_FAST_MODE_FREQ, I2C_DUTY_16_9, 9, 16, 600, 1300);
+		}
+
+		//too fast for I2C, and too slow for a 12 bit CCR at 42MHz
+		I2C_TIMING timing;
+		if(i2c_timing(16000000, 1000000, I2C_DUTY_2, &timing) == 0 || i2c_timing(42000000, 5000, I2C_DUTY_2, &timing) == 0)
+		{
+			timingErrors++;
+		}
+
+		//expect timingChecked = 123, timingErrors = 0
+		while(1);
+	#endif
+
+	#ifdef I2C_READ_TEST
+		lcdStatus = i2c_read_register_byte(i2c, LCD_SLAVE_ADDR, 0x00);
+
+		//each of these ends with a NACK + stop, if one of them closes
+		//wrong the next start never gets SB and the test hangs here
+		i2c_read(i2c, LCD_SLAVE_ADDR, readOne, sizeof(readOne));
+		i2c_read(i2c, LCD_SLAVE_ADDR, readTwo, sizeof(readTwo));
+		i2c_read(i2c, LCD_SLAVE_ADDR, readMany, sizeof(readMany));
+		readDmaResult = i2c_read_dma(i2c, LCD_SLAVE_ADDR, readDma, sizeof(readDma));
+
+		//and once more to check the bus was left idle by the DMA read
+		lcdStatus = i2c_read_register_byte(i2c, LCD_SLAVE_ADDR, 0x00);
+
+		//expect readDmaResult = 0, and bit 7 of lcdStatus (busy) clear
+		while(1);
+	#endif
+
+	#ifdef I2C_RECOVERY_TEST
+		uint32_t start;
+		uint8_t data[2];
+
+		//nothing acknowledges the address, so this has to come back on the NACK
+		//instead of waiting for ADDR forever
+		start = cycles_now();
+		nackResult = i2c_read(i2c, LCD_SLAVE_ADDR + 1, data, sizeof(data));
+		nackUs = cycles_to_us(cycles_elapsed(start));
+		nackError = i2c_error(i2c.I2C);
+
+		start = cycles_now();
+		recoverResult = i2c_recover(i2c);
+		recoverUs = cycles_to_us(cycles_elapsed(start));
+
+		//a 10 byte write takes ~250us at 400KHz, far longer than it is given
+		static const uint8_t text[] = {LCD_CONTROL_DATA, 'T', 'I', 'M', 'E', 'O', 'U', 'T', ' ', ' '};
+		I2C_TRANSFER slow = {LCD_SLAVE_ADDR, text, sizeof(text), NULL, 0, timeout_done, NULL, 1};
+
+		start = cycles_now();
+		i2c_transfer(i2c.I2C, &slow);
+		while(i2c_busy(i2c.I2C));
+		timeoutUs = cycles_to_us(cycles_elapsed(start));
+
+		//the bus should be usable again
+		afterResult = i2c_read(i2c, LCD_SLAVE_ADDR, (uint8_t*)&lcdStatus, 1);
+
+		//expect nackResult = -1, nackError = I2C_STATUS_NACK, nackUs ~30
+		//recoverResult = 0, recoverUs ~120
+		//timeoutStatus = I2C_STATUS_TIMEOUT, timeoutUs ~120 (mostly the recovery)
+		//afterResult = 0
+		while(1);
+	#endif
+
+	#ifdef LCD_FRAMEBUFFER_TEST
+		uint32_t start;
+
+		start = cycles_now();
+		lcd_write(i2c, "ABCDEFGH");
+		writeUs = cycles_to_us(cycles_elapsed(start));
+
+		lcd_fb_init(&fb, i2c);
+
+		lcd_fb_write(&fb, 0, 0, "DISTANCE");
+		lcd_fb_write(&fb, 1, 0, "  123 CM");
+		start = cycles_now();
+		flushResult = lcd_fb_flush(&fb);
+		redrawUs = cycles_to_us(cycles_elapsed(start));
+
+		//the same line again with one digit changed
+		lcd_fb_write(&fb, 1, 0, "  124 CM");
+		start = cycles_now();
+		lcd_fb_flush(&fb);
+		updateUs = cycles_to_us(cycles_elapsed(start));
+
+		start = cycles_now();
+		lcd_fb_flush(&fb);
+		unchangedUs = cycles_to_us(cycles_elapsed(start));
+
+		//expect flushResult = 0, writeUs ~250 (one transaction now)
+		//redrawUs ~700 at 400KHz (29 bytes), ~2700 with SPEED_HZ = I2C_STANDARD_MODE_FREQ
+		//updateUs ~120 (4 bytes), unchangedUs ~0
+		while(1);
+	#endif
+
+	#ifdef LCD_GLYPH_TEST
+		uint32_t start = cycles_now();
+		loadResult = lcd_load_glyphs(i2c, 0, glyphs, 2);
+		loadUs = cycles_to_us(cycles_elapsed(start));
+
+		badLoadResult = lcd_load_glyphs(i2c, 7, glyphs, 2);
+		badCursorResult = lcd_set_cursor(i2c, 2, 0);
+
+		//the test text is cleared, smileys on the top line and hearts on the bottom
+		lcd_fb_init(&glyphFb, i2c);
+		lcd_fb_invalidate(&glyphFb);
+
+		for(uint8_t col = 0; col < LCD_COLS; col++)
+		{
+			lcd_fb_set(&glyphFb, 0, col, 0);
+			lcd_fb_set(&glyphFb, 1, col, 1);
+		}
+
+		lcd_fb_flush(&glyphFb);
+
+		//expect loadResult = 0, badLoadResult = -1, badCursorResult = -1
+		//loadUs ~500 at 400KHz (one transaction of 20 bytes)
+		//8 smileys on the top line, 8 hearts on the bottom line
+		while(1);
+	#endif
+
+	#ifdef LCD_RENDER_TEST
+		lcd_render_init(&render, i2c);
+		lcd_printf(&render, 0, 0, "COUNT");
+
+		//a new value every loop, the LCD only gets the latest one each time it is free
+		for(uint32_t i = 0; i <= 10000; i++)
+		{
+			uint32_t start = cycles_now();
+			lcd_printf(&render, 1, 0, "%lu", i);
+			lcd_render_poll(&render);
+			uint32_t us = cycles_to_us(cycles_elapsed(start));
+
+			if(us > printfMaxUs)
+			{
+				printfMaxUs = us;
+			}
+
+			loops++;
+		}
+
+		while(lcd_render_busy(&render))
+		{
+			lcd_render_poll(&render);
+		}
+
+		//expect "COUNT" on the top line and "10000" on the bottom line
+		//render.REQUESTS = 10002, render.DROPPED = 0, render.ERRORS = 0
+		//render.FRAMES a small fraction of REQUESTS, the rest COALESCED
+		//printfMaxUs in the tens of us, no matter how long a burst takes
+		while(1);
+	#endif
+
+	#ifdef I2C_ASYNC_TEST
+		//the data control byte, then the characters, long enough to go through DMA
+		static const uint8_t text[] = {LCD_CONTROL_DATA, ' ', 'A', 'S', 'Y', 'N', 'C'};
+
+		//nothing at the address after the LCD, this one should be NACKed
+		I2C_TRANSFER probe = {LCD_SLAVE_ADDR + 1, NULL, 0, NULL, 0, transfer_done, NULL};
+
+		//only the address, the LCD should acknowledge it
+		I2C_TRANSFER ping = {LCD_SLAVE_ADDR, NULL, 0, NULL, 0, transfer_done, NULL};
+
+		I2C_TRANSFER write = {LCD_SLAVE_ADDR, text, sizeof(text), NULL, 0, transfer_done, NULL};
+
+		//all three are queued back to back, main doesn't wait for any of them
+		i2c_transfer(i2c.I2C, &probe);
+		i2c_transfer(i2c.I2C, &ping);
+		i2c_transfer(i2c.I2C, &write);
+
+		while(i2c_busy(i2c.I2C))
+		{
+			mainLoops++;
+		}
+
+		//expect transfersDone = 3, transfersNacked = 1, write.STATUS = I2C_STATUS_OK
+		while(1);
+	#endif
 }
 
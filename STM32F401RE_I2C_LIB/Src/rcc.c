@@ -0,0 +1,284 @@
+/**
+ ******************************************************************************
+ * @file           : rcc.c
+ * @author         : Nubal Manhas
+ * @brief          : Main c file for RCC (clock) library
+ ******************************************************************************
+ * @purpose
+ *
+ * The purpose of this file is to define functions that will support
+ * configuring and reading the clock tree of the STM32F01RE MCU
+ *
+ ******************************************************************************
+ */
+#include "rcc.h"
+#include "flash.h"
+
+/*
+ * PLL settings for 84MHz, from 6.3.2 in Ref Manual:
+ *
+ * VCO input  = source / M, 2MHz is recommended to limit jitter
+ * VCO output = VCO input * N, has to be between 192 and 432MHz
+ * SYSCLK     = VCO output / P
+ * USB/SDIO   = VCO output / Q, has to be 48MHz for USB
+ *
+ * HSI: 16MHz / 8 = 2MHz * 168 = 336MHz / 4 = 84MHz, 336MHz / 7 = 48MHz
+ * HSE:  8MHz / 4 = 2MHz * 168 = 336MHz / 4 = 84MHz, 336MHz / 7 = 48MHz
+ */
+#define PLL_M_HSI			8
+#define PLL_M_HSE			4
+#define PLL_N				168
+#define PLL_P				4
+#define PLL_Q				7
+
+//AHB prescaler for each HPRE value, 6.3.3 in Ref Manual
+static const uint16_t AHB_PRESCALERS[16] = {1, 1, 1, 1, 1, 1, 1, 1, 2, 4, 8, 16, 64, 128, 256, 512};
+
+//APB prescaler for each PPREx value, 6.3.3 in Ref Manual
+static const uint8_t APB_PRESCALERS[8] = {1, 1, 1, 1, 2, 4, 8, 16};
+
+//CMSIS core clock variable, declared in system_stm32f4xx.h
+uint32_t SystemCoreClock = RCC_HSI_FREQ;
+
+int rcc_wait_ready(uint32_t readyBit);
+
+/*
+ * Function to wait for an oscillator or the PLL to become ready
+ */
+int rcc_wait_ready(uint32_t readyBit)
+{
+	for(uint32_t i = 0; i < RCC_READY_TIMEOUT; i++)
+	{
+		if(RCC->CR & readyBit)
+		{
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+/*
+ * Function to run SYSCLK at 84MHz from the PLL
+ *
+ * HCLK = 84MHz, APB1 = 42MHz (its max), APB2 = 84MHz.
+ *
+ * Following the order in 3.5.1 in Ref Manual, the flash wait states
+ * are raised before the clock is, since flash can't be read at 84MHz
+ * with the reset value of 0 wait states. The ART accelerator is turned
+ * on as well, so the wait states are mostly hidden. The regulator is
+ * also set to scale 2, which covers up to 84MHz (5.1.3 in Ref Manual).
+ *
+ * If HSE doesn't start, nothing is changed and -1 is returned, so the
+ * MCU keeps running on HSI at 16MHz.
+ *
+ * This should be called first thing in main(), before any of the other
+ * libraries are initialized, since they read the clocks when they set
+ * up their dividers.
+ */
+int rcc_init(RCC_CLOCK_SOURCE source)
+{
+	uint32_t pllcfgr;
+
+	//start the PLL's source oscillator
+	//6.3.1 in Ref Manual
+	if(source == RCC_SOURCE_HSI)
+	{
+		RCC->CR |= RCC_CR_HSION;
+
+		if(rcc_wait_ready(RCC_CR_HSIRDY) != 0)
+		{
+			return -1;
+		}
+
+		pllcfgr = (PLL_M_HSI << RCC_PLLCFGR_PLLM_Pos);
+	}
+	else
+	{
+		if(source == RCC_SOURCE_HSE_BYPASS)
+		{
+			RCC->CR |= RCC_CR_HSEBYP;
+		}
+		else
+		{
+			RCC->CR &= ~RCC_CR_HSEBYP;
+		}
+
+		RCC->CR |= RCC_CR_HSEON;
+
+		if(rcc_wait_ready(RCC_CR_HSERDY) != 0)
+		{
+			RCC->CR &= ~(RCC_CR_HSEON | RCC_CR_HSEBYP);
+			return -1;
+		}
+
+		pllcfgr = (PLL_M_HSE << RCC_PLLCFGR_PLLM_Pos) | RCC_PLLCFGR_PLLSRC_HSE;
+	}
+
+	//regulator voltage scale 2 (up to 84MHz)
+	//5.4.1 in Ref Manual
+	RCC->APB1ENR |= RCC_APB1ENR_PWREN;
+	PWR->CR = (PWR->CR & ~PWR_CR_VOS) | (2U << PWR_CR_VOS_Pos);
+
+	//the PLL can't be changed while it is the system clock, so
+	//move back to HSI first in case this is being called again
+	//6.3.3 in Ref Manual
+	if((RCC->CFGR & RCC_CFGR_SWS) == RCC_CFGR_SWS_PLL)
+	{
+		RCC->CR |= RCC_CR_HSION;
+		rcc_wait_ready(RCC_CR_HSIRDY);
+
+		RCC->CFGR &= ~RCC_CFGR_SW;
+		while((RCC->CFGR & RCC_CFGR_SWS) != RCC_CFGR_SWS_HSI);
+	}
+
+	//the PLL has to be off to be configured
+	//6.3.1/6.3.2 in Ref Manual
+	RCC->CR &= ~RCC_CR_PLLON;
+	while(RCC->CR & RCC_CR_PLLRDY);
+
+	//P is encoded as (P / 2) - 1
+	RCC->PLLCFGR = pllcfgr |
+				   (PLL_N << RCC_PLLCFGR_PLLN_Pos) |
+				   (((PLL_P / 2) - 1) << RCC_PLLCFGR_PLLP_Pos) |
+				   (PLL_Q << RCC_PLLCFGR_PLLQ_Pos);
+
+	RCC->CR |= RCC_CR_PLLON;
+
+	if(rcc_wait_ready(RCC_CR_PLLRDY) != 0)
+	{
+		return -1;
+	}
+
+	//2 wait states are needed for 84MHz, this has to be
+	//in place before the clock goes up
+	flash_set_latency(RCC_SYSCLK_MAX);
+
+	//AHB /1, APB1 /2 (max 42MHz), APB2 /1
+	//6.3.3 in Ref Manual
+	RCC->CFGR = (RCC->CFGR & ~(RCC_CFGR_HPRE | RCC_CFGR_PPRE1 | RCC_CFGR_PPRE2)) |
+				RCC_CFGR_HPRE_DIV1 | RCC_CFGR_PPRE1_DIV2 | RCC_CFGR_PPRE2_DIV1;
+
+	//switch SYSCLK over to the PLL
+	RCC->CFGR = (RCC->CFGR & ~RCC_CFGR_SW) | RCC_CFGR_SW_PLL;
+	while((RCC->CFGR & RCC_CFGR_SWS) != RCC_CFGR_SWS_PLL);
+
+	flash_art_enable();
+
+	SystemCoreClock = rcc_get_hclk();
+
+	return 0;
+}
+
+/*
+ * Function to return the SYSCLK frequency in Hz
+ *
+ * This is worked out from the registers every time, so it is
+ * correct whether rcc_init() has been called or not
+ *
+ * 6.3.2/6.3.3 in Ref Manual
+ */
+uint32_t rcc_get_sysclk(void)
+{
+	uint32_t pllcfgr = RCC->PLLCFGR;
+	uint32_t input;
+	uint32_t m, n, p;
+
+	switch(RCC->CFGR & RCC_CFGR_SWS)
+	{
+		case RCC_CFGR_SWS_HSE:
+			return RCC_HSE_FREQ;
+
+		case RCC_CFGR_SWS_PLL:
+			input = (pllcfgr & RCC_PLLCFGR_PLLSRC) ? RCC_HSE_FREQ : RCC_HSI_FREQ;
+			m = (pllcfgr & RCC_PLLCFGR_PLLM) >> RCC_PLLCFGR_PLLM_Pos;
+			n = (pllcfgr & RCC_PLLCFGR_PLLN) >> RCC_PLLCFGR_PLLN_Pos;
+			p = (((pllcfgr & RCC_PLLCFGR_PLLP) >> RCC_PLLCFGR_PLLP_Pos) + 1) * 2;
+			return ((input / m) * n) / p;
+
+		default:
+			return RCC_HSI_FREQ;
+	}
+}
+
+/*
+ * Function to return the AHB clock (HCLK) in Hz
+ *
+ * 6.3.3 in Ref Manual
+ */
+uint32_t rcc_get_hclk(void)
+{
+	return rcc_get_sysclk() / AHB_PRESCALERS[(RCC->CFGR & RCC_CFGR_HPRE) >> RCC_CFGR_HPRE_Pos];
+}
+
+/*
+ * Function to return the APB1 clock (PCLK1) in Hz
+ *
+ * 6.3.3 in Ref Manual
+ */
+uint32_t rcc_get_pclk1(void)
+{
+	return rcc_get_hclk() / APB_PRESCALERS[(RCC->CFGR & RCC_CFGR_PPRE1) >> RCC_CFGR_PPRE1_Pos];
+}
+
+/*
+ * Function to return the APB2 clock (PCLK2) in Hz
+ *
+ * 6.3.3 in Ref Manual
+ */
+uint32_t rcc_get_pclk2(void)
+{
+	return rcc_get_hclk() / APB_PRESCALERS[(RCC->CFGR & RCC_CFGR_PPRE2) >> RCC_CFGR_PPRE2_Pos];
+}
+
+/*
+ * Function to return the clock of the timers on APB1
+ *
+ * The timers get PCLK1 when the APB1 prescaler is 1,
+ * otherwise they get twice PCLK1 (Figure 12 in Ref Manual)
+ */
+uint32_t rcc_get_timclk1(void)
+{
+	if((RCC->CFGR & RCC_CFGR_PPRE1) >> RCC_CFGR_PPRE1_Pos < 4)
+	{
+		return rcc_get_pclk1();
+	}
+
+	return rcc_get_pclk1() * 2;
+}
+
+/*
+ * Function to return the clock of the timers on APB2
+ *
+ * Same as APB1, twice PCLK2 if the APB2 prescaler isn't 1
+ */
+uint32_t rcc_get_timclk2(void)
+{
+	if((RCC->CFGR & RCC_CFGR_PPRE2) >> RCC_CFGR_PPRE2_Pos < 4)
+	{
+		return rcc_get_pclk2();
+	}
+
+	return rcc_get_pclk2() * 2;
+}
+
+/*
+ * Function called by the startup code (startup_stm32f401retx.s) right
+ * after reset, before main() and before .data/.bss are set up, so it
+ * can only touch registers.
+ *
+ * - gives the CPU full access to the FPU (CP10/CP11), which is off after
+ *   reset even though the project is built for hardware floating point
+ *   (4.6.1 in CortexM4 Generic User Guide)
+ * - sets the flash wait states for the reset clock (HSI 16MHz) and turns
+ *   on the ART accelerator, rcc_init() keeps both right if the clock
+ *   is raised later
+ */
+void SystemInit(void)
+{
+	SCB->CPACR |= ((3UL << (10 * 2)) | (3UL << (11 * 2)));
+	__DSB();
+	__ISB();
+
+	flash_config(rcc_get_hclk());
+}
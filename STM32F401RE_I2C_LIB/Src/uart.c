@@ -13,12 +13,83 @@
  */
 #include "gpio.h"
 #include "uart.h"
-#include <math.h>
+#include "rcc.h"
 #include <stdint.h>
 
 void uart_enable_clk(UART_CONFIG UART);
 void uart_baudrate(UART_CONFIG UART,uint32_t bd);
+uint32_t uart_get_pclk(USART_TypeDef* USART);
+int uart_baud_solve_mode(uint32_t pclk, uint32_t baudrate, int over8, UART_BAUD* result);
+UART_BAUD* uart_baud_get(USART_TypeDef* USART);
 void uart_cr1_enable(UART_CONFIG UART);
+void uart_nvic_enable(UART_CONFIG UART);
+UART_TX_RING* uart_tx_ring_get(USART_TypeDef* USART);
+UART_DMA_TX* uart_dma_tx_get(USART_TypeDef* USART);
+void uart_dma_tx_callback(void* context, uint32_t events);
+UART_DMA_RX* uart_dma_rx_get(USART_TypeDef* USART);
+void uart_dma_rx_callback(void* context, uint32_t events);
+void uart_dma_rx_irq(USART_TypeDef* USART, UART_DMA_RX* rx);
+
+//baudrate settings for USART1, USART2, and USART6
+static UART_BAUD uart1_baud;
+static UART_BAUD uart2_baud;
+static UART_BAUD uart6_baud;
+
+//transmit ring buffers for USART1, USART2, and USART6
+static UART_TX_RING uart1_tx_ring;
+static UART_TX_RING uart2_tx_ring;
+static UART_TX_RING uart6_tx_ring;
+
+/*
+ * DMA transmit streams for USART1, USART2, and USART6
+ *
+ * USART1_TX = DMA2 Stream7 Channel4
+ * USART2_TX = DMA1 Stream6 Channel4
+ * USART6_TX = DMA2 Stream6 Channel5
+ *
+ * Table 27/Table 28 in Ref Manual
+ */
+static UART_DMA_TX uart1_dma_tx = {
+								   {DMA2, DMA_STREAM7, DMA_CH4, DMA_MEMORY_TO_PERIPH, DMA_SIZE_BYTE, DMA_SIZE_BYTE, DMA_PRIORITY_MEDIUM, DMA_NORMAL, 1},
+								   USART1
+								  };
+
+static UART_DMA_TX uart2_dma_tx = {
+								   {DMA1, DMA_STREAM6, DMA_CH4, DMA_MEMORY_TO_PERIPH, DMA_SIZE_BYTE, DMA_SIZE_BYTE, DMA_PRIORITY_MEDIUM, DMA_NORMAL, 1},
+								   USART2
+								  };
+
+static UART_DMA_TX uart6_dma_tx = {
+								   {DMA2, DMA_STREAM6, DMA_CH5, DMA_MEMORY_TO_PERIPH, DMA_SIZE_BYTE, DMA_SIZE_BYTE, DMA_PRIORITY_MEDIUM, DMA_NORMAL, 1},
+								   USART6
+								  };
+
+/*
+ * DMA receive streams for USART1, USART2, and USART6
+ *
+ * USART1_RX = DMA2 Stream2 Channel4
+ * USART2_RX = DMA1 Stream5 Channel4
+ * USART6_RX = DMA2 Stream1 Channel5
+ *
+ * Receiving gets a higher priority than transmitting, since a late
+ * receive request loses data and a late transmit request doesn't
+ *
+ * Table 27/Table 28 in Ref Manual
+ */
+static UART_DMA_RX uart1_dma_rx = {
+								   {DMA2, DMA_STREAM2, DMA_CH4, DMA_PERIPH_TO_MEMORY, DMA_SIZE_BYTE, DMA_SIZE_BYTE, DMA_PRIORITY_HIGH, DMA_CIRCULAR, 1},
+								   USART1
+								  };
+
+static UART_DMA_RX uart2_dma_rx = {
+								   {DMA1, DMA_STREAM5, DMA_CH4, DMA_PERIPH_TO_MEMORY, DMA_SIZE_BYTE, DMA_SIZE_BYTE, DMA_PRIORITY_HIGH, DMA_CIRCULAR, 1},
+								   USART2
+								  };
+
+static UART_DMA_RX uart6_dma_rx = {
+								   {DMA2, DMA_STREAM1, DMA_CH5, DMA_PERIPH_TO_MEMORY, DMA_SIZE_BYTE, DMA_SIZE_BYTE, DMA_PRIORITY_HIGH, DMA_CIRCULAR, 1},
+								   USART6
+								  };
 
 /*
  * Function for initializing UART
@@ -92,6 +163,10 @@ void uart_init(UART_CONFIG UART, uint32_t baudrate)
 
 	//enable uart/tx/rx in CR1 register
 	uart_cr1_enable(UART);
+
+	//enable the USART global interrupt, nothing will fire
+	//until one of the interrupt enable bits in CR1 is set
+	uart_nvic_enable(UART);
 }
 
 /*
@@ -103,8 +178,8 @@ void uart_enable_clk(UART_CONFIG UART)
 {
 	//Set USART enable bit in peripheral clock enable
 	//register for clock access (6.3.11/6.3.12 in Ref Manual)
-	//APB1 = 42MHz
-	//APB2 = 84MHz
+	//APB1 = 42MHz max
+	//APB2 = 84MHz max
 	if(UART.USART == USART2)
 	{
 		RCC->APB1ENR |= USART2_EN;
@@ -121,51 +196,175 @@ void uart_enable_clk(UART_CONFIG UART)
 }
 
 /*
- * Function to configure USART baudrate
+ * Function to return the clock feeding the given USART in Hz,
+ * read from the RCC so it follows whatever rcc_init() set up
  *
- * Based on the formula in 19.3.4 in Ref Manual
+ * Based on Fig. 3 in Datasheet, APB1 = USART2, APB2 = USART1/USART6
  */
-void uart_baudrate(UART_CONFIG UART,uint32_t bd)
+uint32_t uart_get_pclk(USART_TypeDef* USART)
 {
-	double USARTDIV = 0; //stores number to be coded to USART_BRR register
-	int i_frac = 0;
-	int mantissa = 0;
-	double frac = 0;
-	double fracDiff = 0;
+	if(USART == USART2)
+	{
+		return rcc_get_pclk1();
+	}
 
-	if(UART.USART == USART2)
+	return rcc_get_pclk2();
+}
+
+/*
+ * Function to calculate BRR for one oversampling mode
+ *
+ * From 19.3.4 in Ref Manual: baud = pclk / (8 * (2 - OVER8) * USARTDIV),
+ * so USARTDIV scaled up by the oversampling (16 or 8) is just pclk / baud.
+ * That value is rounded to the nearest integer, and then split into
+ * DIV_Mantissa (12 bits) and DIV_Fraction (4 bits, or 3 bits with OVER8,
+ * where bit 3 has to be kept clear).
+ *
+ * Only integer math is used, so no floating point code gets pulled in
+ */
+int uart_baud_solve_mode(uint32_t pclk, uint32_t baudrate, int over8, UART_BAUD* result)
+{
+	uint32_t oversampling = over8 ? 8 : 16;
+	uint32_t div;
+	uint32_t mantissa;
+	uint32_t fraction;
+	int64_t error;
+
+	if(baudrate == 0)
+	{
+		return -1;
+	}
+
+	//rounded pclk / baud, done as 64 bit so large clocks can't overflow
+	div = (uint32_t)(((uint64_t)pclk + (baudrate / 2)) / baudrate);
+
+	mantissa = div / oversampling;
+	fraction = div % oversampling;
+
+	//USARTDIV has to be at least 1, and the mantissa is only 12 bits
+	if(mantissa < 1 || mantissa > 0xFFF)
+	{
+		return -1;
+	}
+
+	result->BRR = (mantissa << 4) | fraction;
+	result->OVER8 = over8 ? 1 : 0;
+
+	//the baudrate that div actually gives, rounded to the nearest Hz
+	result->BAUDRATE = (pclk + (div / 2)) / div;
+
+	//(pclk / div - baud) / baud, scaled to ppm without rounding twice
+	error = ((int64_t)pclk - ((int64_t)div * baudrate)) * 1000000;
+	result->ERROR_PPM = (int32_t)(error / ((int64_t)div * baudrate));
+
+	return 0;
+}
+
+/*
+ * Function to calculate BRR for a baudrate from the peripheral clock in Hz
+ *
+ * 16 times oversampling is used by default since it is more tolerant
+ * to clock deviation (19.3.5 in Ref Manual). 8 times oversampling is only
+ * picked when 16 can't reach the baudrate (above pclk / 16), or when it
+ * gets closer to the requested baudrate. The max is pclk / 8.
+ *
+ * Returns -1 if the baudrate can't be made from pclk at all
+ */
+int uart_baud_solve(uint32_t pclk, uint32_t baudrate, UART_BAUD* result)
+{
+	UART_BAUD over16 = {0, 0, 0, 0};
+	UART_BAUD over8 = {0, 0, 0, 0};
+	int over16Valid = (uart_baud_solve_mode(pclk, baudrate, 0, &over16) == 0);
+	int over8Valid = (uart_baud_solve_mode(pclk, baudrate, 1, &over8) == 0);
+	int32_t over16Error = (over16.ERROR_PPM < 0) ? -over16.ERROR_PPM : over16.ERROR_PPM;
+	int32_t over8Error = (over8.ERROR_PPM < 0) ? -over8.ERROR_PPM : over8.ERROR_PPM;
+
+	if(over16Valid && (!over8Valid || over16Error <= over8Error))
+	{
+		*result = over16;
+		return 0;
+	}
+
+	if(over8Valid)
 	{
-		//16MHz
-		USARTDIV = ((double)APB1_FREQ)/((double)(16*bd));
-	} else{
-		USARTDIV = APB2_FREQ/(16*bd);
+		*result = over8;
+		return 0;
 	}
 
-	mantissa = (int)USARTDIV; //getting the DIV_MANTISSA part
-	frac = (USARTDIV - mantissa) * 16; //getting DIV_Fraction part
+	return -1;
+}
 
-	//DIV_Fraction is 4 bits, so anything higher than 15d (0xF) is an overflow
-	if(frac > 15)
+/*
+ * Function to return the stored baudrate settings for the given USART
+ */
+UART_BAUD* uart_baud_get(USART_TypeDef* USART)
+{
+	if(USART == USART1)
 	{
-		//carry over the overflow to the mantissa
-		mantissa += 1;
-		frac = 0;
+		return &uart1_baud;
 	}
+	else if(USART == USART2)
+	{
+		return &uart2_baud;
+	}
+	else if(USART == USART6)
+	{
+		return &uart6_baud;
+	}
+
+	return NULL;
+}
 
-	//need to check decimal for rounding purposes, since round() doesn't seem to work
-	fracDiff = frac - ((int) frac);
+/*
+ * Function to return the baudrate settings that were last applied,
+ * all 0 if the baudrate couldn't be set
+ */
+UART_BAUD uart_get_baud(USART_TypeDef* USART)
+{
+	UART_BAUD* baud = uart_baud_get(USART);
+	UART_BAUD none = {0, 0, 0, 0};
 
-	if(fracDiff >= 0.5)
+	if(baud == NULL)
 	{
-		frac++;
+		return none;
 	}
 
-	i_frac = (int)(frac); //want to round down to int
+	return *baud;
+}
+
+/*
+ * Function to configure USART baudrate
+ *
+ * BRR and OVER8 are written outright, rather than OR'd in, so an
+ * earlier setting can't leave bits behind. This is called before UE
+ * is set in uart_init(), since OVER8 should only change while the
+ * USART is disabled.
+ *
+ * 19.3.4/19.6.3/19.6.4 in Ref Manual
+ */
+void uart_baudrate(UART_CONFIG UART,uint32_t bd)
+{
+	UART_BAUD result = {0, 0, 0, 0};
+	UART_BAUD* stored = uart_baud_get(UART.USART);
+
+	if(uart_baud_solve(uart_get_pclk(UART.USART), bd, &result) == 0)
+	{
+		if(result.OVER8)
+		{
+			UART.USART->CR1 |= USART_CR1_OVER8;
+		}
+		else
+		{
+			UART.USART->CR1 &= ~USART_CR1_OVER8;
+		}
+
+		UART.USART->BRR = result.BRR;
+	}
 
-	//set baudrate in USART_BRR
-	//19.6.3 in Ref Manual
-	UART.USART->BRR |= (i_frac<<0);
-	UART.USART->BRR |= (mantissa<<4);
+	if(stored != NULL)
+	{
+		*stored = result;
+	}
 }
 
 /*
@@ -221,3 +420,592 @@ char uart_read(USART_TypeDef* USART)
 	while(!(USART->SR & USART_SR_RXNE)){}
 	return USART->DR;
 }
+
+/*
+ * Function for enabling the USARTx global interrupt in the NVIC
+ *
+ * Table 38 in Ref Manual for the positions, USART1 = 37,
+ * USART2 = 38, USART6 = 71.
+ *
+ * 4.2.1 in the Cortex-M4 User Guide
+ */
+void uart_nvic_enable(UART_CONFIG UART)
+{
+	if(UART.USART == USART1)
+	{
+		NVIC->ISER[1] |= (1U << (USART1_IRQn - 32));
+	}
+	else if(UART.USART == USART2)
+	{
+		NVIC->ISER[1] |= (1U << (USART2_IRQn - 32));
+	}
+	else if(UART.USART == USART6)
+	{
+		NVIC->ISER[2] |= (1U << (USART6_IRQn - 64));
+	}
+}
+
+/*
+ * Function to return the transmit ring buffer that belongs
+ * to the given USART, NULL if there isn't one
+ */
+UART_TX_RING* uart_tx_ring_get(USART_TypeDef* USART)
+{
+	if(USART == USART1)
+	{
+		return &uart1_tx_ring;
+	}
+	else if(USART == USART2)
+	{
+		return &uart2_tx_ring;
+	}
+	else if(USART == USART6)
+	{
+		return &uart6_tx_ring;
+	}
+
+	return NULL;
+}
+
+/*
+ * Function to copy as much data as will fit into the ring buffer
+ *
+ * Only HEAD is written here, the interrupt only writes TAIL, so
+ * this doesn't need interrupts disabled. HEAD is moved after the
+ * data is copied so the interrupt never sees a byte that isn't
+ * there yet.
+ */
+size_t uart_tx_ring_push(UART_TX_RING* ring, const uint8_t* data, size_t length)
+{
+	uint32_t head = ring->HEAD;
+	uint32_t space = UART_TX_BUFFER_SIZE - (head - ring->TAIL);
+	size_t count = 0;
+
+	if(length > space)
+	{
+		length = space;
+	}
+
+	while(count < length)
+	{
+		ring->DATA[head & (UART_TX_BUFFER_SIZE - 1)] = data[count];
+		head++;
+		count++;
+	}
+
+	ring->HEAD = head;
+
+	return count;
+}
+
+/*
+ * Function to service the transmit side of a USART interrupt
+ *
+ * While there is data in the ring buffer, every TXE moves one byte into
+ * the data register. Once it is empty the TXE interrupt is turned off
+ * and TC is used to catch the end of the last frame, after which the
+ * transmitter is idle and all transmit interrupts are off.
+ *
+ * 19.3.2/19.6.1/19.6.4 in Ref Manual
+ */
+void uart_tx_ring_irq(USART_TypeDef* USART, UART_TX_RING* ring)
+{
+	if((USART->CR1 & USART_CR1_TXEIE) && (USART->SR & USART_SR_TXE))
+	{
+		if(ring->HEAD != ring->TAIL)
+		{
+			USART->DR = ring->DATA[ring->TAIL & (UART_TX_BUFFER_SIZE - 1)];
+			ring->TAIL++;
+		}
+		else
+		{
+			USART->CR1 &= ~USART_CR1_TXEIE;
+			USART->CR1 |= USART_CR1_TCIE;
+		}
+	}
+
+	if((USART->CR1 & USART_CR1_TCIE) && (USART->SR & USART_SR_TC))
+	{
+		USART->CR1 &= ~USART_CR1_TCIE;
+	}
+}
+
+/*
+ * Function to queue data for transmission without waiting on the USART
+ *
+ * The data is copied into the USART's ring buffer and the TXE interrupt is
+ * turned on to drain it. Nothing is blocked on, if the ring buffer fills up
+ * the rest of the data is dropped, so the return value should be checked
+ * against the length given.
+ *
+ * If a DMA transmit is in progress the data stays queued in the ring buffer
+ * and TXE is only turned on once the DMA transfer is complete, both paths
+ * write to the same data register.
+ */
+size_t uart_write_it(USART_TypeDef* USART, const uint8_t* data, size_t length)
+{
+	UART_TX_RING* ring = uart_tx_ring_get(USART);
+	UART_DMA_TX* tx = uart_dma_tx_get(USART);
+	size_t count;
+	uint32_t primask;
+
+	if(ring == NULL)
+	{
+		return 0;
+	}
+
+	count = uart_tx_ring_push(ring, data, length);
+
+	//CR1 is also changed by the interrupt, so the read-modify-write
+	//can't be interrupted part way through
+	primask = __get_PRIMASK();
+	__disable_irq();
+	if(!tx->BUSY)
+	{
+		USART->CR1 &= ~USART_CR1_TCIE;
+		USART->CR1 |= USART_CR1_TXEIE;
+	}
+	__set_PRIMASK(primask);
+
+	return count;
+}
+
+/*
+ * Function to queue a string for transmission without waiting on the USART
+ */
+size_t uart_write_string_it(USART_TypeDef* USART, const char* str)
+{
+	size_t length = 0;
+
+	while(str[length])
+	{
+		length++;
+	}
+
+	return uart_write_it(USART, (const uint8_t*)str, length);
+}
+
+/*
+ * Function to return how many more bytes can be queued
+ */
+size_t uart_tx_free(USART_TypeDef* USART)
+{
+	UART_TX_RING* ring = uart_tx_ring_get(USART);
+
+	if(ring == NULL)
+	{
+		return 0;
+	}
+
+	return UART_TX_BUFFER_SIZE - (ring->HEAD - ring->TAIL);
+}
+
+/*
+ * Function to wait until the ring buffer is empty and the last
+ * frame has left the shift register (TC = 1)
+ *
+ * 19.6.1 in Ref Manual
+ */
+void uart_flush(USART_TypeDef* USART)
+{
+	UART_TX_RING* ring = uart_tx_ring_get(USART);
+
+	if(ring == NULL)
+	{
+		return;
+	}
+
+	while(ring->HEAD != ring->TAIL);
+	while(!(USART->SR & USART_SR_TC));
+}
+
+/*
+ * Function to return the DMA transmit state that belongs
+ * to the given USART, NULL if there isn't one
+ */
+UART_DMA_TX* uart_dma_tx_get(USART_TypeDef* USART)
+{
+	if(USART == USART1)
+	{
+		return &uart1_dma_tx;
+	}
+	else if(USART == USART2)
+	{
+		return &uart2_dma_tx;
+	}
+	else if(USART == USART6)
+	{
+		return &uart6_dma_tx;
+	}
+
+	return NULL;
+}
+
+/*
+ * Function to send a buffer over USART with DMA
+ *
+ * The buffer isn't copied, DMA reads it straight into the data register,
+ * so it has to stay untouched until the callback is called. The callback
+ * comes from the DMA transfer complete interrupt and can be NULL.
+ *
+ * -1 is returned without sending anything if a DMA transmit is already
+ * in progress, the interrupt driven transmit still has data queued, or
+ * the length doesn't fit in NDTR (65535 max).
+ *
+ * 19.3.13 in Ref Manual for transmission using DMA
+ */
+int uart_write_dma(USART_TypeDef* USART, const uint8_t* data, size_t length, UART_DMA_CALLBACK callback)
+{
+	UART_DMA_TX* tx = uart_dma_tx_get(USART);
+	UART_TX_RING* ring = uart_tx_ring_get(USART);
+
+	if(tx == NULL || length == 0 || length > 0xFFFF)
+	{
+		return -1;
+	}
+
+	//both transmit paths write to the same data register
+	if(tx->BUSY || ring->HEAD != ring->TAIL || (USART->CR1 & USART_CR1_TXEIE))
+	{
+		return -1;
+	}
+
+	tx->BUSY = 1;
+	tx->CALLBACK = callback;
+
+	dma_init(tx->DMA);
+	dma_interrupt_enable(tx->DMA, DMA_EVENT_TRANSFER_COMPLETE | DMA_EVENT_ERROR, uart_dma_tx_callback, tx);
+
+	//TC is cleared by writing 0 to it, and DMAT lets TXE make the DMA requests
+	//19.6.1/19.6.6 in Ref Manual
+	USART->SR = ~USART_SR_TC;
+	USART->CR3 |= USART_CR3_DMAT;
+
+	dma_start(tx->DMA, (uint32_t)&USART->DR, (uint32_t)data, (uint16_t)length);
+
+	return 0;
+}
+
+/*
+ * Function to check if a DMA transmit is still in progress
+ */
+int uart_dma_busy(USART_TypeDef* USART)
+{
+	UART_DMA_TX* tx = uart_dma_tx_get(USART);
+
+	if(tx == NULL)
+	{
+		return 0;
+	}
+
+	return tx->BUSY;
+}
+
+/*
+ * Function called from the DMA interrupt once a transmit is finished
+ *
+ * Transfer complete means the last byte has been moved into the data
+ * register, so the buffer can be reused. On an error the hardware has
+ * already disabled the stream, either way the transmit is over. Anything
+ * uart_write_it() queued while the DMA was running is started here.
+ */
+void uart_dma_tx_callback(void* context, uint32_t events)
+{
+	UART_DMA_TX* tx = (UART_DMA_TX*)context;
+	UART_TX_RING* ring = uart_tx_ring_get(tx->USART);
+
+	dma_interrupt_disable(tx->DMA);
+	tx->USART->CR3 &= ~USART_CR3_DMAT;
+	tx->BUSY = 0;
+
+	if(ring->HEAD != ring->TAIL)
+	{
+		tx->USART->CR1 |= USART_CR1_TXEIE;
+	}
+
+	if(tx->CALLBACK != NULL)
+	{
+		tx->CALLBACK(tx->USART);
+	}
+}
+
+/*
+ * Function to return the DMA receive state that belongs
+ * to the given USART, NULL if there isn't one
+ */
+UART_DMA_RX* uart_dma_rx_get(USART_TypeDef* USART)
+{
+	if(USART == USART1)
+	{
+		return &uart1_dma_rx;
+	}
+	else if(USART == USART2)
+	{
+		return &uart2_dma_rx;
+	}
+	else if(USART == USART6)
+	{
+		return &uart6_dma_rx;
+	}
+
+	return NULL;
+}
+
+/*
+ * Function to receive into a buffer with circular DMA
+ *
+ * The DMA keeps writing around the buffer without stopping, and the
+ * callback is given each new chunk of data when:
+ *
+ * - the line goes idle for one frame after data (IDLE interrupt),
+ *   so short messages come through right away
+ * - the DMA reaches the half way point or the end of the buffer
+ *   (HT/TC interrupts), so a long stream never overwrites data that
+ *   hasn't been given to the callback yet
+ *
+ * The callback has half the buffer's worth of time to deal with each
+ * chunk. The buffer has to stay valid until uart_read_dma_stop() is called.
+ *
+ * RX has to be configured in the UART_CONFIG given to uart_init().
+ *
+ * 19.3.13 in Ref Manual for reception using DMA
+ */
+int uart_read_dma_start(USART_TypeDef* USART, uint8_t* buffer, size_t size, UART_RX_CALLBACK callback)
+{
+	UART_DMA_RX* rx = uart_dma_rx_get(USART);
+	uint32_t primask;
+
+	if(rx == NULL || rx->ACTIVE || size < 2 || size > 0xFFFF)
+	{
+		return -1;
+	}
+
+	rx->BUFFER = buffer;
+	rx->SIZE = (uint16_t)size;
+	rx->POSITION = 0;
+	rx->CALLBACK = callback;
+	rx->STATS.BYTES = 0;
+	rx->STATS.OVERRUNS = 0;
+	rx->STATS.CHUNKS = 0;
+	rx->STATS.FRAMING_ERRORS = 0;
+	rx->STATS.NOISE_ERRORS = 0;
+	rx->STATS.PARITY_ERRORS = 0;
+
+	dma_init(rx->DMA);
+	dma_interrupt_enable(rx->DMA, DMA_EVENT_HALF_TRANSFER | DMA_EVENT_TRANSFER_COMPLETE, uart_dma_rx_callback, rx);
+
+	//clear anything left over in the data register and any old
+	//IDLE/ORE flags by reading SR then DR (19.6.1 in Ref Manual)
+	(void)USART->SR;
+	(void)USART->DR;
+
+	dma_start(rx->DMA, (uint32_t)&USART->DR, (uint32_t)buffer, (uint16_t)size);
+
+	//DMAR makes RXNE a DMA request, and EIE gives an interrupt on
+	//overrun while DMAR is set (19.6.6 in Ref Manual)
+	USART->CR3 |= (USART_CR3_DMAR | USART_CR3_EIE);
+
+	rx->ACTIVE = 1;
+
+	//CR1 is also changed by the transmit interrupt
+	primask = __get_PRIMASK();
+	__disable_irq();
+	USART->CR1 |= USART_CR1_IDLEIE;
+	__set_PRIMASK(primask);
+
+	return 0;
+}
+
+/*
+ * Function to stop a circular DMA receive, anything
+ * received but not yet given to the callback is dropped
+ */
+void uart_read_dma_stop(USART_TypeDef* USART)
+{
+	UART_DMA_RX* rx = uart_dma_rx_get(USART);
+	uint32_t primask;
+
+	if(rx == NULL || !rx->ACTIVE)
+	{
+		return;
+	}
+
+	primask = __get_PRIMASK();
+	__disable_irq();
+	USART->CR1 &= ~USART_CR1_IDLEIE;
+	__set_PRIMASK(primask);
+
+	USART->CR3 &= ~(USART_CR3_DMAR | USART_CR3_EIE);
+
+	dma_interrupt_disable(rx->DMA);
+	dma_stop(rx->DMA);
+
+	rx->ACTIVE = 0;
+}
+
+/*
+ * Function to return a copy of the receive counters
+ */
+UART_RX_STATS uart_rx_stats(USART_TypeDef* USART)
+{
+	UART_DMA_RX* rx = uart_dma_rx_get(USART);
+	UART_RX_STATS stats = {0, 0, 0, 0, 0, 0};
+
+	if(rx != NULL)
+	{
+		stats.BYTES = rx->STATS.BYTES;
+		stats.OVERRUNS = rx->STATS.OVERRUNS;
+		stats.CHUNKS = rx->STATS.CHUNKS;
+		stats.FRAMING_ERRORS = rx->STATS.FRAMING_ERRORS;
+		stats.NOISE_ERRORS = rx->STATS.NOISE_ERRORS;
+		stats.PARITY_ERRORS = rx->STATS.PARITY_ERRORS;
+	}
+
+	return stats;
+}
+
+/*
+ * Function to give the callback everything between the last position
+ * and the given one
+ *
+ * position is where the DMA will write next (SIZE - NDTR). If it is
+ * behind the last position the DMA has wrapped, so the end of the buffer
+ * and the start of it are given as two chunks.
+ *
+ * This is called from both the DMA and USART interrupts, which are at the
+ * same NVIC priority so they can't interrupt each other.
+ */
+void uart_dma_rx_process(UART_DMA_RX* rx, uint16_t position)
+{
+	if(position >= rx->SIZE)
+	{
+		position = 0;
+	}
+
+	if(position == rx->POSITION)
+	{
+		return;
+	}
+
+	if(position > rx->POSITION)
+	{
+		if(rx->CALLBACK != NULL)
+		{
+			rx->CALLBACK(rx->USART, &rx->BUFFER[rx->POSITION], position - rx->POSITION);
+		}
+		rx->STATS.BYTES += position - rx->POSITION;
+		rx->STATS.CHUNKS++;
+	}
+	else
+	{
+		if(rx->CALLBACK != NULL)
+		{
+			rx->CALLBACK(rx->USART, &rx->BUFFER[rx->POSITION], rx->SIZE - rx->POSITION);
+		}
+		rx->STATS.BYTES += rx->SIZE - rx->POSITION;
+		rx->STATS.CHUNKS++;
+
+		if(position > 0)
+		{
+			if(rx->CALLBACK != NULL)
+			{
+				rx->CALLBACK(rx->USART, rx->BUFFER, position);
+			}
+			rx->STATS.BYTES += position;
+			rx->STATS.CHUNKS++;
+		}
+	}
+
+	rx->POSITION = position;
+}
+
+/*
+ * Function called from the DMA interrupt at the half way point
+ * and the end of the receive buffer
+ */
+void uart_dma_rx_callback(void* context, uint32_t events)
+{
+	UART_DMA_RX* rx = (UART_DMA_RX*)context;
+
+	uart_dma_rx_process(rx, rx->SIZE - dma_remaining(rx->DMA));
+}
+
+/*
+ * Function to service the receive side of a USART interrupt
+ *
+ * IDLE, ORE, FE, NF and PE are all cleared by reading SR then DR, with
+ * EIE set FE/NF/ORE keep the interrupt pending until that's done. With
+ * DMA receiving, RXNE has already been serviced by the DMA, so reading
+ * DR here doesn't take a byte away from it.
+ *
+ * 19.3.4/19.6.1 in Ref Manual
+ */
+void uart_dma_rx_irq(USART_TypeDef* USART, UART_DMA_RX* rx)
+{
+	uint32_t sr = USART->SR;
+
+	if(sr & USART_SR_ORE)
+	{
+		rx->STATS.OVERRUNS++;
+	}
+
+	if(sr & USART_SR_FE)
+	{
+		rx->STATS.FRAMING_ERRORS++;
+	}
+
+	if(sr & USART_SR_NE)
+	{
+		rx->STATS.NOISE_ERRORS++;
+	}
+
+	if(sr & USART_SR_PE)
+	{
+		rx->STATS.PARITY_ERRORS++;
+	}
+
+	if(sr & (USART_SR_IDLE | USART_SR_ORE | USART_SR_FE | USART_SR_NE | USART_SR_PE))
+	{
+		(void)USART->DR;
+	}
+
+	if((sr & USART_SR_IDLE) && (USART->CR1 & USART_CR1_IDLEIE))
+	{
+		uart_dma_rx_process(rx, rx->SIZE - dma_remaining(rx->DMA));
+	}
+}
+
+/*
+ * Function to handle a USART interrupt
+ */
+void uart_irq_handler(USART_TypeDef* USART)
+{
+	UART_TX_RING* ring = uart_tx_ring_get(USART);
+	UART_DMA_RX* rx = uart_dma_rx_get(USART);
+
+	if(ring != NULL)
+	{
+		uart_tx_ring_irq(USART, ring);
+	}
+
+	if(rx != NULL && rx->ACTIVE)
+	{
+		uart_dma_rx_irq(USART, rx);
+	}
+}
+
+//interrupt request handlers, check Startup Folder -> startup_stm32f401retx.s for the vector table
+void USART1_IRQHandler(void)
+{
+	uart_irq_handler(USART1);
+}
+
+void USART2_IRQHandler(void)
+{
+	uart_irq_handler(USART2);
+}
+
+void USART6_IRQHandler(void)
+{
+	uart_irq_handler(USART6);
+}
@@ -0,0 +1,39 @@
+/**
+ ******************************************************************************
+ * @file           : flash.h
+ * @author         : Nubal Manhas
+ * @brief          : Header file for Flash interface library
+ ******************************************************************************
+ * @purpose
+ *
+ * The purpose of this file is to declare functions, enums, and structs, that
+ * will support the creation of a library for configuring the flash interface
+ * (wait states and ART accelerator) of the STM32F01RE MCU
+ *
+ ******************************************************************************
+ */
+
+#ifndef FLASH_H_
+#define FLASH_H_
+#include "stm32f4xx.h"
+#include <stdint.h>
+
+//highest HCLK in Hz for each number of wait states, at 2.7-3.6V
+//Table 6 in Ref Manual
+#define FLASH_0WS_MAX_FREQ		30000000
+#define FLASH_1WS_MAX_FREQ		60000000
+#define FLASH_2WS_MAX_FREQ		84000000
+
+//function to set the number of flash wait states needed for the given HCLK in Hz
+void flash_set_latency(uint32_t hclk);
+
+//function to turn on the ART accelerator (prefetch, instruction cache and data cache)
+void flash_art_enable(void);
+
+//function to turn off the ART accelerator
+void flash_art_disable(void);
+
+//function to set the wait states for the given HCLK in Hz and turn on the ART accelerator
+void flash_config(uint32_t hclk);
+
+#endif /* FLASH_H_ */
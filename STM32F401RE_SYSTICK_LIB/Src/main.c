@@ -18,6 +18,7 @@
 
 /* TESTS: */
 #define DELAY_TEST //un-comment this to test a 1000ms (1 second) delay over USART2
+//#define MILLIS_TEST //un-comment this to test the non-blocking timeout, prints millis() every second over USART2
 
 UART_CONFIG UART2;
 int main(void)
@@ -46,5 +47,29 @@ int main(void)
 			i++;//increment number of seconds
 		}
 	#endif
-}
 
+	#ifdef MILLIS_TEST
+		systick_init();
+
+		timeout_t second;
+		timeout_start(&second, 1000);
+
+		uint32_t loops = 0; //number of times the loop ran in the last second, shows the CPU isn't blocked
+		while(1)
+		{
+			loops++;
+
+			if(timeout_expired(&second))
+			{
+				char s[50];
+
+				//start the next second from the old deadline so it doesn't drift
+				second.DEADLINE += 1000;
+
+				sprintf(s, "%lu ms, %lu loops\n\r", (uint32_t)millis(), loops);
+				uart_write_string(UART2.USART, s);
+				loops = 0;
+			}
+		}
+	#endif
+}
@@ -13,41 +13,159 @@
  */
 #include "systick.h"
 #include "stm32f4xx.h"
+#include "rcc.h"
 
-#define SYSCLK_SPEED		16000000 //default sysclk speed
+//1ms = 0.001 seconds, so the number of clock cycles in 1ms is HCLK / 1000
+//(16000 at the default 16MHz, 84000 at 84MHz). The counter goes from
+//LOAD down to 0 inclusive, so LOAD is one less than that
+#define SYSTICK_RELOAD_VAL	((rcc_get_hclk() / SYSTICK_FREQ) - 1)
 
-//1ms = 0.001 seconds, 16MHz clk speed = 16M cycles/second
-//Number of clock cycles = 16MHz * 0.001 seconds = 16000 cycles/millisecond
-#define SYSTICK_RELOAD_VAL	(SYSCLK_SPEED*0.001)
+//number of milliseconds since systick_init(), only written by SysTick_Handler
+static volatile uint64_t systick_ticks = 0;
 
 /*
- * Function to create a delay in milliseconds
+ * Function to start SysTick as a free running 1ms interrupt
  *
  * Based on the System Timer (SysTick) in the
  * Cortex-M4 Core peripherals
  *
  * 4.4 in CortexM4 Generic User Guide
  */
-void systickDelayMS(int delay)
+void systick_init(void)
 {
 	//4.4.5 in CortexM4 Generic User Guide
 	//says to program reload value, clear current
 	//value, then program the control and status
 	//register
+	SysTick->CTRL = 0; //stop the counter while it is being changed
+
 	SysTick->LOAD = SYSTICK_RELOAD_VAL; //load number of clock pulses for 1ms
 
-	SysTick->VAL &= ~SysTick_VAL_CURRENT_Msk ; //clear current value register
+	SysTick->VAL = 0; //clear current value register
+
+	//processor (internal) clock, interrupt every time the counter
+	//reaches 0, and enable the counter
+	SysTick->CTRL = SysTick_CTRL_CLKSOURCE_Msk | SysTick_CTRL_TICKINT_Msk | SysTick_CTRL_ENABLE_Msk;
+}
+
+/*
+ * Function to return the number of milliseconds since systick_init()
+ *
+ * The count is 64 bits, which the CPU can't read in one go, so
+ * interrupts are held off while it is copied to stop SysTick_Handler
+ * from changing it half way through
+ */
+uint64_t millis(void)
+{
+	uint64_t ticks;
+	uint32_t primask = __get_PRIMASK();
+
+	__disable_irq();
+	ticks = systick_ticks;
+	__set_PRIMASK(primask);
+
+	return ticks;
+}
+
+/*
+ * Function to check if the given millis() value has been reached,
+ * 64 bits won't wrap around so a plain compare is enough
+ */
+int deadline_expired(uint64_t deadline)
+{
+	return (millis() >= deadline) ? 1 : 0;
+}
+
+/*
+ * Function to start a timeout, this doesn't block
+ */
+void timeout_start(timeout_t* timeout, uint32_t ms)
+{
+	timeout->DEADLINE = millis() + ms;
+}
+
+/*
+ * Function to check if a timeout has expired
+ */
+int timeout_expired(timeout_t* timeout)
+{
+	return deadline_expired(timeout->DEADLINE);
+}
+
+/*
+ * Function to return how many milliseconds are left, 0 once expired
+ */
+uint32_t timeout_remaining(timeout_t* timeout)
+{
+	uint64_t now = millis();
+
+	if(now >= timeout->DEADLINE)
+	{
+		return 0;
+	}
+
+	return (uint32_t)(timeout->DEADLINE - now);
+}
+
+/*
+ * Function to create a delay in milliseconds
+ *
+ * Kept for the code that already uses it, this now just waits on
+ * millis(). SysTick is started here if it isn't running yet. The wait
+ * is for one extra tick boundary, since the delay can start part way
+ * through a tick, so it is never shorter than asked for.
+ *
+ * millis() only moves in SysTick_Handler, so with interrupts masked
+ * (PRIMASK) or from inside an interrupt (IPSR != 0) it could stop and
+ * the wait would never end. In that case COUNTFLAG is polled instead,
+ * it is set every time the counter reaches 0 and cleared when CTRL is
+ * read (4.4.1 in CortexM4 Generic User Guide). millis() will be behind
+ * by the ticks missed while interrupts were held off.
+ */
+void systickDelayMS(int delay)
+{
+	uint64_t start;
+	uint32_t reloads;
+
+	if(delay <= 0)
+	{
+		return;
+	}
 
-	SysTick->CTRL |= SysTick_CTRL_CLKSOURCE_Msk; //set to processor (internal) clock
-	SysTick->CTRL |= SysTick_CTRL_ENABLE_Msk; //enable counter
+	if(!(SysTick->CTRL & SysTick_CTRL_TICKINT_Msk))
+	{
+		systick_init();
+	}
 
-	//start delay
-	for(int i = 0; i < delay; i++)
+	if(__get_PRIMASK() || __get_IPSR())
 	{
-		//since SysTick is a 24-bit down-counter, it should go to 0 once it's done counting,
-		//which causes the flag to be raised. wait until that happens.
-		while(!(SysTick->CTRL & SysTick_CTRL_COUNTFLAG_Msk));
+		reloads = 0;
+
+		(void)SysTick->CTRL; //read to clear a COUNTFLAG left from before
+
+		while(reloads <= (uint32_t)delay)
+		{
+			if(SysTick->CTRL & SysTick_CTRL_COUNTFLAG_Msk)
+			{
+				reloads++;
+			}
+		}
+
+		return;
 	}
 
-	SysTick->CTRL = 0; //clear control register once the delay is done to stop the counter
+	start = millis();
+
+	while(millis() - start <= (uint64_t)delay);
+}
+
+/*
+ * SysTick interrupt, happens every 1ms
+ *
+ * 4.4 in CortexM4 Generic User Guide, and the vector table in
+ * startup_stm32f401retx.s
+ */
+void SysTick_Handler(void)
+{
+	systick_ticks++;
 }
@@ -0,0 +1,113 @@
+/**
+ ******************************************************************************
+ * @file           : soft_timer.h
+ * @author         : Nubal Manhas
+ * @brief          : Header file for Software Timer library
+ ******************************************************************************
+ * @purpose
+ *
+ * The purpose of this file is to declare functions, enums, and structs, that
+ * will support the creation of a library for running any number of software
+ * timers off of one TIM2-5 compare interrupt on the STM32F01RE MCU
+ *
+ ******************************************************************************
+ */
+
+#ifndef SOFT_TIMER_H_
+#define SOFT_TIMER_H_
+#include "timer.h"
+#include <stdint.h>
+
+//each level of the wheel has 2^6 = 64 slots
+#define SOFT_TIMER_WHEEL_BITS		6
+#define SOFT_TIMER_WHEEL_SLOTS		(1U << SOFT_TIMER_WHEEL_BITS)
+#define SOFT_TIMER_WHEEL_MASK		(SOFT_TIMER_WHEEL_SLOTS - 1)
+
+//4 levels cover 2^24 ticks (4.6 hours at 1KHz), longer timers are
+//parked in the last level until they get close enough
+#define SOFT_TIMER_WHEEL_LEVELS		4
+
+//longest delay/period in ticks, so expiry times can be compared across wrapping
+#define SOFT_TIMER_MAX_TICKS		0x7FFFFFFF
+
+//frequency the hardware timer counts at, the compare interrupt is
+//moved forward by (this / tick frequency) counts every tick
+#define SOFT_TIMER_COUNT_FREQ		1000000
+
+/*
+ * One shot timers run once, periodic timers
+ * restart themselves every PERIOD ticks
+ */
+typedef enum
+{
+	SOFT_TIMER_ONE_SHOT,
+	SOFT_TIMER_PERIODIC
+}SOFT_TIMER_MODE;
+
+/*
+ * Where the callback is run from, straight from the timer
+ * interrupt, or later from soft_timer_run_deferred() in main
+ */
+typedef enum
+{
+	SOFT_TIMER_RUN_ISR,
+	SOFT_TIMER_RUN_DEFERRED
+}SOFT_TIMER_RUN;
+
+//callback for an expired timer, context is whatever was given to soft_timer_init()
+typedef void (*SOFT_TIMER_CALLBACK)(void* context);
+
+/*
+ * Struct for one software timer
+ *
+ * The memory for each timer is given by the caller and the wheel
+ * links the timers together through NEXT/PREV, so nothing is allocated
+ * and starting/stopping a timer is O(1). LIST is the wheel slot the
+ * timer is currently in, NULL when it isn't running.
+ *
+ * Only CALLBACK, CONTEXT, MODE and RUN should be set by the caller,
+ * using soft_timer_init().
+ */
+typedef struct SOFT_TIMER
+{
+	struct SOFT_TIMER* NEXT;
+	struct SOFT_TIMER* PREV;
+	struct SOFT_TIMER** LIST;
+	struct SOFT_TIMER* DEFERRED_NEXT;
+	uint32_t EXPIRES;
+	uint32_t PERIOD;
+	SOFT_TIMER_CALLBACK CALLBACK;
+	void* CONTEXT;
+	SOFT_TIMER_MODE MODE;
+	SOFT_TIMER_RUN RUN;
+	volatile int PENDING;
+}SOFT_TIMER;
+
+//function to set up a software timer, this doesn't start it
+void soft_timer_init(SOFT_TIMER* timer, SOFT_TIMER_MODE mode, SOFT_TIMER_RUN run, SOFT_TIMER_CALLBACK callback, void* context);
+
+//function to start (or restart) a timer to expire in the given number of ticks, returns -1 if ticks is too large
+int soft_timer_start(SOFT_TIMER* timer, uint32_t ticks);
+
+//function to stop a timer, a deferred callback that is already waiting is dropped as well
+void soft_timer_stop(SOFT_TIMER* timer);
+
+//function to check if a timer is running
+int soft_timer_active(SOFT_TIMER* timer);
+
+//function to return the number of ticks since the wheel started
+uint32_t soft_timer_now(void);
+
+//function to move the wheel forward one tick and expire any timers that are due, called from the timer interrupt
+void soft_timer_tick(void);
+
+//function to run the callbacks of expired SOFT_TIMER_RUN_DEFERRED timers, call this from the main loop
+void soft_timer_run_deferred(void);
+
+//function to drive the wheel from a compare channel on a TIM2-5 timer, returns -1 if it can't tick at the given frequency
+int soft_timer_hw_init(TIM_TypeDef* TMR, TIM2_5_CH channel, uint32_t tickFreq);
+
+//function to service the compare interrupt, call this from the TIMx_IRQHandler of the timer given to soft_timer_hw_init()
+void soft_timer_irq_handler(void);
+
+#endif /* SOFT_TIMER_H_ */
@@ -0,0 +1,45 @@
+/**
+ ******************************************************************************
+ * @file           : timestamp.h
+ * @author         : Nubal Manhas
+ * @brief          : Header file for Timestamp library
+ ******************************************************************************
+ * @purpose
+ *
+ * The purpose of this file is to declare functions, enums, and structs, that
+ * will support the creation of a library for a free running 64 bit timestamp
+ * on one of the 32 bit timers (TIM2/TIM5) of the STM32F01RE MCU
+ *
+ ******************************************************************************
+ */
+
+#ifndef TIMESTAMP_H_
+#define TIMESTAMP_H_
+#include "timer.h"
+#include <stdint.h>
+
+//default counting frequency, 1 tick = 1us
+#define TIMESTAMP_FREQ_1MHZ		1000000
+
+//function to start the timestamp on TIM2 or TIM5 counting at the given frequency, returns -1 if it can't
+int timestamp_init(TIM_TypeDef* TMR, uint32_t frequency);
+
+//function to return the frequency the timestamp counts at in Hz
+uint32_t timestamp_freq(void);
+
+//function to return the 64 bit timestamp in timer ticks, safe to call from interrupts
+uint64_t timestamp_ticks(void);
+
+//function to return the 64 bit timestamp in microseconds, safe to call from interrupts
+uint64_t timestamp_us(void);
+
+//function to extend a 32 bit capture/count value of the timestamp timer to a 64 bit timestamp in ticks
+uint64_t timestamp_extend(uint32_t count);
+
+//function to convert timestamp ticks to microseconds
+uint64_t timestamp_ticks_to_us(uint64_t ticks);
+
+//function to count overflows, call this from the TIMx_IRQHandler of the timer given to timestamp_init()
+void timestamp_irq_handler(void);
+
+#endif /* TIMESTAMP_H_ */
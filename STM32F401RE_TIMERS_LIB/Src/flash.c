@@ -0,0 +1,91 @@
+/**
+ ******************************************************************************
+ * @file           : flash.c
+ * @author         : Nubal Manhas
+ * @brief          : Main c file for Flash interface library
+ ******************************************************************************
+ * @purpose
+ *
+ * The purpose of this file is to define functions that will support
+ * configuring the flash interface for the STM32F01RE MCU
+ *
+ ******************************************************************************
+ */
+#include "flash.h"
+
+/*
+ * Function to set the flash wait states for the given HCLK
+ *
+ * Flash can't be read in one cycle above 30MHz, so the CPU has to
+ * wait a number of cycles on every read. When raising the clock this
+ * has to be called before the switch, and when lowering it after, so
+ * there are never too few wait states for the current clock.
+ *
+ * The new value is read back before returning, as 3.5.1 in Ref Manual
+ * asks for.
+ *
+ * Table 6/3.8.1 in Ref Manual
+ */
+void flash_set_latency(uint32_t hclk)
+{
+	uint32_t latency;
+
+	if(hclk <= FLASH_0WS_MAX_FREQ)
+	{
+		latency = FLASH_ACR_LATENCY_0WS;
+	}
+	else if(hclk <= FLASH_1WS_MAX_FREQ)
+	{
+		latency = FLASH_ACR_LATENCY_1WS;
+	}
+	else
+	{
+		latency = FLASH_ACR_LATENCY_2WS;
+	}
+
+	FLASH->ACR = (FLASH->ACR & ~FLASH_ACR_LATENCY) | latency;
+	while((FLASH->ACR & FLASH_ACR_LATENCY) != latency);
+}
+
+/*
+ * Function to turn on the ART accelerator
+ *
+ * The prefetch buffer reads the next instructions ahead of time, and the
+ * instruction (64 lines of 128 bits) and data (8 lines) caches keep recently
+ * used flash lines, so most reads don't have to wait on the wait states.
+ *
+ * The caches are reset first so nothing stale is left in them, which
+ * can only be done while they are turned off.
+ *
+ * 3.4.1/3.8.1 in Ref Manual
+ */
+void flash_art_enable(void)
+{
+	FLASH->ACR &= ~(FLASH_ACR_ICEN | FLASH_ACR_DCEN);
+
+	FLASH->ACR |= (FLASH_ACR_ICRST | FLASH_ACR_DCRST);
+	FLASH->ACR &= ~(FLASH_ACR_ICRST | FLASH_ACR_DCRST);
+
+	FLASH->ACR |= (FLASH_ACR_PRFTEN | FLASH_ACR_ICEN | FLASH_ACR_DCEN);
+}
+
+/*
+ * Function to turn off the ART accelerator, every flash read
+ * will take the full number of wait states
+ *
+ * 3.8.1 in Ref Manual
+ */
+void flash_art_disable(void)
+{
+	FLASH->ACR &= ~(FLASH_ACR_PRFTEN | FLASH_ACR_ICEN | FLASH_ACR_DCEN);
+}
+
+/*
+ * Function to set the wait states for the given HCLK and
+ * turn on the ART accelerator
+ */
+void flash_config(uint32_t hclk)
+{
+	flash_set_latency(hclk);
+	flash_art_enable();
+}
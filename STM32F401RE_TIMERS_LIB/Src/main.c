@@ -14,6 +14,9 @@
 #include "stm32f4xx.h"
 #include "uart.h"
 #include "timer.h"
+#include "soft_timer.h"
+#include "timestamp.h"
+#include "gpio.h"
 #include <stdio.h>
 #include <stdint.h>
 
@@ -24,6 +27,9 @@
 //#define OUTPUT_TEST //un-comment this to test output compare on PA5 (LED2 should toggle every second)
 //#define INPUT_TEST //un-comment this to test input capture, wire PA5 (output compare) to PA6 (input capture)
 #define PWM_TEST //un-comment this to test pwm mode on PA5
+//#define SOFT_TIMER_TEST //un-comment this to check the software timer wheel against a virtual clock (view results with live expressions)
+//#define SOFT_TIMER_HW_TEST //un-comment this to run software timers off of TIM5 CH1 (LED2 on PA5 blinks, a message is sent every second)
+//#define TIMESTAMP_TEST //un-comment this to test the 64 bit timestamp on TIM2 across counter overflows (a message is sent every second)
 
 UART_CONFIG UART2; //struct to configure UART2
 TIM2_5_CONFIG TMR2; //struct to configure TIM2 (this will be used for output compare as well)
@@ -32,6 +38,81 @@ TIM2_5_CAPTURE_COMPARE_CONFIG COMPARE_CAPTURE; //struct to configure input captu
 
 int timestamp = 0; //used to store input capture counter, global allows one to use live expressions in the debugger to view
 
+#ifdef SOFT_TIMER_TEST
+	#define SOFT_TIMER_TEST_COUNT 2000 //number of timers in the wheel at once
+	#define SOFT_TIMER_TEST_TICKS 20000000 //virtual ticks to run for, long enough for every level to cascade
+
+	SOFT_TIMER testTimers[SOFT_TIMER_TEST_COUNT];
+	uint32_t testDue[SOFT_TIMER_TEST_COUNT]; //tick each timer should fire on next
+
+	//globals so the results can be viewed with live expressions in the debugger
+	uint32_t softTimerFired = 0; //callbacks run
+	uint32_t softTimerErrors = 0; //callbacks run on the wrong tick, or for a stopped timer
+	uint32_t softTimerMissed = 0; //one shot timers that never fired
+	int softTimerDone = 0; //set once the test has finished
+
+	/*
+	 * Callback for every test timer, checks that it was run on
+	 * exactly the tick the timer was started for
+	 */
+	void soft_timer_test_callback(void* context)
+	{
+		int i = (int)(intptr_t)context;
+
+		softTimerFired++;
+
+		if(soft_timer_now() != testDue[i] || (i % 50) == 1)
+		{
+			softTimerErrors++;
+		}
+
+		testDue[i] += testTimers[i].PERIOD;
+	}
+#endif
+
+#ifdef TIMESTAMP_TEST
+	uint64_t timestampNow = 0; //latest timestamp in us
+	uint32_t timestampBackwards = 0; //times the timestamp went backwards, should stay 0
+	uint32_t timestampWraps = 0; //CNT overflows seen so far
+
+	//TIM2 global interrupt, counts the timestamp overflows
+	void TIM2_IRQHandler(void)
+	{
+		timestamp_irq_handler();
+	}
+#endif
+
+#ifdef SOFT_TIMER_HW_TEST
+	GPIOx_PIN_CONFIG LED; //LED2 on PA5
+	SOFT_TIMER BLINK_TIMER; //toggles LED2 from the interrupt
+	SOFT_TIMER PRINT_TIMER; //prints the tick count from main
+	SOFT_TIMER ONCE_TIMER; //one shot, stops the blinking after 10 seconds
+
+	void blink_callback(void* context)
+	{
+		gpio_toggle_output(GPIOA, LED);
+	}
+
+	void print_callback(void* context)
+	{
+		char s[50];
+
+		sprintf(s,"ticks: %lu\n\r", soft_timer_now());
+		uart_write_string(UART2.USART, s);
+	}
+
+	void once_callback(void* context)
+	{
+		soft_timer_stop(&BLINK_TIMER);
+	}
+
+	//TIM5 global interrupt, the wheel is driven off of CH1
+	void TIM5_IRQHandler(void)
+	{
+		soft_timer_irq_handler();
+	}
+#endif
+
 int main(void)
 {
 	//UART with PA3 as RX, PA2 as TX for USART2
@@ -181,5 +262,112 @@ int main(void)
 			uart_write_string(UART2.USART, s); //print to USART2
 		}
 	#endif
+
+	#ifdef SOFT_TIMER_TEST
+		//the hardware timer isn't started, soft_timer_tick() is called
+		//directly instead so the wheel runs off of a virtual clock
+		for(int i = 0; i < SOFT_TIMER_TEST_COUNT; i++)
+		{
+			//mix of short, medium and long (past the end of the wheel) delays
+			uint32_t ticks = (i % 10 == 0) ? (uint32_t)i * 9000 + 1 : (i % 3 == 0) ? (uint32_t)i * 97 : (uint32_t)i % 4000;
+
+			soft_timer_init(&testTimers[i], (i % 4 == 0) ? SOFT_TIMER_PERIODIC : SOFT_TIMER_ONE_SHOT, SOFT_TIMER_RUN_ISR, soft_timer_test_callback, (void*)(intptr_t)i);
+			soft_timer_start(&testTimers[i], ticks);
+
+			testDue[i] = soft_timer_now() + (ticks == 0 ? 1 : ticks);
+		}
+
+		//cancel some of them, these should never fire
+		for(int i = 1; i < SOFT_TIMER_TEST_COUNT; i += 50)
+		{
+			soft_timer_stop(&testTimers[i]);
+		}
+
+		for(uint32_t tick = 0; tick < SOFT_TIMER_TEST_TICKS; tick++)
+		{
+			soft_timer_tick();
+		}
+
+		for(int i = 0; i < SOFT_TIMER_TEST_COUNT; i++)
+		{
+			if(testTimers[i].MODE == SOFT_TIMER_ONE_SHOT && (i % 50) != 1 && soft_timer_active(&testTimers[i]))
+			{
+				softTimerMissed++;
+			}
+		}
+
+		softTimerDone = 1;
+
+		while(1)
+		{
+		}
+	#endif
+
+	#ifdef SOFT_TIMER_HW_TEST
+		//LED2 as an output
+		LED.PIN_MODE = GPIOx_PIN_OUTPUT;
+		LED.PIN_NUM = GPIOx_PIN_5;
+		LED.OTYPER_MODE = GPIOx_OTYPER_PUSH_PULL;
+		LED.PUPDR_MODE = GPIOx_PUPDR_NONE;
+		gpio_init(GPIOA, LED);
+
+		//blink from the interrupt, print from main
+		soft_timer_init(&BLINK_TIMER, SOFT_TIMER_PERIODIC, SOFT_TIMER_RUN_ISR, blink_callback, NULL);
+		soft_timer_init(&PRINT_TIMER, SOFT_TIMER_PERIODIC, SOFT_TIMER_RUN_DEFERRED, print_callback, NULL);
+		soft_timer_init(&ONCE_TIMER, SOFT_TIMER_ONE_SHOT, SOFT_TIMER_RUN_ISR, once_callback, NULL);
+
+		//1ms ticks
+		soft_timer_hw_init(TIM5, TIM2_5_CH1, 1000);
+
+		soft_timer_start(&BLINK_TIMER, 250);
+		soft_timer_start(&PRINT_TIMER, 1000);
+		soft_timer_start(&ONCE_TIMER, 10000);
+
+		while(1)
+		{
+			soft_timer_run_deferred();
+		}
+	#endif
+
+	#ifdef TIMESTAMP_TEST
+		uint64_t lastTimestamp = 0;
+		uint64_t nextPrint = 0;
+		uint32_t lastCount = 0;
+
+		//1us ticks
+		timestamp_init(TIM2, TIMESTAMP_FREQ_1MHZ);
+
+		//start CNT 3 seconds before it overflows, so the wrap happens
+		//during the test instead of after 71 minutes
+		TIM2->CNT = 0xFFFFFFFF - 3000000;
+
+		while(1)
+		{
+			timestampNow = timestamp_us();
+
+			if(timestampNow < lastTimestamp)
+			{
+				timestampBackwards++;
+			}
+
+			if(TIM2->CNT < lastCount)
+			{
+				timestampWraps++;
+			}
+
+			lastCount = TIM2->CNT;
+			lastTimestamp = timestampNow;
+
+			if(timestampNow >= nextPrint)
+			{
+				char s[80];
+
+				sprintf(s,"timestamp: %lu%09lu us, backwards: %lu\n\r", (uint32_t)(timestampNow / 1000000000), (uint32_t)(timestampNow % 1000000000), timestampBackwards);
+				uart_write_string(UART2.USART, s);
+
+				nextPrint += 1000000;
+			}
+		}
+	#endif
 }
 
@@ -0,0 +1,508 @@
+/**
+ ******************************************************************************
+ * @file           : soft_timer.c
+ * @author         : Nubal Manhas
+ * @brief          : Main c file for Software Timer library
+ ******************************************************************************
+ * @purpose
+ *
+ * The purpose of this file is to define functions that will support
+ * running any number of software timers off of one TIM2-5 compare
+ * interrupt on the STM32F01RE MCU
+ *
+ ******************************************************************************
+ */
+#include "soft_timer.h"
+#include <stddef.h>
+
+/*
+ * Hierarchical timer wheel
+ *
+ * Level 0 has a slot for each of the next 64 ticks, level 1 has a slot
+ * for each of the next 64 blocks of 64 ticks, and so on. A timer is put
+ * in the slot for its expiry time at the lowest level that can hold it,
+ * so starting a timer is just pushing it onto a list, no matter how many
+ * timers there are.
+ *
+ * Every tick the level 0 slot for the current tick is emptied and those
+ * timers are expired. Whenever level 0 wraps around, the next level 1 slot
+ * is emptied and its timers are put back in, which moves them down into
+ * level 0 (and the same for the levels above). Each timer is only moved
+ * down at most once per level, so ticking is O(1) on average as well.
+ */
+static SOFT_TIMER* wheel[SOFT_TIMER_WHEEL_LEVELS][SOFT_TIMER_WHEEL_SLOTS];
+
+//ticks since the wheel started, every timer at or before this has been expired
+static volatile uint32_t wheelTicks = 0;
+
+//expired SOFT_TIMER_RUN_DEFERRED timers, waiting for soft_timer_run_deferred()
+static SOFT_TIMER* deferredHead = NULL;
+static SOFT_TIMER* deferredTail = NULL;
+
+//hardware timer + channel driving the wheel, set by soft_timer_hw_init()
+static TIM_TypeDef* hwTimer = NULL;
+static TIM2_5_CH hwChannel = TIM2_5_CH1;
+static uint32_t hwStep = 0;
+
+void soft_timer_insert(SOFT_TIMER* timer);
+void soft_timer_unlink(SOFT_TIMER* timer);
+void soft_timer_cascade(int level);
+void soft_timer_expire(SOFT_TIMER* timer);
+
+/*
+ * Function to put a timer in the wheel slot for its expiry time
+ *
+ * The level is picked from how far away EXPIRES is, and the slot from the
+ * bits of EXPIRES for that level. Timers further away than the wheel covers
+ * are put in the furthest slot of the last level, they will just keep being
+ * put back in there until they are in range.
+ */
+void soft_timer_insert(SOFT_TIMER* timer)
+{
+	uint32_t expires = timer->EXPIRES;
+	int32_t delta = (int32_t)(expires - wheelTicks);
+	int level;
+	SOFT_TIMER** list;
+
+	//anything already due goes in the current slot, which gets
+	//emptied right after the cascade that put it there
+	if(delta < 0)
+	{
+		delta = 0;
+		expires = wheelTicks;
+	}
+
+	for(level = 0; level < SOFT_TIMER_WHEEL_LEVELS - 1; level++)
+	{
+		if((uint32_t)delta < (1U << (SOFT_TIMER_WHEEL_BITS * (level + 1))))
+		{
+			break;
+		}
+	}
+
+	if((uint32_t)delta >= (1U << (SOFT_TIMER_WHEEL_BITS * SOFT_TIMER_WHEEL_LEVELS)))
+	{
+		expires = wheelTicks + (1U << (SOFT_TIMER_WHEEL_BITS * SOFT_TIMER_WHEEL_LEVELS)) - 1;
+	}
+
+	list = &wheel[level][(expires >> (SOFT_TIMER_WHEEL_BITS * level)) & SOFT_TIMER_WHEEL_MASK];
+
+	//push onto the front of the slot
+	timer->PREV = NULL;
+	timer->NEXT = *list;
+
+	if(*list != NULL)
+	{
+		(*list)->PREV = timer;
+	}
+
+	*list = timer;
+	timer->LIST = list;
+}
+
+/*
+ * Function to take a timer out of whatever slot it is in
+ */
+void soft_timer_unlink(SOFT_TIMER* timer)
+{
+	if(timer->LIST == NULL)
+	{
+		return;
+	}
+
+	if(timer->PREV != NULL)
+	{
+		timer->PREV->NEXT = timer->NEXT;
+	}
+	else
+	{
+		*timer->LIST = timer->NEXT;
+	}
+
+	if(timer->NEXT != NULL)
+	{
+		timer->NEXT->PREV = timer->PREV;
+	}
+
+	timer->NEXT = NULL;
+	timer->PREV = NULL;
+	timer->LIST = NULL;
+}
+
+/*
+ * Function to empty the current slot of a level, and put each of
+ * its timers back into the wheel, which moves them down a level
+ */
+void soft_timer_cascade(int level)
+{
+	SOFT_TIMER** list = &wheel[level][(wheelTicks >> (SOFT_TIMER_WHEEL_BITS * level)) & SOFT_TIMER_WHEEL_MASK];
+	SOFT_TIMER* timer;
+
+	while(*list != NULL)
+	{
+		timer = *list;
+		soft_timer_unlink(timer);
+		soft_timer_insert(timer);
+	}
+}
+
+/*
+ * Function to handle a timer that has reached its expiry time
+ *
+ * Periodic timers are put back in the wheel before the callback is
+ * run, so the callback is free to stop or restart its own timer.
+ * Deferred timers are added to the back of the deferred list, if one
+ * is already waiting there it isn't added twice.
+ */
+void soft_timer_expire(SOFT_TIMER* timer)
+{
+	if(timer->MODE == SOFT_TIMER_PERIODIC)
+	{
+		timer->EXPIRES += timer->PERIOD;
+		soft_timer_insert(timer);
+	}
+
+	if(timer->RUN == SOFT_TIMER_RUN_DEFERRED)
+	{
+		if(!timer->PENDING)
+		{
+			timer->PENDING = 1;
+			timer->DEFERRED_NEXT = NULL;
+
+			if(deferredTail != NULL)
+			{
+				deferredTail->DEFERRED_NEXT = timer;
+			}
+			else
+			{
+				deferredHead = timer;
+			}
+
+			deferredTail = timer;
+		}
+	}
+	else if(timer->CALLBACK != NULL)
+	{
+		timer->CALLBACK(timer->CONTEXT);
+	}
+}
+
+/*
+ * Function to set up a software timer, this only fills in the
+ * struct, the timer isn't running until soft_timer_start()
+ */
+void soft_timer_init(SOFT_TIMER* timer, SOFT_TIMER_MODE mode, SOFT_TIMER_RUN run, SOFT_TIMER_CALLBACK callback, void* context)
+{
+	timer->NEXT = NULL;
+	timer->PREV = NULL;
+	timer->LIST = NULL;
+	timer->DEFERRED_NEXT = NULL;
+	timer->EXPIRES = 0;
+	timer->PERIOD = 0;
+	timer->CALLBACK = callback;
+	timer->CONTEXT = context;
+	timer->MODE = mode;
+	timer->RUN = run;
+	timer->PENDING = 0;
+}
+
+/*
+ * Function to start a timer to expire in the given number of ticks,
+ * for periodic timers this is also the period. If the timer is already
+ * running it is restarted.
+ *
+ * 0 ticks is treated as 1, so the timer expires on the next tick and
+ * never in the middle of the tick that is being handled.
+ *
+ * This can be called from main or from a timer callback
+ */
+int soft_timer_start(SOFT_TIMER* timer, uint32_t ticks)
+{
+	uint32_t primask;
+
+	if(ticks > SOFT_TIMER_MAX_TICKS)
+	{
+		return -1;
+	}
+
+	if(ticks == 0)
+	{
+		ticks = 1;
+	}
+
+	primask = __get_PRIMASK();
+	__disable_irq();
+
+	soft_timer_unlink(timer);
+
+	timer->PERIOD = ticks;
+	timer->EXPIRES = wheelTicks + ticks;
+	soft_timer_insert(timer);
+
+	__set_PRIMASK(primask);
+
+	return 0;
+}
+
+/*
+ * Function to stop a timer
+ *
+ * If a deferred callback is waiting for this timer it is dropped,
+ * so nothing is run for a timer after it has been stopped
+ */
+void soft_timer_stop(SOFT_TIMER* timer)
+{
+	uint32_t primask = __get_PRIMASK();
+	SOFT_TIMER* prev = NULL;
+	SOFT_TIMER* next;
+
+	__disable_irq();
+
+	soft_timer_unlink(timer);
+
+	if(timer->PENDING)
+	{
+		//the deferred list is only walked when a waiting timer
+		//is stopped, so it is normally never searched
+		next = deferredHead;
+
+		while(next != NULL && next != timer)
+		{
+			prev = next;
+			next = next->DEFERRED_NEXT;
+		}
+
+		if(next != NULL)
+		{
+			if(prev != NULL)
+			{
+				prev->DEFERRED_NEXT = timer->DEFERRED_NEXT;
+			}
+			else
+			{
+				deferredHead = timer->DEFERRED_NEXT;
+			}
+
+			if(deferredTail == timer)
+			{
+				deferredTail = prev;
+			}
+		}
+
+		timer->DEFERRED_NEXT = NULL;
+		timer->PENDING = 0;
+	}
+
+	__set_PRIMASK(primask);
+}
+
+/*
+ * Function to check if a timer is in the wheel
+ */
+int soft_timer_active(SOFT_TIMER* timer)
+{
+	return timer->LIST != NULL;
+}
+
+/*
+ * Function to return the number of ticks since the wheel started,
+ * this wraps around after 2^32 ticks
+ */
+uint32_t soft_timer_now(void)
+{
+	return wheelTicks;
+}
+
+/*
+ * Function to move the wheel forward one tick
+ *
+ * Normally this is called by soft_timer_irq_handler(), but it doesn't
+ * touch any hardware, so it can also be called directly to run the wheel
+ * off of a virtual clock (for testing, or from some other interrupt).
+ *
+ * The higher levels are cascaded down first, then the level 0 slot for
+ * this tick is emptied. ISR timers have their callbacks run here.
+ */
+void soft_timer_tick(void)
+{
+	SOFT_TIMER** list;
+	SOFT_TIMER* timer;
+	int level;
+
+	wheelTicks++;
+
+	//cascade each level whose slot just changed,
+	//which is every time the level below wraps to 0
+	for(level = 1; level < SOFT_TIMER_WHEEL_LEVELS; level++)
+	{
+		if((wheelTicks & ((1U << (SOFT_TIMER_WHEEL_BITS * level)) - 1)) != 0)
+		{
+			break;
+		}
+
+		soft_timer_cascade(level);
+	}
+
+	list = &wheel[0][wheelTicks & SOFT_TIMER_WHEEL_MASK];
+
+	//timers are taken off one at a time, since a callback
+	//can stop any other timer in this slot
+	while(*list != NULL)
+	{
+		timer = *list;
+		soft_timer_unlink(timer);
+
+		//timers too far away for the wheel can land here early
+		if((int32_t)(timer->EXPIRES - wheelTicks) > 0)
+		{
+			soft_timer_insert(timer);
+			continue;
+		}
+
+		soft_timer_expire(timer);
+	}
+}
+
+/*
+ * Function to run the callbacks of expired SOFT_TIMER_RUN_DEFERRED
+ * timers, in the order they expired
+ *
+ * Interrupts are only disabled long enough to take each timer off of
+ * the list, the callbacks themselves run with interrupts on
+ */
+void soft_timer_run_deferred(void)
+{
+	uint32_t primask;
+	SOFT_TIMER* timer;
+
+	while(1)
+	{
+		primask = __get_PRIMASK();
+		__disable_irq();
+
+		timer = deferredHead;
+
+		if(timer != NULL)
+		{
+			deferredHead = timer->DEFERRED_NEXT;
+
+			if(deferredHead == NULL)
+			{
+				deferredTail = NULL;
+			}
+
+			timer->DEFERRED_NEXT = NULL;
+			timer->PENDING = 0;
+		}
+
+		__set_PRIMASK(primask);
+
+		if(timer == NULL)
+		{
+			return;
+		}
+
+		if(timer->CALLBACK != NULL)
+		{
+			timer->CALLBACK(timer->CONTEXT);
+		}
+	}
+}
+
+/*
+ * Function to drive the wheel from one compare channel of a TIM2-5 timer
+ *
+ * The timer free runs at SOFT_TIMER_COUNT_FREQ over its full range, and
+ * the channel's compare register is moved forward by one tick's worth of
+ * counts every interrupt. Nothing else about the timer is tied to the wheel,
+ * so the other channels can still be used for compares/captures, as long as
+ * they work with the same prescaler and a free running counter.
+ *
+ * The channel is left in frozen output compare mode, it only sets CCxIF and
+ * doesn't drive a pin.
+ *
+ * Returns -1 if the timer can't count at SOFT_TIMER_COUNT_FREQ, or the
+ * tick frequency doesn't divide into it
+ *
+ * 13.3.8/13.4.7 in Ref Manual
+ */
+int soft_timer_hw_init(TIM_TypeDef* TMR, TIM2_5_CH channel, uint32_t tickFreq)
+{
+	TIM2_5_CONFIG timer;
+	volatile uint32_t* ccr;
+
+	timer.TMR = TMR;
+	timer.COUNTER_MODE = TIM2_5_UP;
+	timer.PRESCALER = tim2_5_prescaler(timer, SOFT_TIMER_COUNT_FREQ);
+
+	//a PERIOD of 0 puts all 1's into ARR, so the counter runs over
+	//its full 16 (TIM3/4) or 32 (TIM2/5) bits and the compare value
+	//can just be added to and left to wrap with it
+	timer.PERIOD = 0;
+
+	if(timer.PRESCALER < 0 || tickFreq == 0 || tickFreq > SOFT_TIMER_COUNT_FREQ)
+	{
+		return -1;
+	}
+
+	hwTimer = TMR;
+	hwChannel = channel;
+	hwStep = SOFT_TIMER_COUNT_FREQ / tickFreq;
+
+	tim2_5_init(timer);
+
+	//PSC is only loaded on an update event, and with the full range
+	//ARR the first one could be minutes away, so generate one now
+	//13.3.1 in Ref Manual
+	tim2_5_generate_event(timer);
+
+	//frozen output compare, CCxS = 00 and OCxM = 000
+	//13.4.7/13.4.8 in Ref Manual
+	if(channel == TIM2_5_CH1 || channel == TIM2_5_CH2)
+	{
+		TMR->CCMR1 &= ~(0xFFU << (8 * channel));
+	}
+	else
+	{
+		TMR->CCMR2 &= ~(0xFFU << (8 * (channel - TIM2_5_CH3)));
+	}
+
+	//CCR1-4 are next to each other
+	ccr = &TMR->CCR1 + channel;
+	*ccr = hwStep;
+
+	tim2_5_clear_interrupt_flag(timer, (TIM2_5_INTERRUPT_EN)(TIM2_5_CC1_INTERRUPT + channel));
+	tim2_5_interrupt_enable(timer, (TIM2_5_INTERRUPT_EN)(TIM2_5_CC1_INTERRUPT + channel));
+	tim2_5_enable(timer);
+
+	return 0;
+}
+
+/*
+ * Function to service the compare interrupt set up by soft_timer_hw_init()
+ *
+ * The next compare is scheduled from the last one instead of from CNT,
+ * so the ticks don't drift no matter how long the callbacks take
+ */
+void soft_timer_irq_handler(void)
+{
+	uint32_t flag;
+	volatile uint32_t* ccr;
+
+	if(hwTimer == NULL)
+	{
+		return;
+	}
+
+	flag = 1U << (TIM2_5_CC1_INTERRUPT + hwChannel);
+
+	if(hwTimer->SR & flag)
+	{
+		hwTimer->SR = ~flag;
+
+		ccr = &hwTimer->CCR1 + hwChannel;
+		*ccr += hwStep;
+
+		soft_timer_tick();
+	}
+}
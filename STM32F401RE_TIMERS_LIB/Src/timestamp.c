@@ -0,0 +1,202 @@
+/**
+ ******************************************************************************
+ * @file           : timestamp.c
+ * @author         : Nubal Manhas
+ * @brief          : Main c file for Timestamp library
+ ******************************************************************************
+ * @purpose
+ *
+ * The purpose of this file is to define functions that will support
+ * a free running 64 bit timestamp on one of the 32 bit timers (TIM2/TIM5)
+ * of the STM32F01RE MCU
+ *
+ ******************************************************************************
+ */
+#include "timestamp.h"
+#include <stddef.h>
+
+//timer the timestamp runs on, set by timestamp_init()
+static TIM_TypeDef* timestampTimer = NULL;
+
+//upper 32 bits of the timestamp, counted by the update interrupt
+static volatile uint32_t timestampOverflows = 0;
+
+static uint32_t timestampFreq = 0;
+static uint32_t timestampTicksPerUs = 0;
+
+/*
+ * Function to start the timestamp
+ *
+ * The timer free runs over its full 32 bits at the given frequency,
+ * TIMESTAMP_FREQ_1MHZ for 1us ticks, or tim2_5_get_clk() to count at
+ * the timer clock. The frequency has to be a whole number of MHz and
+ * divide evenly into the timer clock, so ticks convert to microseconds
+ * exactly.
+ *
+ * Only TIM2 and TIM5 have 32 bit counters (13.1 in Ref Manual), on TIM3/4
+ * the timestamp would overflow every 65ms at 1MHz, so they aren't allowed.
+ *
+ * Returns -1 if the timer or frequency can't be used
+ */
+int timestamp_init(TIM_TypeDef* TMR, uint32_t frequency)
+{
+	TIM2_5_CONFIG timer;
+	uint32_t clk;
+
+	if(TMR != TIM2 && TMR != TIM5)
+	{
+		return -1;
+	}
+
+	timer.TMR = TMR;
+	timer.COUNTER_MODE = TIM2_5_UP;
+
+	clk = tim2_5_get_clk(timer);
+
+	if(frequency == 0 || (frequency % TIMESTAMP_FREQ_1MHZ) != 0 || (clk % frequency) != 0)
+	{
+		return -1;
+	}
+
+	timer.PRESCALER = tim2_5_prescaler(timer, frequency);
+
+	//a PERIOD of 0 puts 0xFFFFFFFF into ARR, so the
+	//counter overflows after the full 32 bits
+	timer.PERIOD = 0;
+
+	if(timer.PRESCALER < 0)
+	{
+		return -1;
+	}
+
+	timestampTimer = TMR;
+	timestampOverflows = 0;
+	timestampFreq = frequency;
+	timestampTicksPerUs = frequency / TIMESTAMP_FREQ_1MHZ;
+
+	tim2_5_init(timer);
+
+	//PSC is only loaded on an update event, so generate one
+	//now then clear the flag it sets so it isn't counted
+	//13.3.1 in Ref Manual
+	tim2_5_generate_event(timer);
+	tim2_5_clear_interrupt_flag(timer, TIM2_5_UPDATE_INTERRUPT);
+
+	tim2_5_interrupt_enable(timer, TIM2_5_UPDATE_INTERRUPT);
+	tim2_5_enable(timer);
+
+	return 0;
+}
+
+/*
+ * Function to return the frequency the timestamp counts at in Hz
+ */
+uint32_t timestamp_freq(void)
+{
+	return timestampFreq;
+}
+
+/*
+ * Function to return the 64 bit timestamp in ticks
+ *
+ * The overflow count and CNT are read with interrupts off, so the update
+ * interrupt can't run in the middle. If the counter has wrapped but the
+ * update interrupt hasn't counted it yet (UIF is still set, because this
+ * is being called from an interrupt of the same or higher priority, or
+ * it wrapped just now), the overflow is added here and CNT is read again,
+ * since the first read could have been from just before the wrap.
+ *
+ * 13.4.5 in Ref Manual for UIF
+ */
+uint64_t timestamp_ticks(void)
+{
+	uint32_t primask;
+	uint32_t high;
+	uint32_t low;
+
+	if(timestampTimer == NULL)
+	{
+		return 0;
+	}
+
+	primask = __get_PRIMASK();
+	__disable_irq();
+
+	high = timestampOverflows;
+	low = timestampTimer->CNT;
+
+	if(timestampTimer->SR & TIM_SR_UIF)
+	{
+		low = timestampTimer->CNT;
+		high++;
+	}
+
+	__set_PRIMASK(primask);
+
+	return ((uint64_t)high << 32) | low;
+}
+
+/*
+ * Function to return the 64 bit timestamp in microseconds
+ */
+uint64_t timestamp_us(void)
+{
+	return timestamp_ticks_to_us(timestamp_ticks());
+}
+
+/*
+ * Function to turn a 32 bit value taken from the timestamp timer
+ * (CNT, or a CCRx input capture) into a full 64 bit timestamp
+ *
+ * The value has to be from less than one overflow ago (71 minutes
+ * at 1MHz), the upper bits are worked out from how far behind
+ * the current timestamp it is
+ */
+uint64_t timestamp_extend(uint32_t count)
+{
+	uint64_t now = timestamp_ticks();
+
+	return now - (uint32_t)((uint32_t)now - count);
+}
+
+/*
+ * Function to convert timestamp ticks to microseconds, at 1MHz
+ * this is a no-op, otherwise the ticks are divided down
+ */
+uint64_t timestamp_ticks_to_us(uint64_t ticks)
+{
+	if(timestampTicksPerUs <= 1)
+	{
+		return ticks;
+	}
+
+	return ticks / timestampTicksPerUs;
+}
+
+/*
+ * Function to count overflows of the timestamp timer
+ *
+ * The count and flag are changed together with interrupts off, so
+ * timestamp_ticks() from a higher priority interrupt never sees the
+ * overflow counted twice or not at all
+ */
+void timestamp_irq_handler(void)
+{
+	uint32_t primask;
+
+	if(timestampTimer == NULL)
+	{
+		return;
+	}
+
+	primask = __get_PRIMASK();
+	__disable_irq();
+
+	if(timestampTimer->SR & TIM_SR_UIF)
+	{
+		timestampTimer->SR = ~TIM_SR_UIF;
+		timestampOverflows++;
+	}
+
+	__set_PRIMASK(primask);
+}
@@ -18,6 +18,106 @@
 /* TESTS: */
 //#define WRITE_TEST //un-comment this to test writing over USART2
 //#define READ_TEST //un-comment this to test reading over USART2, PA5 should go high in response to '1'
+//#define WRITE_IT_TEST //un-comment this to test interrupt driven writing over USART2, PA5 should blink while it sends
+//#define WRITE_DMA_TEST //un-comment this to test DMA writing over USART2, PA5 should blink while it sends
+//#define READ_DMA_TEST //un-comment this to test circular DMA reading over USART2, everything received is echoed back
+//#define RING_TEST //un-comment this to check the transmit ring buffer and its interrupt handler against a USART in RAM (view results with live expressions)
+//#define BAUD_TEST //un-comment this to check the baudrate calculation against known values (view results with live expressions) and print a sweep over the standard baudrates over USART2
+
+#ifdef WRITE_DMA_TEST
+	volatile int dmaDone = 0; //number of finished DMA transmits, view with live expressions in the debugger
+
+	//callback for a finished DMA transmit
+	static void uart2_dma_callback(USART_TypeDef* USART)
+	{
+		dmaDone++;
+	}
+#endif
+
+#ifdef READ_DMA_TEST
+	uint8_t rxBuffer[64]; //circular DMA receive buffer
+	UART_RX_STATS rxStats; //BYTES should match what was sent and OVERRUNS should stay 0, view with live expressions in the debugger
+
+	//callback for received chunks, echoes them back through the transmit ring buffer
+	static void uart2_rx_callback(USART_TypeDef* USART, const uint8_t* data, size_t length)
+	{
+		uart_write_it(USART, data, length);
+	}
+#endif
+
+#ifdef RING_TEST
+	USART_TypeDef fakeUsart; //stands in for the USART registers, so every byte written to DR can be checked
+	UART_TX_RING fakeRing; //ring buffer that only fakeUsart drains
+	volatile uint32_t ringSent = 0; //bytes taken out through uart_tx_ring_irq()
+	volatile uint32_t ringErrors = 0; //bytes out of order, the buffer taking more/less than it should, or the interrupts left wrong
+	uint32_t ringPushed = 0; //bytes accepted so far, the pattern carries on from here
+
+	//queues length bytes of a pattern that doesn't line up with the buffer size, expected is how many should fit
+	void ring_push(size_t length, size_t expected)
+	{
+		uint8_t data[UART_TX_BUFFER_SIZE + 64];
+		size_t accepted;
+
+		for(size_t i = 0; i < length; i++)
+		{
+			data[i] = (uint8_t)((ringPushed + i) % 251);
+		}
+
+		accepted = uart_tx_ring_push(&fakeRing, data, length);
+
+		if(accepted != expected)
+		{
+			ringErrors++;
+		}
+
+		ringPushed += accepted;
+	}
+
+	//runs the interrupt handler count times with TXE set, each one should write the next byte to DR
+	void ring_drain(uint32_t count)
+	{
+		for(uint32_t i = 0; i < count; i++)
+		{
+			fakeUsart.DR = 0xFFFF; //not a byte, so a missed write shows up
+
+			uart_tx_ring_irq(&fakeUsart, &fakeRing);
+
+			if(fakeUsart.DR != (ringSent % 251))
+			{
+				ringErrors++;
+			}
+
+			ringSent++;
+		}
+	}
+#endif
+
+#ifdef BAUD_TEST
+	volatile uint32_t baudChecked = 0; //number of clock/baudrate pairs checked against known values
+	volatile uint32_t baudErrors = 0; //number that gave the wrong BRR/OVER8, or were wrongly accepted/rejected
+
+	//checks uart_baud_solve() against BRR/OVER8 worked out by hand from
+	//USARTDIV = pclk / (8 * (2 - OVER8) * baud), 19.3.4 in Ref Manual,
+	//brr = 0 for a baudrate that can't be made from pclk
+	void check_baud(uint32_t pclk, uint32_t baudrate, uint32_t brr, int over8)
+	{
+		UART_BAUD result;
+		int works = (uart_baud_solve(pclk, baudrate, &result) == 0);
+
+		baudChecked++;
+
+		if(works != (brr != 0))
+		{
+			baudErrors++;
+			return;
+		}
+
+		if(works && (result.BRR != brr || result.OVER8 != over8))
+		{
+			baudErrors++;
+		}
+	}
+#endif
 
 UART_CONFIG UART2;
 int main(void)
@@ -58,5 +158,173 @@ int main(void)
 			}
 		}
 	#endif
+
+	#ifdef WRITE_IT_TEST
+		//configuring PA5 as output (LED2 on the DEV board)
+		GPIOx_PIN_CONFIG LED2;
+		LED2.PIN_MODE = GPIOx_PIN_OUTPUT;
+		LED2.PIN_NUM = GPIOx_PIN_5;
+		LED2.OTYPER_MODE = GPIOx_OTYPER_PUSH_PULL;
+		LED2.PUPDR_MODE = GPIOx_PUPDR_NONE;
+
+		gpio_init(GPIOA,LED2);
+
+		int sent = 0; //total bytes accepted, view with live expressions in the debugger
+		int dropped = 0; //total bytes that didn't fit in the ring buffer
+
+		while(1)
+		{
+			char s[50];
+			int length = sprintf(s, "HELLO %i\n\r", sent);
+
+			//only queue a message when all of it fits, then the CPU is free to
+			//keep toggling the LED while the interrupt sends it
+			if(uart_tx_free(UART2.USART) >= length)
+			{
+				int accepted = uart_write_it(UART2.USART, (uint8_t*)s, length);
+				sent += accepted;
+				dropped += length - accepted;
+			}
+
+			gpio_toggle_output(GPIOA, LED2);
+			for(int i = 0; i < 100000; i++){}
+		}
+	#endif
+
+	#ifdef WRITE_DMA_TEST
+		//configuring PA5 as output (LED2 on the DEV board)
+		GPIOx_PIN_CONFIG LED2;
+		LED2.PIN_MODE = GPIOx_PIN_OUTPUT;
+		LED2.PIN_NUM = GPIOx_PIN_5;
+		LED2.OTYPER_MODE = GPIOx_OTYPER_PUSH_PULL;
+		LED2.PUPDR_MODE = GPIOx_PUPDR_NONE;
+
+		gpio_init(GPIOA,LED2);
+
+		//two buffers, so one can be filled while DMA sends the other
+		char s[2][50];
+		int current = 0;
+		int rejected = 0; //number of times the DMA was still busy
+
+		while(1)
+		{
+			int length = sprintf(s[current], "HELLO %i\n\r", dmaDone);
+
+			if(uart_write_dma(UART2.USART, (uint8_t*)s[current], length, uart2_dma_callback) == 0)
+			{
+				current ^= 1;
+			}
+			else
+			{
+				rejected++;
+			}
+
+			gpio_toggle_output(GPIOA, LED2);
+			for(int i = 0; i < 100000; i++){}
+		}
+	#endif
+
+	#ifdef READ_DMA_TEST
+		uart_read_dma_start(UART2.USART, rxBuffer, sizeof(rxBuffer), uart2_rx_callback);
+
+		while(1)
+		{
+			//main can be kept busy here without losing anything,
+			//the DMA keeps receiving in the background
+			for(int i = 0; i < 1000000; i++){}
+
+			rxStats = uart_rx_stats(UART2.USART);
+		}
+	#endif
+
+	#ifdef RING_TEST
+		//TC stays clear while there are frames going out
+		fakeUsart.SR = USART_SR_TXE;
+		fakeUsart.CR1 = USART_CR1_TXEIE;
+
+		//start short of where HEAD/TAIL wrap around 32 bits, so both the
+		//index into DATA and the free running counters wrap during the test
+		fakeRing.HEAD = 0xFFFFFF80;
+		fakeRing.TAIL = 0xFFFFFF80;
+
+		ring_push(300, UART_TX_BUFFER_SIZE); //only a full buffer fits, the rest is dropped
+		ring_push(1, 0);
+		ring_drain(100);
+		ring_push(150, 100); //only the space that was drained
+		ring_drain(UART_TX_BUFFER_SIZE);
+
+		//once empty TXE turns TXEIE off and TCIE on, then TC turns TCIE off
+		uart_tx_ring_irq(&fakeUsart, &fakeRing);
+
+		if((fakeUsart.CR1 & USART_CR1_TXEIE) || !(fakeUsart.CR1 & USART_CR1_TCIE))
+		{
+			ringErrors++;
+		}
+
+		//the last frame has left the shift register
+		fakeUsart.SR |= USART_SR_TC;
+		uart_tx_ring_irq(&fakeUsart, &fakeRing);
+
+		if((fakeUsart.CR1 & (USART_CR1_TXEIE | USART_CR1_TCIE)) || ringSent != ringPushed)
+		{
+			ringErrors++;
+		}
+
+		//expect ringSent = 356, ringErrors = 0
+		while(1);
+	#endif
+
+	#ifdef BAUD_TEST
+		check_baud(16000000, 115200, 0x08B, 0); //USARTDIV 8.6875
+		check_baud(16000000, 9600, 0x683, 0); //USARTDIV 104.1875
+		check_baud(16000000, 1200, 0x3415, 0); //USARTDIV 833.3125
+		check_baud(16000000, 921600, 0x011, 0); //USARTDIV 1.0625, still reachable with 16 times oversampling
+		check_baud(16000000, 1500000, 0x013, 1); //USARTDIV 1.375, only reachable with 8 times oversampling
+		check_baud(16000000, 2000000, 0x010, 1); //USARTDIV 1.0, the fastest 8 times oversampling can go
+		check_baud(16000000, 4000000, 0, 0); //above pclk / 8
+		check_baud(42000000, 2400, 0x445C, 0); //USARTDIV 1093.75
+		check_baud(84000000, 2400, 0x88B8, 0); //USARTDIV 2187.5
+		check_baud(84000000, 921600, 0x05B, 0); //USARTDIV 5.6875
+		check_baud(84000000, 1200, 0, 0); //USARTDIV 4375, the mantissa is only 12 bits
+
+		//expect baudChecked = 11, baudErrors = 0
+
+		//APB clocks to check against: reset (16MHz), and APB1/APB2 with SYSCLK at 84MHz
+		const uint32_t clocks[] = {16000000, 42000000, 84000000};
+		const uint32_t baudrates[] = {1200, 2400, 4800, 9600, 19200, 38400, 57600, 115200, 230400, 460800, 921600};
+
+		int unreachable = 0; //number of baudrates that couldn't be made, view with live expressions in the debugger
+		int32_t worstPPM = 0; //largest error out of the ones that could be made
+
+		for(int i = 0; i < sizeof(clocks)/sizeof(clocks[0]); i++)
+		{
+			for(int j = 0; j < sizeof(baudrates)/sizeof(baudrates[0]); j++)
+			{
+				UART_BAUD result;
+				char s[80];
+
+				if(uart_baud_solve(clocks[i], baudrates[j], &result) == 0)
+				{
+					int32_t error = (result.ERROR_PPM < 0) ? -result.ERROR_PPM : result.ERROR_PPM;
+					if(error > worstPPM)
+					{
+						worstPPM = error;
+					}
+
+					sprintf(s, "%lu Hz %lu baud: BRR=0x%03lX OVER8=%i actual=%lu error=%li ppm\n\r",
+							clocks[i], baudrates[j], result.BRR, result.OVER8, result.BAUDRATE, result.ERROR_PPM);
+				}
+				else
+				{
+					unreachable++;
+					sprintf(s, "%lu Hz %lu baud: can't be reached\n\r", clocks[i], baudrates[j]);
+				}
+
+				uart_write_string(UART2.USART, s);
+			}
+		}
+
+		while(1){}
+	#endif
 }
 
@@ -15,8 +15,40 @@
 
 #ifndef SYSTICK_H_
 #define SYSTICK_H_
+#include <stdint.h>
 
-//function for a generic 1ms delay
+//SysTick interrupt frequency in Hz, 1 tick = 1ms
+#define SYSTICK_FREQ		1000
+
+/*
+ * Struct for a non-blocking timeout, DEADLINE is
+ * the millis() value at which it expires
+ */
+typedef struct
+{
+	uint64_t DEADLINE;
+}timeout_t;
+
+//function to start the 1ms SysTick interrupt, call again after the clock speed changes
+void systick_init(void);
+
+//function to return the number of milliseconds since systick_init()
+uint64_t millis(void);
+
+//function to check if the given millis() value has been reached
+int deadline_expired(uint64_t deadline);
+
+//function to start a timeout that expires in the given number of milliseconds
+void timeout_start(timeout_t* timeout, uint32_t ms);
+
+//function to check if a timeout has expired
+int timeout_expired(timeout_t* timeout);
+
+//function to return the number of milliseconds left before a timeout expires
+uint32_t timeout_remaining(timeout_t* timeout);
+
+//function for a generic 1ms delay, polls SysTick itself when called
+//with interrupts disabled or from an interrupt, millis() falls behind then
 void systickDelayMS(int delay);
 
 
@@ -177,6 +177,12 @@ void tim2_5_init(TIM2_5_CONFIG timer);
 //function to enable a given timer
 void tim2_5_init_enable(TIM2_5_CONFIG timer);
 
+//function to return the clock the given timer counts from in Hz, 0 if it isn't one of TIM2-5
+uint32_t tim2_5_get_clk(TIM2_5_CONFIG timer);
+
+//function to return the PRESCALER needed for the timer to count at the given frequency, -1 if it can't
+int tim2_5_prescaler(TIM2_5_CONFIG timer, uint32_t frequency);
+
 //function for a simple delay with a given timer
 void tim2_5_delay(TIM2_5_CONFIG timer);
 
@@ -0,0 +1,195 @@
+/**
+ ******************************************************************************
+ * @file           : ws2812b.h
+ * @author         : Nubal Manhas
+ * @brief          : Header file for WS2812B LED strip library
+ ******************************************************************************
+ * @purpose
+ *
+ * The purpose of this file is to declare functions, enums, and structs, that
+ * will support the creation of a library for driving WS2812B addressable
+ * LED strips with a timer + DMA on the STM32F01RE MCU
+ *
+ * Datasheet for WS2812B: https://cdn-shop.adafruit.com/datasheets/WS2812B.pdf
+ *
+ ******************************************************************************
+ */
+
+#ifndef WS2812B_H_
+#define WS2812B_H_
+#include "timer.h"
+#include "dma.h"
+#include "gpio.h"
+#include <stdint.h>
+
+/*
+ * Bit timing from p. 4 in WS2812B datasheet, each bit is 1.25us
+ * (800KHz), a 0 is high for 0.4us and a 1 is high for 0.8us, all
+ * +-150ns. The whole bit (high + low) can be off by +-600ns.
+ */
+#define WS2812B_BIT_NS			1250
+#define WS2812B_T0H_NS			400
+#define WS2812B_T1H_NS			800
+#define WS2812B_TH_TOLERANCE_NS	150
+#define WS2812B_BIT_TOLERANCE_NS	600
+
+//24 bits per LED, sent as G7..G0, R7..R0, B7..B0 (p. 5 in WS2812B datasheet)
+#define WS2812B_BITS_PER_LED	24
+
+//the data line has to be held low for more than 50us to latch the
+//colours (p. 4 in WS2812B datasheet), 48 bits of 0 duty = 60us
+#define WS2812B_RESET_SLOTS		48
+
+//number of uint16_t's needed in the buffer for a strip of the given length
+#define WS2812B_BUFFER_SIZE(leds)	((leds) * WS2812B_BITS_PER_LED + WS2812B_RESET_SLOTS)
+
+//LEDs encoded into each half of the buffer when streaming, more LEDs
+//per half means fewer interrupts but a bigger buffer
+#ifndef WS2812B_STREAM_HALF_LEDS
+#define WS2812B_STREAM_HALF_LEDS	1
+#endif
+
+//number of uint16_t's needed in the buffer for ws2812b_stream(), this doesn't depend on the strip length
+#define WS2812B_STREAM_BUFFER_SIZE	(2 * WS2812B_STREAM_HALF_LEDS * WS2812B_BITS_PER_LED)
+
+//one strip per pin of a GPIO port in parallel mode
+#define WS2812B_PARALLEL_MAX_STRIPS	16
+
+//number of uint16_t's needed in the buffer for parallel strips of the given length, this doesn't depend on the number of strips
+#define WS2812B_PARALLEL_BUFFER_SIZE(leds)	((leds) * WS2812B_BITS_PER_LED)
+
+/*
+ * Colour of one LED
+ */
+typedef struct
+{
+	uint8_t R;
+	uint8_t G;
+	uint8_t B;
+}WS2812B_COLOR;
+
+/*
+ * Timer values for the bit timing, PERIOD is the timer
+ * period for one bit, DUTY_0/DUTY_1 are the compare values
+ * for the high time of a 0/1 bit
+ */
+typedef struct
+{
+	uint16_t PERIOD;
+	uint16_t DUTY_0;
+	uint16_t DUTY_1;
+}WS2812B_TIMING;
+
+/*
+ * Interrupt timing for ws2812b_stream()
+ *
+ * HALVES is the number of halves refilled, MAX_CYCLES/LAST_CYCLES the
+ * worst/latest CPU cycles spent refilling a half, and BUDGET_CYCLES the
+ * cycles it takes to send one half, which MAX_CYCLES has to stay well
+ * under. LATE counts refills that happened after the DMA had already
+ * moved on to the half being refilled (the strip got stale data).
+ */
+typedef struct
+{
+	uint32_t HALVES;
+	uint32_t MAX_CYCLES;
+	uint32_t LAST_CYCLES;
+	uint32_t BUDGET_CYCLES;
+	uint32_t LATE;
+}WS2812B_STREAM_STATS;
+
+//callback for when a frame has been sent and latched, context is whatever was given to ws2812b_write()
+typedef void (*WS2812B_CALLBACK)(void* context);
+
+/*
+ * Struct for one LED strip
+ *
+ * Before ws2812b_init() the caller sets TIMER.TMR (TIM3 or TIM4),
+ * COMPARE (pin, port and channel of the data line), BUFFER and LED_COUNT.
+ * BUFFER has to hold WS2812B_BUFFER_SIZE(LED_COUNT) values.
+ *
+ * Everything else is filled in by ws2812b_init()
+ *
+ * FRAME, NEXT_LED and ZERO_SLOTS are only used by ws2812b_stream(),
+ * where BUFFER only has to hold WS2812B_STREAM_BUFFER_SIZE values
+ */
+typedef struct
+{
+	TIM2_5_CONFIG TIMER;
+	TIM2_5_CAPTURE_COMPARE_CONFIG COMPARE;
+	DMA_CONFIG DMA;
+	WS2812B_TIMING TIMING;
+	uint16_t* BUFFER;
+	uint16_t LED_COUNT;
+	WS2812B_CALLBACK CALLBACK;
+	void* CONTEXT;
+	volatile int BUSY;
+	const WS2812B_COLOR* FRAME;
+	uint16_t NEXT_LED;
+	uint16_t ZERO_SLOTS;
+	WS2812B_STREAM_STATS STATS;
+}WS2812B_STRIP;
+
+/*
+ * Struct for up to 16 strips on the pins of one GPIO port, sent in parallel
+ *
+ * Before ws2812b_parallel_init() the caller sets PORT, PIN_MASK (bit n set
+ * for a strip on pin n), BUFFER and LED_COUNT (the longest strip). BUFFER
+ * has to hold WS2812B_PARALLEL_BUFFER_SIZE(LED_COUNT) values.
+ *
+ * TIMER is always TIM1 (see ws2812b_parallel_init()), everything
+ * else is filled in by ws2812b_parallel_init()
+ */
+typedef struct
+{
+	TIM2_5_CONFIG TIMER;
+	GPIO_TypeDef* PORT;
+	uint16_t PIN_MASK;
+	DMA_CONFIG SET_DMA;
+	DMA_CONFIG DATA_DMA;
+	DMA_CONFIG RESET_DMA;
+	WS2812B_TIMING TIMING;
+	uint16_t* BUFFER;
+	uint16_t LED_COUNT;
+	WS2812B_CALLBACK CALLBACK;
+	void* CONTEXT;
+	volatile int BUSY;
+}WS2812B_PARALLEL;
+
+//function to work out the bit timing for the given timer clock in Hz, returns -1 if it is out of tolerance
+int ws2812b_timing(uint32_t timerClk, WS2812B_TIMING* timing);
+
+//function to expand a frame of colours into compare values, followed by the reset slots
+void ws2812b_expand(const WS2812B_COLOR* frame, uint16_t ledCount, uint16_t* buffer, WS2812B_TIMING timing);
+
+//function to set up the timer, pin and DMA for a strip, returns -1 if the strip can't be driven
+int ws2812b_init(WS2812B_STRIP* strip);
+
+//function to send a frame to the strip in the background, returns -1 if a frame is still being sent
+int ws2812b_write(WS2812B_STRIP* strip, const WS2812B_COLOR* frame, WS2812B_CALLBACK callback, void* context);
+
+//function to send a frame through a small circular buffer that is refilled from interrupts, returns -1 if a frame is still being sent
+int ws2812b_stream(WS2812B_STRIP* strip, const WS2812B_COLOR* frame, WS2812B_CALLBACK callback, void* context);
+
+//function to return the interrupt timing of ws2812b_stream()
+WS2812B_STREAM_STATS ws2812b_stream_stats(WS2812B_STRIP* strip);
+
+//function to check if a frame is still being sent
+int ws2812b_busy(WS2812B_STRIP* strip);
+
+//function to turn one LED of every strip into its 24 BSRR reset masks
+void ws2812b_transpose(const WS2812B_COLOR* const strips[WS2812B_PARALLEL_MAX_STRIPS], uint16_t led, uint16_t pinMask, uint16_t* out);
+
+//function to set up TIM1, the pins and the DMA streams for parallel strips, returns -1 if they can't be driven
+int ws2812b_parallel_init(WS2812B_PARALLEL* parallel);
+
+//function to send one frame per strip (NULL for pins without a strip) in the background, returns -1 if a frame is still being sent
+int ws2812b_parallel_write(WS2812B_PARALLEL* parallel, const WS2812B_COLOR* const strips[WS2812B_PARALLEL_MAX_STRIPS], WS2812B_CALLBACK callback, void* context);
+
+//function to check if a parallel frame is still being sent
+int ws2812b_parallel_busy(WS2812B_PARALLEL* parallel);
+
+//function to end the reset latch, call this from TIM1_UP_TIM10_IRQHandler
+void ws2812b_parallel_irq_handler(void);
+
+#endif /* WS2812B_H_ */
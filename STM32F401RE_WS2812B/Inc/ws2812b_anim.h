@@ -0,0 +1,102 @@
+/**
+ ******************************************************************************
+ * @file           : ws2812b_anim.h
+ * @author         : Nubal Manhas
+ * @brief          : Header file for WS2812B animation library
+ ******************************************************************************
+ * @purpose
+ *
+ * The purpose of this file is to declare functions, enums, and structs, that
+ * will support the creation of a library for running LED effects at a fixed
+ * frame rate on a WS2812B strip, for the STM32F01RE MCU
+ *
+ ******************************************************************************
+ */
+
+#ifndef WS2812B_ANIM_H_
+#define WS2812B_ANIM_H_
+#include "ws2812b.h"
+#include "ws2812b_color.h"
+#include "timer.h"
+#include <stdint.h>
+
+//frequency the frame timer counts at, the frame rate has to divide into this and be at most half of it
+#define WS2812B_ANIM_TIMER_FREQ		10000
+
+/*
+ * Effect that draws one frame
+ *
+ * Every LED has to be set, frame still holds whatever was last drawn
+ * into that buffer (after the pipeline). number counts up by one every
+ * frame, context is whatever was given to ws2812b_anim_effect()
+ */
+typedef void (*WS2812B_EFFECT)(WS2812B_COLOR* frame, uint16_t count, uint32_t number, void* context);
+
+/*
+ * Counters for tuning effects
+ *
+ * RENDERED is frames drawn, SENT frames sent to the strip, SKIPPED frames
+ * that matched the last one so weren't sent, and DROPPED frame ticks that
+ * were missed because the last frame was still being drawn or sent.
+ *
+ * LAST_CYCLES/MAX_CYCLES are the CPU cycles taken to draw a frame (effect +
+ * pipeline + compare), and BUDGET_CYCLES the cycles between frames.
+ */
+typedef struct
+{
+	uint32_t RENDERED;
+	uint32_t SENT;
+	uint32_t SKIPPED;
+	uint32_t DROPPED;
+	uint32_t LAST_CYCLES;
+	uint32_t MAX_CYCLES;
+	uint32_t BUDGET_CYCLES;
+}WS2812B_ANIM_STATS;
+
+/*
+ * State for one animation
+ *
+ * FRAMES are two caller given buffers of STRIP->LED_COUNT colours each,
+ * one is drawn into while the other holds the last frame sent. PIPELINE
+ * is optional (NULL to send the effect's colours as they are).
+ *
+ * Everything is set up by ws2812b_anim_init()
+ */
+typedef struct
+{
+	WS2812B_STRIP* STRIP;
+	WS2812B_COLOR* FRAMES[2];
+	WS2812B_PIPELINE* PIPELINE;
+	WS2812B_EFFECT EFFECT;
+	void* CONTEXT;
+	TIM2_5_CONFIG TIMER;
+	int STREAM;
+	int BACK;
+	int FIRST;
+	uint32_t NUMBER;
+	volatile uint32_t TICKS;
+	WS2812B_ANIM_STATS STATS;
+}WS2812B_ANIM;
+
+//function to set up an animation, stream = 1 sends frames with ws2812b_stream() instead of ws2812b_write()
+void ws2812b_anim_init(WS2812B_ANIM* anim, WS2812B_STRIP* strip, WS2812B_COLOR* front, WS2812B_COLOR* back, WS2812B_PIPELINE* pipeline, int stream);
+
+//function to change the effect that is drawn, starting from frame 0
+void ws2812b_anim_effect(WS2812B_ANIM* anim, WS2812B_EFFECT effect, void* context);
+
+//function to start the frame timer on TIM2-5 at the given frames per second, returns -1 if the rate can't be made exactly
+int ws2812b_anim_start(WS2812B_ANIM* anim, TIM_TypeDef* TMR, uint32_t fps);
+
+//function to stop the frame timer
+void ws2812b_anim_stop(WS2812B_ANIM* anim);
+
+//function to count a frame tick, call this from the TIMx_IRQHandler of the timer given to ws2812b_anim_start()
+void ws2812b_anim_tick(WS2812B_ANIM* anim);
+
+//function to draw and send a frame if one is due, call this from the main loop, returns 1 if a frame was drawn
+int ws2812b_anim_process(WS2812B_ANIM* anim);
+
+//function to return the animation counters
+WS2812B_ANIM_STATS ws2812b_anim_stats(WS2812B_ANIM* anim);
+
+#endif /* WS2812B_ANIM_H_ */
@@ -0,0 +1,61 @@
+/**
+ ******************************************************************************
+ * @file           : ws2812b_color.h
+ * @author         : Nubal Manhas
+ * @brief          : Header file for WS2812B colour pipeline library
+ ******************************************************************************
+ * @purpose
+ *
+ * The purpose of this file is to declare functions, enums, and structs, that
+ * will support the creation of a library for turning colours into what is
+ * sent to WS2812B LEDs (gamma, brightness, dithering) using only integer
+ * math, for the STM32F01RE MCU
+ *
+ ******************************************************************************
+ */
+
+#ifndef WS2812B_COLOR_H_
+#define WS2812B_COLOR_H_
+#include "ws2812b.h"
+#include <stdint.h>
+
+//gamma the LEDs are corrected for, the table in ws2812b_color.c is built for this
+#define WS2812B_GAMMA			2.2
+
+//hue is 0-255 around the colour wheel, split into 6 regions of 43
+#define WS2812B_HUE_REGION		43
+
+/*
+ * State for one colour pipeline
+ *
+ * LUT is the gamma table scaled by BRIGHTNESS, as 8.8 fixed point
+ * (the top 8 bits are what gets sent, the bottom 8 bits are only used
+ * when DITHER is on). FRAME counts frames for the dithering.
+ *
+ * Set up with ws2812b_color_init(), and only change BRIGHTNESS
+ * through ws2812b_color_brightness() so the LUT is rebuilt
+ */
+typedef struct
+{
+	uint16_t LUT[256];
+	uint8_t BRIGHTNESS;
+	int DITHER;
+	uint8_t FRAME;
+}WS2812B_PIPELINE;
+
+//gamma table, 8 bit linear in, 8.8 fixed point out
+extern const uint16_t WS2812B_GAMMA_TABLE[256];
+
+//function to set up a pipeline with the given brightness (0-255), dither = 1 turns on temporal dithering
+void ws2812b_color_init(WS2812B_PIPELINE* pipeline, uint8_t brightness, int dither);
+
+//function to change the brightness (0-255) of a pipeline
+void ws2812b_color_brightness(WS2812B_PIPELINE* pipeline, uint8_t brightness);
+
+//function to convert hue, saturation and value (all 0-255) to a colour
+WS2812B_COLOR ws2812b_hsv(uint8_t hue, uint8_t saturation, uint8_t value);
+
+//function to run a frame through the pipeline, in and out can be the same array
+void ws2812b_color_apply(WS2812B_PIPELINE* pipeline, const WS2812B_COLOR* in, WS2812B_COLOR* out, uint16_t count);
+
+#endif /* WS2812B_COLOR_H_ */
@@ -17,22 +17,27 @@
 #include "gpio.h"
 #include "timer.h"
 #include "systick.h"
+#include "ws2812b.h"
+#include "ws2812b_color.h"
+#include "ws2812b_anim.h"
+#include "dwt.h"
 #include <stdio.h>
 #include <stdint.h>
 
-#define WS2812B_TEST
+/* TESTS: */
+#define WS2812B_TEST //un-comment this to run a colour chase on a strip wired to PA6
+//#define WS2812B_EXPAND_TEST //un-comment this to check the bit timing and frame expansion (view results with live expressions)
+//#define COLOR_BENCHMARK_TEST //un-comment this to time each colour pipeline stage in cycles per pixel and check the brightness ends (view results with live expressions)
+//#define ANIM_TEST //un-comment this to run a rainbow at 50 FPS on a strip wired to PA6, frame counters are sent over USART2
+//#define WS2812B_STREAM_TEST //un-comment this to stream frames to a 300 LED strip on PA6, the refill interrupt timing is sent over USART2
+//#define WS2812B_PARALLEL_TEST //un-comment this to run a colour chase on 4 strips at once, wired to PC0-PC3
+//#define TRANSPOSE_BENCHMARK_TEST //un-comment this to time the parallel bit transpose in cycles per LED (view results with live expressions)
 
 //baudrate for UART
 const int UART_BAUDRATE = 115200;
 
-//to configure the Timers, the following formula is used:
-//Desired Frequency = SYSCLK_FREQ / (PRESCALER+PERIOD),
-//and a 1.25uS (800KHz) frequency is required based on p. 4 in the
-//WS2812B datasheet
-const int TMR3_PRESCALER = 1;
-const int TMR3_PERIOD = 20;
-const int TMR3_64_DUTY = TMR3_PERIOD * 0.6;
-const int TMR3_32_DUTY = TMR3_PERIOD * 0.32;
+//number of LEDs on the strip
+#define WS2812B_LED_COUNT 8
 
 //UART with PA3 as RX, PA2 as TX for USART2
 UART_CONFIG UART2 = {
@@ -42,58 +47,510 @@ UART_CONFIG UART2 = {
 					 GPIOA
 					};
 
-//struct to configure output compare
-TIM2_5_CAPTURE_COMPARE_CONFIG CAPTURE_COMPARE = {
-												 TIM3_CH1_PA6,
-												 GPIOA,
-												 TIM2_5_OUTPUT,
-												 TIM2_5_CH1,
-												 TIM2_5_PWM_MODE1
-												};
-
 /*
- * Configuring TIM3 to count to 1.25uS (16MHz system clk)
- *
- * This is because the data transfer time is 1.25uS for the
- * LED PWM (p. 4 in WS2812B datasheet)
+ * Buffer with one TIM3 compare value per bit, plus the reset slots
  *
- * 16MHz/800KHz (1.25uS) = 20 = (prescaler + period)
- * so setting a prescaler for the clock isn't neeeded,
- * just a period of 20 at 16MHz is good enough.
+ * The timer period and compare values for a 0/1 (the old TMR3_32_DUTY/
+ * TMR3_64_DUTY) are worked out by ws2812b_init() from the timer clock,
+ * 20/6/13 at 16MHz (p. 4 in WS2812B datasheet)
  */
-TIM2_5_CONFIG TMR3 = {
-					  TIM3,
-					  TIM2_5_UP,
-					  TMR3_PRESCALER,
-					  TMR3_PERIOD
-					 };
-//char buffer for uart transmitting
-char str[30];
-int myCount = 0;
+uint16_t stripBuffer[WS2812B_BUFFER_SIZE(WS2812B_LED_COUNT)];
+
+//strip on TIM3 CH1 (PA6), the rest is filled in by ws2812b_init()
+WS2812B_STRIP STRIP = {
+					   .TIMER = {TIM3},
+					   .COMPARE = {TIM3_CH1_PA6, GPIOA, TIM2_5_OUTPUT, TIM2_5_CH1, TIM2_5_PWM_MODE1},
+					   .BUFFER = stripBuffer,
+					   .LED_COUNT = WS2812B_LED_COUNT
+					  };
+
+WS2812B_COLOR frame[WS2812B_LED_COUNT]; //colours for the next frame
+
+//globals so these can be viewed with live expressions in the debugger
+volatile uint32_t framesSent = 0; //frames sent + latched
+int ws2812bErrors = 0; //WS2812B_EXPAND_TEST failures, should stay 0
+
+#ifdef COLOR_BENCHMARK_TEST
+	#define BENCHMARK_PIXELS 64
+
+	WS2812B_PIPELINE PIPELINE; //gamma + brightness LUT
+	WS2812B_COLOR benchIn[BENCHMARK_PIXELS];
+	WS2812B_COLOR benchOut[BENCHMARK_PIXELS];
+	uint16_t benchBuffer[WS2812B_BUFFER_SIZE(BENCHMARK_PIXELS)];
+
+	//cycles per pixel for each stage, view with live expressions
+	uint32_t hsvCyclesPerPixel = 0; //ws2812b_hsv()
+	uint32_t gammaCyclesPerPixel = 0; //ws2812b_color_apply() without dithering
+	uint32_t ditherCyclesPerPixel = 0; //ws2812b_color_apply() with dithering
+	uint32_t expandCyclesPerPixel = 0; //ws2812b_expand(), the encoder the pipeline feeds
+	uint32_t brightnessCycles = 0; //rebuilding the LUT for a new brightness, once per change
+	int colorErrors = 0; //brightness 0 not black or 255 not full, should stay 0
+#endif
+
+#ifdef ANIM_TEST
+	#define ANIM_FPS 50 //has to divide into WS2812B_ANIM_TIMER_FREQ
+
+	WS2812B_ANIM ANIM; //frame scheduler for STRIP
+	WS2812B_PIPELINE ANIM_PIPELINE; //gamma + brightness for the animation
+	WS2812B_COLOR animFrames[2][WS2812B_LED_COUNT]; //double buffer
+
+	/*
+	 * Rainbow that moves one step every 4 frames, so 3 out of every
+	 * 4 frames are the same as the last one and aren't sent
+	 */
+	void rainbow_effect(WS2812B_COLOR* frame, uint16_t count, uint32_t number, void* context)
+	{
+		uint8_t offset = (uint8_t)(number / 4);
+
+		for(uint16_t i = 0; i < count; i++)
+		{
+			frame[i] = ws2812b_hsv((uint8_t)(offset + (i * 256 / count)), 255, 255);
+		}
+	}
+
+	//TIM2 global interrupt, frame ticks
+	void TIM2_IRQHandler(void)
+	{
+		ws2812b_anim_tick(&ANIM);
+	}
+#endif
+
+#ifdef WS2812B_STREAM_TEST
+	#define STREAM_LED_COUNT 300
+
+	//300 LEDs would need a 14KB buffer fully expanded,
+	//streaming only needs WS2812B_STREAM_BUFFER_SIZE values
+	uint16_t streamBuffer[WS2812B_STREAM_BUFFER_SIZE];
+	WS2812B_COLOR streamFrame[STREAM_LED_COUNT];
+#endif
+
+#if defined(WS2812B_PARALLEL_TEST) || defined(TRANSPOSE_BENCHMARK_TEST)
+	#define PARALLEL_STRIPS 4
+
+	//one frame per strip, transposed into a single buffer
+	uint16_t parallelBuffer[WS2812B_PARALLEL_BUFFER_SIZE(WS2812B_LED_COUNT)];
+	WS2812B_COLOR parallelFrames[PARALLEL_STRIPS][WS2812B_LED_COUNT];
+	const WS2812B_COLOR* parallelStrips[WS2812B_PARALLEL_MAX_STRIPS];
+
+	//strips on PC0-PC3, the rest is filled in by ws2812b_parallel_init()
+	WS2812B_PARALLEL PARALLEL = {
+								 .PORT = GPIOC,
+								 .PIN_MASK = 0x000F,
+								 .BUFFER = parallelBuffer,
+								 .LED_COUNT = WS2812B_LED_COUNT
+								};
+#endif
+
+#ifdef WS2812B_PARALLEL_TEST
+	//TIM1 update interrupt, ends the reset latch
+	void TIM1_UP_TIM10_IRQHandler(void)
+	{
+		ws2812b_parallel_irq_handler();
+	}
+#endif
+
+#ifdef TRANSPOSE_BENCHMARK_TEST
+	uint32_t transposeCyclesPerLed = 0; //16 strips, one LED each
+	uint32_t naiveCyclesPerLed = 0; //same thing, one bit at a time
+	int transposeErrors = 0; //slots where the two disagree, should stay 0
+
+	/*
+	 * Straightforward version of ws2812b_transpose() to compare against
+	 */
+	void naive_transpose(const WS2812B_COLOR* const strips[WS2812B_PARALLEL_MAX_STRIPS], uint16_t led, uint16_t pinMask, uint16_t* out)
+	{
+		for(int bit = 0; bit < WS2812B_BITS_PER_LED; bit++)
+		{
+			uint16_t zeros = 0;
+
+			for(int s = 0; s < WS2812B_PARALLEL_MAX_STRIPS; s++)
+			{
+				uint32_t grb = 0;
+
+				if(strips[s] != NULL)
+				{
+					grb = ((uint32_t)strips[s][led].G << 16) | ((uint32_t)strips[s][led].R << 8) | strips[s][led].B;
+				}
+
+				if(!(grb & (0x800000U >> bit)))
+				{
+					zeros |= (1U << s);
+				}
+			}
+
+			out[bit] = zeros & pinMask;
+		}
+	}
+#endif
+
+#if defined(WS2812B_TEST) || defined(WS2812B_STREAM_TEST) || defined(WS2812B_PARALLEL_TEST)
+	/*
+	 * Called from the DMA interrupt once a frame has been latched
+	 */
+	void frame_done(void* context)
+	{
+		framesSent++;
+	}
+#endif
+
 int main(void)
 {
 	#ifdef WS2812B_TEST
-	//init uart2 at 115200 baud
-	//uart_init(UART2.USART, UART_BAUDRATE);
-	tim2_5_init_pwm(TMR3, CAPTURE_COMPARE, 0, TIM2_5_RISING_EDGE);
-	tim2_5_enable(TMR3);
-	tim2_5_interrupt_enable(TMR3, TIM2_5_CC1_INTERRUPT);
+		uint64_t nextFrame = 0;
+		int position = 0;
+
+		systick_init();
+
+		if(ws2812b_init(&STRIP) != 0)
+		{
+			while(1)
+			{
+			}
+		}
+
 		while(1)
 		{
+			//move one lit LED along the strip every 50ms,
+			//the CPU is free while each frame is being sent
+			if(deadline_expired(nextFrame) && !ws2812b_busy(&STRIP))
+			{
+				for(int i = 0; i < WS2812B_LED_COUNT; i++)
+				{
+					frame[i].R = (i == position) ? 64 : 0;
+					frame[i].G = (i == (position + 1) % WS2812B_LED_COUNT) ? 64 : 0;
+					frame[i].B = (i == (position + 2) % WS2812B_LED_COUNT) ? 64 : 0;
+				}
+
+				ws2812b_write(&STRIP, frame, frame_done, NULL);
 
+				position = (position + 1) % WS2812B_LED_COUNT;
+				nextFrame = millis() + 50;
+			}
 		}
 	#endif
-}
 
-void TIM3_IRQHandler(void)
-{
-	if(myCount == 41)
-	{
-		tim2_5_pwm_duty(TMR3, CAPTURE_COMPARE, 13);
-		tim2_5_interrupt_disable(TMR3, TIM2_5_CC1_INTERRUPT);
-	} else
-	{
-		myCount++;
-	}
+	#ifdef WS2812B_EXPAND_TEST
+		WS2812B_TIMING timing;
+
+		//16MHz (reset) and 84MHz (rcc_init()) timer clocks
+		if(ws2812b_timing(16000000, &timing) != 0 || timing.PERIOD != 20 || timing.DUTY_0 != 6 || timing.DUTY_1 != 13)
+		{
+			ws2812bErrors++;
+		}
+
+		if(ws2812b_timing(84000000, &timing) != 0 || timing.PERIOD != 105 || timing.DUTY_0 != 34 || timing.DUTY_1 != 67)
+		{
+			ws2812bErrors++;
+		}
+
+		//too slow to get the high times within 150ns
+		if(ws2812b_timing(2000000, &timing) != -1)
+		{
+			ws2812bErrors++;
+		}
+
+		//expand a frame and check every slot against the colour it came from
+		ws2812b_timing(16000000, &timing);
+
+		for(int i = 0; i < WS2812B_LED_COUNT; i++)
+		{
+			frame[i].R = 0x81 ^ (i * 17);
+			frame[i].G = 0x3C + i;
+			frame[i].B = 0xF0 >> (i % 5);
+		}
+
+		ws2812b_expand(frame, WS2812B_LED_COUNT, stripBuffer, timing);
+
+		for(int i = 0; i < WS2812B_LED_COUNT; i++)
+		{
+			uint32_t grb = ((uint32_t)frame[i].G << 16) | ((uint32_t)frame[i].R << 8) | frame[i].B;
+
+			for(int bit = 0; bit < WS2812B_BITS_PER_LED; bit++)
+			{
+				uint16_t expected = (grb & (0x800000U >> bit)) ? timing.DUTY_1 : timing.DUTY_0;
+
+				if(stripBuffer[(i * WS2812B_BITS_PER_LED) + bit] != expected)
+				{
+					ws2812bErrors++;
+				}
+			}
+		}
+
+		for(int slot = 0; slot < WS2812B_RESET_SLOTS; slot++)
+		{
+			if(stripBuffer[(WS2812B_LED_COUNT * WS2812B_BITS_PER_LED) + slot] != 0)
+			{
+				ws2812bErrors++;
+			}
+		}
+
+		while(1)
+		{
+		}
+	#endif
+
+	#ifdef COLOR_BENCHMARK_TEST
+		WS2812B_TIMING benchTiming;
+		uint32_t start;
+
+		dwt_init();
+		ws2812b_timing(16000000, &benchTiming);
+
+		start = cycles_now();
+		ws2812b_color_init(&PIPELINE, 128, 0);
+		brightnessCycles = cycles_elapsed(start);
+
+		//a rainbow across the pixels
+		start = cycles_now();
+
+		for(int i = 0; i < BENCHMARK_PIXELS; i++)
+		{
+			benchIn[i] = ws2812b_hsv((uint8_t)(i * 4), 255, 255);
+		}
+
+		hsvCyclesPerPixel = cycles_elapsed(start) / BENCHMARK_PIXELS;
+
+		start = cycles_now();
+		ws2812b_color_apply(&PIPELINE, benchIn, benchOut, BENCHMARK_PIXELS);
+		gammaCyclesPerPixel = cycles_elapsed(start) / BENCHMARK_PIXELS;
+
+		PIPELINE.DITHER = 1;
+
+		start = cycles_now();
+		ws2812b_color_apply(&PIPELINE, benchIn, benchOut, BENCHMARK_PIXELS);
+		ditherCyclesPerPixel = cycles_elapsed(start) / BENCHMARK_PIXELS;
 
+		start = cycles_now();
+		ws2812b_expand(benchOut, BENCHMARK_PIXELS, benchBuffer, benchTiming);
+		expandCyclesPerPixel = cycles_elapsed(start) / BENCHMARK_PIXELS;
+
+		//brightness 0 has to stay off through all 8 dither thresholds
+		ws2812b_color_brightness(&PIPELINE, 0);
+
+		for(int frame = 0; frame < 8; frame++)
+		{
+			ws2812b_color_apply(&PIPELINE, benchIn, benchOut, BENCHMARK_PIXELS);
+
+			for(int i = 0; i < BENCHMARK_PIXELS; i++)
+			{
+				if(benchOut[i].R != 0 || benchOut[i].G != 0 || benchOut[i].B != 0)
+				{
+					colorErrors++;
+				}
+			}
+		}
+
+		//and 255 has to reach full on, without dithering
+		ws2812b_color_brightness(&PIPELINE, 255);
+		PIPELINE.DITHER = 0;
+		benchIn[0].R = 255;
+		benchIn[0].G = 255;
+		benchIn[0].B = 255;
+		ws2812b_color_apply(&PIPELINE, benchIn, benchOut, 1);
+
+		if(benchOut[0].R != 255 || benchOut[0].G != 255 || benchOut[0].B != 255)
+		{
+			colorErrors++;
+		}
+
+		//expect colorErrors = 0
+		while(1)
+		{
+		}
+	#endif
+
+	#ifdef ANIM_TEST
+		uint64_t nextStats = 0;
+
+		systick_init();
+		uart_init(UART2, UART_BAUDRATE);
+
+		if(ws2812b_init(&STRIP) != 0)
+		{
+			while(1)
+			{
+			}
+		}
+
+		ws2812b_color_init(&ANIM_PIPELINE, 64, 0);
+		ws2812b_anim_init(&ANIM, &STRIP, animFrames[0], animFrames[1], &ANIM_PIPELINE, 0);
+		ws2812b_anim_effect(&ANIM, rainbow_effect, NULL);
+
+		if(ws2812b_anim_start(&ANIM, TIM2, ANIM_FPS) != 0)
+		{
+			while(1)
+			{
+			}
+		}
+
+		while(1)
+		{
+			ws2812b_anim_process(&ANIM);
+
+			if(deadline_expired(nextStats))
+			{
+				WS2812B_ANIM_STATS stats = ws2812b_anim_stats(&ANIM);
+				char s[120];
+
+				sprintf(s,"rendered: %lu, sent: %lu, skipped: %lu, dropped: %lu, frame: %lu/%lu cycles\n\r", stats.RENDERED, stats.SENT, stats.SKIPPED, stats.DROPPED, stats.MAX_CYCLES, stats.BUDGET_CYCLES);
+				uart_write_string(UART2.USART, s);
+
+				nextStats = millis() + 1000;
+			}
+
+			//sleep until the next interrupt (frame tick, DMA or SysTick)
+			__WFI();
+		}
+	#endif
+
+	#ifdef WS2812B_STREAM_TEST
+		uint64_t nextPrint = 0;
+		int offset = 0;
+
+		systick_init();
+		uart_init(UART2, UART_BAUDRATE);
+
+		STRIP.BUFFER = streamBuffer;
+		STRIP.LED_COUNT = STREAM_LED_COUNT;
+
+		if(ws2812b_init(&STRIP) != 0)
+		{
+			while(1)
+			{
+			}
+		}
+
+		while(1)
+		{
+			//a rainbow-ish gradient moving along the strip, the frame can
+			//only be changed once the last one has been sent
+			if(!ws2812b_busy(&STRIP))
+			{
+				for(int i = 0; i < STREAM_LED_COUNT; i++)
+				{
+					uint8_t step = (uint8_t)(i + offset);
+
+					streamFrame[i].R = step >> 2;
+					streamFrame[i].G = (uint8_t)(255 - step) >> 2;
+					streamFrame[i].B = (uint8_t)(step * 2) >> 3;
+				}
+
+				ws2812b_stream(&STRIP, streamFrame, frame_done, NULL);
+				offset++;
+			}
+
+			//worst case refill time against the time it takes to send a half
+			if(deadline_expired(nextPrint))
+			{
+				WS2812B_STREAM_STATS stats = ws2812b_stream_stats(&STRIP);
+				char s[100];
+
+				sprintf(s,"frames: %lu, isr max: %lu/%lu cycles, last: %lu, late: %lu\n\r", framesSent, stats.MAX_CYCLES, stats.BUDGET_CYCLES, stats.LAST_CYCLES, stats.LATE);
+				uart_write_string(UART2.USART, s);
+
+				nextPrint = millis() + 1000;
+			}
+		}
+	#endif
+
+	#ifdef WS2812B_PARALLEL_TEST
+		uint64_t parallelNextFrame = 0;
+		int parallelPosition = 0;
+
+		systick_init();
+
+		for(int s = 0; s < PARALLEL_STRIPS; s++)
+		{
+			parallelStrips[s] = parallelFrames[s];
+		}
+
+		if(ws2812b_parallel_init(&PARALLEL) != 0)
+		{
+			while(1)
+			{
+			}
+		}
+
+		while(1)
+		{
+			//each strip chases a different colour, one LED further along than the last strip
+			if(deadline_expired(parallelNextFrame) && !ws2812b_parallel_busy(&PARALLEL))
+			{
+				for(int s = 0; s < PARALLEL_STRIPS; s++)
+				{
+					for(int i = 0; i < WS2812B_LED_COUNT; i++)
+					{
+						int lit = (i == (parallelPosition + s) % WS2812B_LED_COUNT);
+
+						parallelFrames[s][i].R = (lit && s != 1) ? 64 : 0;
+						parallelFrames[s][i].G = (lit && s != 2) ? 64 : 0;
+						parallelFrames[s][i].B = (lit && s != 0) ? 64 : 0;
+					}
+				}
+
+				ws2812b_parallel_write(&PARALLEL, parallelStrips, frame_done, NULL);
+
+				parallelPosition = (parallelPosition + 1) % WS2812B_LED_COUNT;
+				parallelNextFrame = millis() + 50;
+			}
+		}
+	#endif
+
+	#ifdef TRANSPOSE_BENCHMARK_TEST
+		//all 16 strips, so the benchmark is the worst case
+		static WS2812B_COLOR benchFrames[WS2812B_PARALLEL_MAX_STRIPS][WS2812B_LED_COUNT];
+		uint16_t fast[WS2812B_BITS_PER_LED];
+		uint16_t slow[WS2812B_BITS_PER_LED];
+		uint32_t start;
+
+		dwt_init();
+
+		for(int s = 0; s < WS2812B_PARALLEL_MAX_STRIPS; s++)
+		{
+			parallelStrips[s] = benchFrames[s];
+
+			for(int i = 0; i < WS2812B_LED_COUNT; i++)
+			{
+				benchFrames[s][i].R = (uint8_t)(s * 31 + i * 7);
+				benchFrames[s][i].G = (uint8_t)(s * 13) ^ (uint8_t)(i * 91);
+				benchFrames[s][i].B = (uint8_t)(0xA5 >> (s % 8)) + i;
+			}
+		}
+
+		start = cycles_now();
+
+		for(int i = 0; i < WS2812B_LED_COUNT; i++)
+		{
+			ws2812b_transpose(parallelStrips, i, 0xFFFF, parallelBuffer + (i * WS2812B_BITS_PER_LED));
+		}
+
+		transposeCyclesPerLed = cycles_elapsed(start) / WS2812B_LED_COUNT;
+
+		start = cycles_now();
+
+		for(int i = 0; i < WS2812B_LED_COUNT; i++)
+		{
+			naive_transpose(parallelStrips, i, 0xFFFF, parallelBuffer + (i * WS2812B_BITS_PER_LED));
+		}
+
+		naiveCyclesPerLed = cycles_elapsed(start) / WS2812B_LED_COUNT;
+
+		for(int i = 0; i < WS2812B_LED_COUNT; i++)
+		{
+			ws2812b_transpose(parallelStrips, i, 0xFFFF, fast);
+			naive_transpose(parallelStrips, i, 0xFFFF, slow);
+
+			for(int bit = 0; bit < WS2812B_BITS_PER_LED; bit++)
+			{
+				if(fast[bit] != slow[bit])
+				{
+					transposeErrors++;
+				}
+			}
+		}
+
+		while(1)
+		{
+		}
+	#endif
 }
@@ -0,0 +1,777 @@
+/**
+ ******************************************************************************
+ * @file           : ws2812b.c
+ * @author         : Nubal Manhas
+ * @brief          : Main c file for WS2812B LED strip library
+ ******************************************************************************
+ * @purpose
+ *
+ * The purpose of this file is to define functions that will support
+ * driving WS2812B addressable LED strips with a timer + DMA on the
+ * STM32F01RE MCU
+ *
+ ******************************************************************************
+ */
+#include "ws2812b.h"
+#include "dwt.h"
+#include "rcc.h"
+#include <stddef.h>
+
+void ws2812b_dma_callback(void* context, uint32_t events);
+void ws2812b_stream_callback(void* context, uint32_t events);
+void ws2812b_stream_fill(WS2812B_STRIP* strip, uint16_t* half);
+void ws2812b_finish(WS2812B_STRIP* strip);
+void ws2812b_transpose8(uint32_t* x, uint32_t* y);
+void ws2812b_parallel_callback(void* context, uint32_t events);
+void ws2812b_parallel_stop(WS2812B_PARALLEL* parallel);
+
+//parallel strips being sent, for the TIM1 update interrupt
+static WS2812B_PARALLEL* parallelActive = NULL;
+uint32_t ws2812b_ticks_to_ns(uint32_t ticks, uint32_t timerClk);
+
+/*
+ * Function to convert timer ticks to nanoseconds, rounded
+ */
+uint32_t ws2812b_ticks_to_ns(uint32_t ticks, uint32_t timerClk)
+{
+	return (uint32_t)((((uint64_t)ticks * 1000000000) + (timerClk / 2)) / timerClk);
+}
+
+/*
+ * Function to work out the timer period and compare values for the
+ * WS2812B bit timing at the given timer clock (with a prescaler of 1)
+ *
+ * 16MHz: PERIOD = 20,  DUTY_0 = 6 (375ns),  DUTY_1 = 13 (813ns)
+ * 84MHz: PERIOD = 105, DUTY_0 = 34 (405ns), DUTY_1 = 67 (798ns)
+ *
+ * Returns -1 if the rounded times are outside the datasheet tolerances
+ * (the timer clock is too slow), or the period doesn't fit in 16 bits
+ */
+int ws2812b_timing(uint32_t timerClk, WS2812B_TIMING* timing)
+{
+	uint32_t period, duty0, duty1;
+	int32_t error;
+
+	if(timerClk == 0)
+	{
+		return -1;
+	}
+
+	period = (uint32_t)((((uint64_t)timerClk * WS2812B_BIT_NS) + 500000000) / 1000000000);
+	duty0 = ((period * WS2812B_T0H_NS) + (WS2812B_BIT_NS / 2)) / WS2812B_BIT_NS;
+	duty1 = ((period * WS2812B_T1H_NS) + (WS2812B_BIT_NS / 2)) / WS2812B_BIT_NS;
+
+	if(period < 2 || period > 0xFFFF || duty0 == 0 || duty0 == duty1)
+	{
+		return -1;
+	}
+
+	error = (int32_t)ws2812b_ticks_to_ns(period, timerClk) - WS2812B_BIT_NS;
+
+	if(error > WS2812B_BIT_TOLERANCE_NS || error < -WS2812B_BIT_TOLERANCE_NS)
+	{
+		return -1;
+	}
+
+	error = (int32_t)ws2812b_ticks_to_ns(duty0, timerClk) - WS2812B_T0H_NS;
+
+	if(error > WS2812B_TH_TOLERANCE_NS || error < -WS2812B_TH_TOLERANCE_NS)
+	{
+		return -1;
+	}
+
+	error = (int32_t)ws2812b_ticks_to_ns(duty1, timerClk) - WS2812B_T1H_NS;
+
+	if(error > WS2812B_TH_TOLERANCE_NS || error < -WS2812B_TH_TOLERANCE_NS)
+	{
+		return -1;
+	}
+
+	timing->PERIOD = period;
+	timing->DUTY_0 = duty0;
+	timing->DUTY_1 = duty1;
+
+	return 0;
+}
+
+/*
+ * Function to expand a frame into one compare value per bit
+ *
+ * Each LED takes 24 values, green then red then blue, most significant
+ * bit first (p. 5 in WS2812B datasheet). The WS2812B_RESET_SLOTS values
+ * after the last LED are 0, which holds the line low to latch the frame.
+ *
+ * This doesn't touch any hardware, so it can run anywhere
+ */
+void ws2812b_expand(const WS2812B_COLOR* frame, uint16_t ledCount, uint16_t* buffer, WS2812B_TIMING timing)
+{
+	uint32_t grb;
+
+	for(uint16_t led = 0; led < ledCount; led++)
+	{
+		grb = ((uint32_t)frame[led].G << 16) | ((uint32_t)frame[led].R << 8) | frame[led].B;
+
+		for(int bit = WS2812B_BITS_PER_LED - 1; bit >= 0; bit--)
+		{
+			*buffer++ = (grb & (1U << bit)) ? timing.DUTY_1 : timing.DUTY_0;
+		}
+	}
+
+	for(int slot = 0; slot < WS2812B_RESET_SLOTS; slot++)
+	{
+		*buffer++ = 0;
+	}
+}
+
+/*
+ * Function to set up the timer, data pin and DMA stream for a strip
+ *
+ * The timer runs in PWM mode 1 with a period of one bit, and the
+ * update event makes a DMA request that writes the next compare
+ * value. With the compare preload on (set by tim2_5_init_pwm()),
+ * each value takes effect at the start of the following bit, so
+ * the timing doesn't depend on when the DMA gets to it.
+ *
+ * Only TIM3 and TIM4 can be used, their CCRx registers are 16 bits
+ * like the buffer. The update requests are:
+ *
+ * TIM3_UP = DMA1 Stream2 Channel5
+ * TIM4_UP = DMA1 Stream6 Channel2 (same stream as USART2_TX)
+ *
+ * Table 27 in Ref Manual
+ *
+ * Returns -1 for any other timer, or if the timer clock can't
+ * meet the bit timing
+ */
+int ws2812b_init(WS2812B_STRIP* strip)
+{
+	if(strip->TIMER.TMR == TIM3)
+	{
+		strip->DMA.DMA = DMA1;
+		strip->DMA.STREAM = DMA_STREAM2;
+		strip->DMA.CHANNEL = DMA_CH5;
+	}
+	else if(strip->TIMER.TMR == TIM4)
+	{
+		strip->DMA.DMA = DMA1;
+		strip->DMA.STREAM = DMA_STREAM6;
+		strip->DMA.CHANNEL = DMA_CH2;
+	}
+	else
+	{
+		return -1;
+	}
+
+	if(ws2812b_timing(tim2_5_get_clk(strip->TIMER), &strip->TIMING) != 0)
+	{
+		return -1;
+	}
+
+	strip->DMA.DIRECTION = DMA_MEMORY_TO_PERIPH;
+	strip->DMA.PERIPH_SIZE = DMA_SIZE_HALF_WORD;
+	strip->DMA.MEM_SIZE = DMA_SIZE_HALF_WORD;
+	strip->DMA.PRIORITY = DMA_PRIORITY_HIGH;
+	strip->DMA.MODE = DMA_NORMAL;
+	strip->DMA.MEM_INCREMENT = 1;
+
+	strip->TIMER.COUNTER_MODE = TIM2_5_UP;
+	strip->TIMER.PRESCALER = 1;
+	strip->TIMER.PERIOD = strip->TIMING.PERIOD;
+
+	strip->COMPARE.CAPTURE_COMPARE_MODE = TIM2_5_OUTPUT;
+	strip->COMPARE.OUTPUT_MODE = TIM2_5_PWM_MODE1;
+
+	strip->CALLBACK = NULL;
+	strip->CONTEXT = NULL;
+	strip->BUSY = 0;
+	strip->FRAME = NULL;
+	strip->STATS = (WS2812B_STREAM_STATS){0};
+
+	//the timer is left running with a duty of 0,
+	//so the line sits low between frames
+	tim2_5_init_pwm(strip->TIMER, strip->COMPARE, 0, TIM2_5_RISING_EDGE);
+	tim2_5_pwm_duty(strip->TIMER, strip->COMPARE, 0);
+	tim2_5_enable(strip->TIMER);
+
+	return 0;
+}
+
+/*
+ * Function to send a frame to the strip
+ *
+ * The frame is expanded into the strip's buffer, so it can be changed
+ * as soon as this returns. After that the CPU isn't involved until the
+ * DMA is done. The callback is run from the DMA interrupt once the last
+ * reset slot has been loaded, by then the line has been low for
+ * WS2812B_RESET_SLOTS - 2 bits (57.5us), so the frame has been latched.
+ *
+ * Returns -1 if the last frame is still being sent, or the strip
+ * is too long for one DMA transfer
+ */
+int ws2812b_write(WS2812B_STRIP* strip, const WS2812B_COLOR* frame, WS2812B_CALLBACK callback, void* context)
+{
+	uint32_t count = WS2812B_BUFFER_SIZE((uint32_t)strip->LED_COUNT);
+
+	if(strip->BUSY || count > 0xFFFF)
+	{
+		return -1;
+	}
+
+	strip->BUSY = 1;
+	strip->CALLBACK = callback;
+	strip->CONTEXT = context;
+
+	ws2812b_expand(frame, strip->LED_COUNT, strip->BUFFER, strip->TIMING);
+
+	dma_init(strip->DMA);
+	dma_interrupt_enable(strip->DMA, DMA_EVENT_TRANSFER_COMPLETE | DMA_EVENT_ERROR, ws2812b_dma_callback, strip);
+
+	//CCR1-4 are next to each other
+	dma_start(strip->DMA, (uint32_t)(&strip->TIMER.TMR->CCR1 + strip->COMPARE.CHANNEL), (uint32_t)strip->BUFFER, (uint16_t)count);
+
+	//UDE makes every update event a DMA request
+	//13.4.4 in Ref Manual
+	strip->TIMER.TMR->DIER |= TIM_DIER_UDE;
+
+	return 0;
+}
+
+/*
+ * Function to send a frame without expanding all of it up front
+ *
+ * BUFFER is used as a circular buffer of two halves, each holding
+ * WS2812B_STREAM_HALF_LEDS LEDs. While the DMA sends one half, the half
+ * transfer/transfer complete interrupt encodes the next LEDs into the
+ * other, so the RAM used stays the same for any strip length (48 values,
+ * 96 bytes by default, instead of 24 values per LED).
+ *
+ * Since the frame is read while it is being sent, it can't be changed
+ * until the callback has run. Each refill has to finish within one half
+ * (30us per LED), see ws2812b_stream_stats() for how long they take.
+ *
+ * Returns -1 if a frame is still being sent
+ */
+int ws2812b_stream(WS2812B_STRIP* strip, const WS2812B_COLOR* frame, WS2812B_CALLBACK callback, void* context)
+{
+	uint32_t halfSlots = WS2812B_STREAM_HALF_LEDS * WS2812B_BITS_PER_LED;
+
+	if(strip->BUSY)
+	{
+		return -1;
+	}
+
+	strip->BUSY = 1;
+	strip->CALLBACK = callback;
+	strip->CONTEXT = context;
+	strip->FRAME = frame;
+	strip->NEXT_LED = 0;
+	strip->ZERO_SLOTS = 0;
+
+	//one half takes halfSlots timer periods, converted to CPU cycles
+	strip->STATS.BUDGET_CYCLES = (uint32_t)(((uint64_t)halfSlots * strip->TIMING.PERIOD * rcc_get_hclk()) / tim2_5_get_clk(strip->TIMER));
+
+	dwt_init();
+
+	ws2812b_stream_fill(strip, strip->BUFFER);
+	ws2812b_stream_fill(strip, strip->BUFFER + halfSlots);
+
+	strip->DMA.MODE = DMA_CIRCULAR;
+	dma_init(strip->DMA);
+	dma_interrupt_enable(strip->DMA, DMA_EVENT_HALF_TRANSFER | DMA_EVENT_TRANSFER_COMPLETE | DMA_EVENT_ERROR, ws2812b_stream_callback, strip);
+
+	dma_start(strip->DMA, (uint32_t)(&strip->TIMER.TMR->CCR1 + strip->COMPARE.CHANNEL), (uint32_t)strip->BUFFER, (uint16_t)(2 * halfSlots));
+
+	strip->TIMER.TMR->DIER |= TIM_DIER_UDE;
+
+	return 0;
+}
+
+/*
+ * Function to return the interrupt timing of ws2812b_stream(),
+ * this is kept across frames so the worst case covers all of them
+ */
+WS2812B_STREAM_STATS ws2812b_stream_stats(WS2812B_STRIP* strip)
+{
+	return strip->STATS;
+}
+
+/*
+ * Function to encode the next LEDs of the frame into one half of the
+ * buffer, once the frame runs out the rest is filled with 0 duty
+ */
+void ws2812b_stream_fill(WS2812B_STRIP* strip, uint16_t* half)
+{
+	uint16_t leds = strip->LED_COUNT - strip->NEXT_LED;
+	uint16_t zeros;
+
+	if(leds > WS2812B_STREAM_HALF_LEDS)
+	{
+		leds = WS2812B_STREAM_HALF_LEDS;
+	}
+
+	//ws2812b_expand() always adds the reset slots after the LEDs, so
+	//the encoding is done here the same way, without them
+	for(uint16_t led = 0; led < leds; led++)
+	{
+		const WS2812B_COLOR* color = &strip->FRAME[strip->NEXT_LED + led];
+		uint32_t grb = ((uint32_t)color->G << 16) | ((uint32_t)color->R << 8) | color->B;
+
+		for(int bit = WS2812B_BITS_PER_LED - 1; bit >= 0; bit--)
+		{
+			*half++ = (grb & (1U << bit)) ? strip->TIMING.DUTY_1 : strip->TIMING.DUTY_0;
+		}
+	}
+
+	strip->NEXT_LED += leds;
+
+	zeros = (WS2812B_STREAM_HALF_LEDS - leds) * WS2812B_BITS_PER_LED;
+
+	for(uint16_t slot = 0; slot < zeros; slot++)
+	{
+		*half++ = 0;
+	}
+}
+
+/*
+ * Function called from the DMA interrupt each time a half has been sent
+ *
+ * The half that just finished is refilled. Once the frame is done, the
+ * halves are only 0's, and the stream is stopped after WS2812B_RESET_SLOTS
+ * of them have been sent, which is the same latch time as ws2812b_write()
+ */
+void ws2812b_stream_callback(void* context, uint32_t events)
+{
+	WS2812B_STRIP* strip = (WS2812B_STRIP*)context;
+	uint32_t halfSlots = WS2812B_STREAM_HALF_LEDS * WS2812B_BITS_PER_LED;
+	uint32_t start = cycles_now();
+	uint16_t* half;
+	uint32_t trailing;
+
+	if(events & DMA_EVENT_ERROR)
+	{
+		ws2812b_finish(strip);
+		return;
+	}
+
+	//both flags at once means the other half was missed as well
+	if((events & DMA_EVENT_HALF_TRANSFER) && (events & DMA_EVENT_TRANSFER_COMPLETE))
+	{
+		strip->STATS.LATE++;
+	}
+
+	half = (events & DMA_EVENT_TRANSFER_COMPLETE) ? strip->BUFFER + halfSlots : strip->BUFFER;
+
+	//a 0 value is only ever padding (an LED that is off still sends DUTY_0),
+	//so once the whole frame has been encoded, count how long the line has
+	//been low from the 0's at the end of the half that was just sent
+	if(strip->NEXT_LED == strip->LED_COUNT)
+	{
+		for(trailing = halfSlots; trailing > 0 && half[trailing - 1] == 0; trailing--);
+
+		trailing = halfSlots - trailing;
+
+		if(trailing == halfSlots)
+		{
+			strip->ZERO_SLOTS += halfSlots;
+		}
+		else
+		{
+			strip->ZERO_SLOTS = trailing;
+		}
+	}
+
+	if(strip->ZERO_SLOTS >= WS2812B_RESET_SLOTS)
+	{
+		ws2812b_finish(strip);
+	}
+	else
+	{
+		ws2812b_stream_fill(strip, half);
+	}
+
+	strip->STATS.LAST_CYCLES = cycles_elapsed(start);
+	strip->STATS.HALVES++;
+
+	if(strip->STATS.LAST_CYCLES > strip->STATS.MAX_CYCLES)
+	{
+		strip->STATS.MAX_CYCLES = strip->STATS.LAST_CYCLES;
+	}
+}
+
+/*
+ * Function to stop sending and leave the line low
+ *
+ * The update requests are turned off and the duty is set to 0 in case
+ * the stream stopped early on an error
+ */
+void ws2812b_finish(WS2812B_STRIP* strip)
+{
+	strip->TIMER.TMR->DIER &= ~TIM_DIER_UDE;
+	tim2_5_pwm_duty(strip->TIMER, strip->COMPARE, 0);
+
+	dma_stop(strip->DMA);
+	dma_interrupt_disable(strip->DMA);
+
+	strip->DMA.MODE = DMA_NORMAL;
+	strip->BUSY = 0;
+
+	if(strip->CALLBACK != NULL)
+	{
+		strip->CALLBACK(strip->CONTEXT);
+	}
+}
+
+/*
+ * Function to check if a frame is still being sent
+ */
+int ws2812b_busy(WS2812B_STRIP* strip)
+{
+	return strip->BUSY;
+}
+
+/*
+ * Function called from the DMA interrupt once a frame is done
+ *
+ * The update requests are turned off and the duty is set to 0 in case
+ * the stream stopped early on an error, so the line is left low
+ */
+void ws2812b_dma_callback(void* context, uint32_t events)
+{
+	WS2812B_STRIP* strip = (WS2812B_STRIP*)context;
+
+	strip->TIMER.TMR->DIER &= ~TIM_DIER_UDE;
+	tim2_5_pwm_duty(strip->TIMER, strip->COMPARE, 0);
+
+	dma_interrupt_disable(strip->DMA);
+
+	strip->BUSY = 0;
+
+	if(strip->CALLBACK != NULL)
+	{
+		strip->CALLBACK(strip->CONTEXT);
+	}
+}
+
+/*
+ * Function to transpose an 8x8 bit matrix held in two words, x holds
+ * rows 0-3 and y rows 4-7, most significant byte first. Afterwards
+ * row n holds what was column n. Three swap steps of 1, 2 and 4 bits,
+ * from 7-3 in Hacker's Delight (2nd ed.)
+ */
+void ws2812b_transpose8(uint32_t* x, uint32_t* y)
+{
+	uint32_t t;
+	uint32_t a = *x;
+	uint32_t b = *y;
+
+	t = (a ^ (a >> 7)) & 0x00AA00AA;
+	a = a ^ t ^ (t << 7);
+	t = (b ^ (b >> 7)) & 0x00AA00AA;
+	b = b ^ t ^ (t << 7);
+
+	t = (a ^ (a >> 14)) & 0x0000CCCC;
+	a = a ^ t ^ (t << 14);
+	t = (b ^ (b >> 14)) & 0x0000CCCC;
+	b = b ^ t ^ (t << 14);
+
+	t = (a & 0xF0F0F0F0) | ((b >> 4) & 0x0F0F0F0F);
+	b = ((a << 4) & 0xF0F0F0F0) | (b & 0x0F0F0F0F);
+
+	*x = t;
+	*y = b;
+}
+
+/*
+ * Function to turn one LED of every strip into the values written to
+ * the BSRR reset half for each of its 24 bits
+ *
+ * Value n has a 1 for every pin whose strip sends a 0 for bit n, so
+ * writing it ends the high time of the 0's early (0.4us) while the 1's
+ * stay high until all pins are reset (0.8us). Bits are in the same
+ * order as ws2812b_expand(), green then red then blue, MSB first.
+ *
+ * Each colour byte of 8 strips is packed into two words and transposed
+ * as an 8x8 bit matrix, so one pass of shifts/masks works on 32 bits at
+ * a time instead of pulling each bit out of each strip one by one.
+ *
+ * This doesn't touch any hardware, so it can run anywhere
+ */
+void ws2812b_transpose(const WS2812B_COLOR* const strips[WS2812B_PARALLEL_MAX_STRIPS], uint16_t led, uint16_t pinMask, uint16_t* out)
+{
+	//[colour][strips 0-7 / 8-15][x/y], colour is G, R, B
+	uint32_t words[3][2][2] = {{{0}}};
+	const WS2812B_COLOR* color;
+	uint32_t shift;
+
+	//strip s goes in row 7 - (s % 8), so after the transpose
+	//it ends up in bit s % 8 of every row
+	for(int s = 0; s < WS2812B_PARALLEL_MAX_STRIPS; s++)
+	{
+		if(strips[s] == NULL || !(pinMask & (1U << s)))
+		{
+			continue;
+		}
+
+		color = &strips[s][led];
+		shift = (s & 3) * 8;
+
+		words[0][s >> 3][(~s >> 2) & 1] |= (uint32_t)color->G << shift;
+		words[1][s >> 3][(~s >> 2) & 1] |= (uint32_t)color->R << shift;
+		words[2][s >> 3][(~s >> 2) & 1] |= (uint32_t)color->B << shift;
+	}
+
+	for(int c = 0; c < 3; c++)
+	{
+		ws2812b_transpose8(&words[c][0][0], &words[c][0][1]);
+		ws2812b_transpose8(&words[c][1][0], &words[c][1][1]);
+
+		//row n is bit 7 - n of the colour
+		for(int row = 0; row < 8; row++)
+		{
+			uint32_t rowShift = 24 - ((row & 3) * 8);
+			uint32_t low = (words[c][0][row >> 2] >> rowShift) & 0xFF;
+			uint32_t high = (words[c][1][row >> 2] >> rowShift) & 0xFF;
+
+			*out++ = (uint16_t)(~((high << 8) | low) & pinMask);
+		}
+	}
+}
+
+/*
+ * Function to set up parallel strips on one GPIO port
+ *
+ * Each bit slot needs three writes to the port's BSRR, all made by DMA:
+ *
+ * - the TIM1 update sets every strip's pin (start of the bit)
+ * - CC1 at DUTY_0 resets the pins of the strips sending a 0
+ * - CC2 at DUTY_1 resets every pin (the strips sending a 1)
+ *
+ * Only the middle write changes from slot to slot, the other two write
+ * PIN_MASK each time. The reset writes are half word writes to the upper
+ * half of BSRR (BRy), so the buffer only needs 16 bits per slot.
+ *
+ * GPIO is on AHB1, which only DMA2 can reach (DMA1's peripheral port is
+ * APB1 only, Figure 1 in Ref Manual), so the TIM2-5 requests (all on
+ * DMA1) can't be used. TIM1 is on DMA2:
+ *
+ * TIM1_UP  = DMA2 Stream5 Channel6
+ * TIM1_CH1 = DMA2 Stream3 Channel6
+ * TIM1_CH2 = DMA2 Stream2 Channel6 (same stream as USART1_RX)
+ *
+ * Table 28 in Ref Manual
+ *
+ * TIM1 is an advanced timer on APB2, tim2_5_init() only handles TIM2-5,
+ * so it is set up here. It has the same registers as TIM2-5 for
+ * everything used, so the rest of the TIM2_5_CONFIG functions work on it.
+ *
+ * Returns -1 if there are no pins, or TIM1 can't meet the bit timing
+ */
+int ws2812b_parallel_init(WS2812B_PARALLEL* parallel)
+{
+	GPIOx_PIN_CONFIG pin;
+	DMA_CONFIG dma = {DMA2, DMA_STREAM5, DMA_CH6, DMA_MEMORY_TO_PERIPH, DMA_SIZE_HALF_WORD, DMA_SIZE_HALF_WORD, DMA_PRIORITY_VERY_HIGH, DMA_NORMAL, 0};
+
+	if(parallel->PIN_MASK == 0 || ws2812b_timing(rcc_get_timclk2(), &parallel->TIMING) != 0)
+	{
+		return -1;
+	}
+
+	parallel->SET_DMA = dma;
+
+	dma.STREAM = DMA_STREAM3;
+	dma.MEM_INCREMENT = 1;
+	parallel->DATA_DMA = dma;
+
+	dma.STREAM = DMA_STREAM2;
+	dma.MEM_INCREMENT = 0;
+	parallel->RESET_DMA = dma;
+
+	parallel->CALLBACK = NULL;
+	parallel->CONTEXT = NULL;
+	parallel->BUSY = 0;
+
+	//every strip's pin as a push pull output, starting low
+	pin.PIN_MODE = GPIOx_PIN_OUTPUT;
+	pin.OTYPER_MODE = GPIOx_OTYPER_PUSH_PULL;
+	pin.PUPDR_MODE = GPIOx_PUPDR_NONE;
+	pin.ALT_FUNC = GPIOx_ALT_AF0;
+
+	for(int s = 0; s < WS2812B_PARALLEL_MAX_STRIPS; s++)
+	{
+		if(parallel->PIN_MASK & (1U << s))
+		{
+			pin.PIN_NUM = (GPIOx_PIN_NUM)s;
+			gpio_init(parallel->PORT, pin);
+		}
+	}
+
+	parallel->PORT->BSRR = (uint32_t)parallel->PIN_MASK << 16;
+
+	parallel->TIMER.TMR = TIM1;
+	parallel->TIMER.COUNTER_MODE = TIM2_5_UP;
+	parallel->TIMER.PRESCALER = 1;
+	parallel->TIMER.PERIOD = parallel->TIMING.PERIOD;
+
+	//TIM1 clock, 6.3.12 in Ref Manual
+	RCC->APB2ENR |= RCC_APB2ENR_TIM1EN;
+
+	//CC1/CC2 are left as frozen output compares, they only make DMA
+	//requests and aren't connected to any pins
+	//12.4 in Ref Manual
+	TIM1->CR1 = 0;
+	TIM1->CR2 = 0;
+	TIM1->CCMR1 = 0;
+	TIM1->PSC = parallel->TIMER.PRESCALER - 1;
+	TIM1->ARR = parallel->TIMER.PERIOD - 1;
+	TIM1->CCR1 = parallel->TIMING.DUTY_0;
+	TIM1->CCR2 = parallel->TIMING.DUTY_1;
+
+	tim2_5_generate_event(parallel->TIMER);
+	TIM1->SR = 0;
+
+	//the update interrupt is only used to time the reset latch
+	//Table 38 in Ref Manual
+	NVIC->ISER[0] |= (1U << TIM1_UP_TIM10_IRQn);
+
+	return 0;
+}
+
+/*
+ * Function to send a frame to each strip
+ *
+ * strips[n] is the frame for the strip on pin n, every strip is sent
+ * LED_COUNT LEDs, so shorter strips just get data past their end. Pins
+ * in PIN_MASK with a NULL frame are sent all 0's (off).
+ *
+ * The frames are transposed into BUFFER, so they can be changed as soon
+ * as this returns. The callback is run once the last bit has been sent
+ * and the lines have been held low for the reset latch.
+ *
+ * Returns -1 if the last frame is still being sent
+ */
+int ws2812b_parallel_write(WS2812B_PARALLEL* parallel, const WS2812B_COLOR* const strips[WS2812B_PARALLEL_MAX_STRIPS], WS2812B_CALLBACK callback, void* context)
+{
+	uint32_t count = WS2812B_PARALLEL_BUFFER_SIZE((uint32_t)parallel->LED_COUNT);
+	uint32_t bsrr = (uint32_t)&parallel->PORT->BSRR;
+
+	if(parallel->BUSY || count == 0 || count > 0xFFFF)
+	{
+		return -1;
+	}
+
+	parallel->BUSY = 1;
+	parallel->CALLBACK = callback;
+	parallel->CONTEXT = context;
+	parallelActive = parallel;
+
+	for(uint16_t led = 0; led < parallel->LED_COUNT; led++)
+	{
+		ws2812b_transpose(strips, led, parallel->PIN_MASK, parallel->BUFFER + (led * WS2812B_BITS_PER_LED));
+	}
+
+	dma_init(parallel->SET_DMA);
+	dma_init(parallel->DATA_DMA);
+	dma_init(parallel->RESET_DMA);
+
+	//the reset stream makes the last write of every slot, so it finishing means the frame is done
+	dma_interrupt_enable(parallel->RESET_DMA, DMA_EVENT_TRANSFER_COMPLETE | DMA_EVENT_ERROR, ws2812b_parallel_callback, parallel);
+	dma_interrupt_enable(parallel->DATA_DMA, DMA_EVENT_ERROR, ws2812b_parallel_callback, parallel);
+	dma_interrupt_enable(parallel->SET_DMA, DMA_EVENT_ERROR, ws2812b_parallel_callback, parallel);
+
+	//BSRR low half sets pins, high half (BSRR + 2) resets them
+	//8.4.7 in Ref Manual
+	dma_start(parallel->SET_DMA, bsrr, (uint32_t)&parallel->PIN_MASK, (uint16_t)count);
+	dma_start(parallel->DATA_DMA, bsrr + 2, (uint32_t)parallel->BUFFER, (uint16_t)count);
+	dma_start(parallel->RESET_DMA, bsrr + 2, (uint32_t)&parallel->PIN_MASK, (uint16_t)count);
+
+	//start one tick before the update, so the first request of
+	//the first slot is the update (set) and not CC1/CC2
+	TIM1->ARR = parallel->TIMER.PERIOD - 1;
+	TIM1->CNT = parallel->TIMER.PERIOD - 1;
+	TIM1->SR = 0;
+	TIM1->DIER = TIM_DIER_UDE | TIM_DIER_CC1DE | TIM_DIER_CC2DE;
+
+	tim2_5_enable(parallel->TIMER);
+
+	return 0;
+}
+
+/*
+ * Function to check if a parallel frame is still being sent
+ */
+int ws2812b_parallel_busy(WS2812B_PARALLEL* parallel)
+{
+	return parallel->BUSY;
+}
+
+/*
+ * Function called from the DMA interrupt once the last slot has been
+ * reset, or if any of the streams had an error
+ *
+ * The DMA requests are turned off, and TIM1 is reused in one pulse mode
+ * to time the reset latch, so the CPU only sees one more interrupt when
+ * it is over (TIM1 doesn't need to count bits anymore).
+ */
+void ws2812b_parallel_callback(void* context, uint32_t events)
+{
+	WS2812B_PARALLEL* parallel = (WS2812B_PARALLEL*)context;
+
+	tim2_5_disable(parallel->TIMER);
+	TIM1->DIER = 0;
+
+	dma_stop(parallel->SET_DMA);
+	dma_stop(parallel->DATA_DMA);
+	dma_stop(parallel->RESET_DMA);
+	dma_interrupt_disable(parallel->SET_DMA);
+	dma_interrupt_disable(parallel->DATA_DMA);
+	dma_interrupt_disable(parallel->RESET_DMA);
+
+	//the lines are already low, unless a stream stopped early
+	parallel->PORT->BSRR = (uint32_t)parallel->PIN_MASK << 16;
+
+	//WS2812B_RESET_SLOTS bit times, then one update with the counter
+	//stopping itself (OPM), 12.4.1 in Ref Manual
+	TIM1->CNT = 0;
+	TIM1->ARR = (parallel->TIMER.PERIOD * WS2812B_RESET_SLOTS) - 1;
+	TIM1->CR1 |= TIM_CR1_OPM;
+	TIM1->SR = 0;
+	TIM1->DIER = TIM_DIER_UIE;
+
+	tim2_5_enable(parallel->TIMER);
+}
+
+/*
+ * Function to stop the latch timer and report the frame as sent
+ */
+void ws2812b_parallel_stop(WS2812B_PARALLEL* parallel)
+{
+	TIM1->DIER = 0;
+	TIM1->CR1 &= ~(TIM_CR1_OPM | TIM_CR1_CEN);
+	TIM1->ARR = parallel->TIMER.PERIOD - 1;
+
+	parallel->BUSY = 0;
+
+	if(parallel->CALLBACK != NULL)
+	{
+		parallel->CALLBACK(parallel->CONTEXT);
+	}
+}
+
+/*
+ * Function to handle the TIM1 update interrupt, which is only
+ * enabled for the end of the reset latch
+ */
+void ws2812b_parallel_irq_handler(void)
+{
+	if(!(TIM1->SR & TIM_SR_UIF))
+	{
+		return;
+	}
+
+	TIM1->SR = ~TIM_SR_UIF;
+
+	if(parallelActive != NULL && (TIM1->DIER & TIM_DIER_UIE))
+	{
+		ws2812b_parallel_stop(parallelActive);
+	}
+}
@@ -0,0 +1,241 @@
+/**
+ ******************************************************************************
+ * @file           : ws2812b_anim.c
+ * @author         : Nubal Manhas
+ * @brief          : Main c file for WS2812B animation library
+ ******************************************************************************
+ * @purpose
+ *
+ * The purpose of this file is to define functions that will support
+ * running LED effects at a fixed frame rate on a WS2812B strip, for
+ * the STM32F01RE MCU
+ *
+ ******************************************************************************
+ */
+#include "ws2812b_anim.h"
+#include "dwt.h"
+#include "rcc.h"
+#include <stddef.h>
+#include <string.h>
+
+/*
+ * Function to set up an animation
+ *
+ * Both frames start off black, and nothing is drawn until
+ * an effect is given and the frame timer is started
+ */
+void ws2812b_anim_init(WS2812B_ANIM* anim, WS2812B_STRIP* strip, WS2812B_COLOR* front, WS2812B_COLOR* back, WS2812B_PIPELINE* pipeline, int stream)
+{
+	anim->STRIP = strip;
+	anim->FRAMES[0] = front;
+	anim->FRAMES[1] = back;
+	anim->PIPELINE = pipeline;
+	anim->EFFECT = NULL;
+	anim->CONTEXT = NULL;
+	anim->TIMER.TMR = NULL;
+	anim->STREAM = stream;
+	anim->BACK = 1;
+	anim->FIRST = 1;
+	anim->NUMBER = 0;
+	anim->TICKS = 0;
+	anim->STATS = (WS2812B_ANIM_STATS){0};
+
+	memset(front, 0, strip->LED_COUNT * sizeof(WS2812B_COLOR));
+	memset(back, 0, strip->LED_COUNT * sizeof(WS2812B_COLOR));
+}
+
+/*
+ * Function to change the effect, the next frame is always
+ * sent even if it matches the last one from the old effect
+ */
+void ws2812b_anim_effect(WS2812B_ANIM* anim, WS2812B_EFFECT effect, void* context)
+{
+	anim->EFFECT = effect;
+	anim->CONTEXT = context;
+	anim->NUMBER = 0;
+	anim->FIRST = 1;
+}
+
+/*
+ * Function to start the frame timer
+ *
+ * The timer counts at WS2812B_ANIM_TIMER_FREQ and makes an update
+ * interrupt every 1/fps seconds. The interrupt only counts the tick,
+ * the frame is drawn by ws2812b_anim_process() in the main loop, so
+ * main can sleep (__WFI()) in between frames instead of polling.
+ *
+ * Returns -1 if the timer can't count at WS2812B_ANIM_TIMER_FREQ,
+ * or the frame rate doesn't divide into it (60 FPS would give 166
+ * ticks, 60.24 FPS, and BUDGET_CYCLES would be off the same way).
+ * The period has to be at least 2 ticks, with 1 ARR would be 0 and
+ * the timer would never make an update event (13.3.2 in Ref Manual).
+ */
+int ws2812b_anim_start(WS2812B_ANIM* anim, TIM_TypeDef* TMR, uint32_t fps)
+{
+	TIM2_5_CONFIG timer;
+
+	timer.TMR = TMR;
+	timer.COUNTER_MODE = TIM2_5_UP;
+	timer.PRESCALER = tim2_5_prescaler(timer, WS2812B_ANIM_TIMER_FREQ);
+
+	if(timer.PRESCALER < 0 || fps == 0 || fps > WS2812B_ANIM_TIMER_FREQ / 2 || WS2812B_ANIM_TIMER_FREQ % fps != 0)
+	{
+		return -1;
+	}
+
+	timer.PERIOD = WS2812B_ANIM_TIMER_FREQ / fps;
+
+	anim->TIMER = timer;
+	anim->TICKS = 0;
+	anim->STATS.BUDGET_CYCLES = rcc_get_hclk() / fps;
+
+	dwt_init();
+
+	tim2_5_init(timer);
+
+	//load the prescaler now, then clear the flag the
+	//update event sets so it isn't counted as a frame
+	//13.3.1 in Ref Manual
+	tim2_5_generate_event(timer);
+	tim2_5_clear_interrupt_flag(timer, TIM2_5_UPDATE_INTERRUPT);
+
+	tim2_5_interrupt_enable(timer, TIM2_5_UPDATE_INTERRUPT);
+	tim2_5_enable(timer);
+
+	return 0;
+}
+
+/*
+ * Function to stop the frame timer, the frame being sent is finished
+ */
+void ws2812b_anim_stop(WS2812B_ANIM* anim)
+{
+	if(anim->TIMER.TMR == NULL)
+	{
+		return;
+	}
+
+	tim2_5_interrupt_disable(anim->TIMER, TIM2_5_UPDATE_INTERRUPT);
+	tim2_5_disable(anim->TIMER);
+}
+
+/*
+ * Function to count a frame tick from the timer's update interrupt
+ *
+ * If the last tick hasn't been handled yet, the frame
+ * for it is never going to be drawn, so it is dropped
+ */
+void ws2812b_anim_tick(WS2812B_ANIM* anim)
+{
+	if(!(anim->TIMER.TMR->SR & TIM_SR_UIF))
+	{
+		return;
+	}
+
+	tim2_5_clear_interrupt_flag(anim->TIMER, TIM2_5_UPDATE_INTERRUPT);
+
+	if(anim->TICKS > 0)
+	{
+		anim->STATS.DROPPED++;
+	}
+	else
+	{
+		anim->TICKS = 1;
+	}
+}
+
+/*
+ * Function to draw and send a frame, if a tick is waiting
+ *
+ * The effect draws into the back frame, which then goes through the
+ * colour pipeline. If the result is byte for byte the same as the front
+ * frame (the last one sent) nothing is sent, since the strip is already
+ * showing it. Otherwise it is sent and the two frames swap.
+ *
+ * With ws2812b_stream() the strip reads the frame while it is sent, so
+ * the front frame is never drawn into, the back one only becomes the
+ * front once it has been handed to the strip.
+ *
+ * If the strip is still sending the last frame when the tick comes in,
+ * the frame is dropped, since drawing it late would throw off the rate.
+ *
+ * Returns 1 if a frame was drawn, 0 if none was due
+ */
+int ws2812b_anim_process(WS2812B_ANIM* anim)
+{
+	WS2812B_COLOR* back;
+	WS2812B_COLOR* front;
+	uint16_t count = anim->STRIP->LED_COUNT;
+	uint32_t start;
+	uint32_t primask;
+
+	if(anim->TICKS == 0 || anim->EFFECT == NULL)
+	{
+		return 0;
+	}
+
+	anim->TICKS = 0;
+
+	if(ws2812b_busy(anim->STRIP))
+	{
+		//DROPPED is also counted from the timer interrupt
+		primask = __get_PRIMASK();
+		__disable_irq();
+		anim->STATS.DROPPED++;
+		__set_PRIMASK(primask);
+
+		return 0;
+	}
+
+	back = anim->FRAMES[anim->BACK];
+	front = anim->FRAMES[anim->BACK ^ 1];
+
+	start = cycles_now();
+
+	anim->EFFECT(back, count, anim->NUMBER, anim->CONTEXT);
+	anim->NUMBER++;
+
+	if(anim->PIPELINE != NULL)
+	{
+		ws2812b_color_apply(anim->PIPELINE, back, back, count);
+	}
+
+	anim->STATS.RENDERED++;
+
+	if(!anim->FIRST && memcmp(back, front, count * sizeof(WS2812B_COLOR)) == 0)
+	{
+		anim->STATS.SKIPPED++;
+	}
+	else
+	{
+		if(anim->STREAM)
+		{
+			ws2812b_stream(anim->STRIP, back, NULL, NULL);
+		}
+		else
+		{
+			ws2812b_write(anim->STRIP, back, NULL, NULL);
+		}
+
+		anim->STATS.SENT++;
+		anim->FIRST = 0;
+		anim->BACK ^= 1;
+	}
+
+	anim->STATS.LAST_CYCLES = cycles_elapsed(start);
+
+	if(anim->STATS.LAST_CYCLES > anim->STATS.MAX_CYCLES)
+	{
+		anim->STATS.MAX_CYCLES = anim->STATS.LAST_CYCLES;
+	}
+
+	return 1;
+}
+
+/*
+ * Function to return the animation counters
+ */
+WS2812B_ANIM_STATS ws2812b_anim_stats(WS2812B_ANIM* anim)
+{
+	return anim->STATS;
+}
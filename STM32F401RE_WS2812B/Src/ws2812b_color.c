@@ -0,0 +1,187 @@
+/**
+ ******************************************************************************
+ * @file           : ws2812b_color.c
+ * @author         : Nubal Manhas
+ * @brief          : Main c file for WS2812B colour pipeline library
+ ******************************************************************************
+ * @purpose
+ *
+ * The purpose of this file is to define functions that will support
+ * turning colours into what is sent to WS2812B LEDs (gamma, brightness,
+ * dithering) using only integer math, for the STM32F01RE MCU
+ *
+ ******************************************************************************
+ */
+#include "ws2812b_color.h"
+#include <string.h>
+
+/*
+ * Gamma table, 255 * 256 * (i / 255)^2.2 rounded
+ *
+ * The LEDs' PWM is linear, but eyes aren't, so without this the bottom
+ * of the range looks like big steps and the top looks washed out. The
+ * output keeps 8 fractional bits, so dim colours that would round to
+ * 0 or 1 can still be shown through dithering.
+ */
+const uint16_t WS2812B_GAMMA_TABLE[256] = {
+	    0,     0,     2,     4,     7,    11,    17,    24,
+	   32,    42,    53,    65,    78,    94,   110,   128,
+	  148,   169,   191,   216,   241,   269,   298,   328,
+	  360,   394,   430,   467,   506,   547,   589,   633,
+	  679,   726,   776,   827,   880,   934,   991,  1049,
+	 1109,  1171,  1235,  1300,  1368,  1437,  1508,  1581,
+	 1656,  1733,  1812,  1893,  1975,  2060,  2146,  2235,
+	 2325,  2417,  2512,  2608,  2706,  2806,  2908,  3013,
+	 3119,  3227,  3337,  3450,  3564,  3680,  3798,  3919,
+	 4041,  4166,  4292,  4421,  4552,  4685,  4819,  4956,
+	 5096,  5237,  5380,  5525,  5673,  5823,  5974,  6128,
+	 6284,  6442,  6603,  6765,  6930,  7097,  7266,  7437,
+	 7610,  7786,  7963,  8143,  8325,  8509,  8696,  8885,
+	 9075,  9268,  9464,  9661,  9861, 10063, 10267, 10474,
+	10682, 10893, 11107, 11322, 11540, 11760, 11982, 12207,
+	12433, 12663, 12894, 13128, 13363, 13602, 13842, 14085,
+	14330, 14578, 14827, 15080, 15334, 15591, 15850, 16111,
+	16375, 16641, 16909, 17180, 17453, 17729, 18006, 18287,
+	18569, 18854, 19141, 19431, 19723, 20017, 20314, 20613,
+	20915, 21218, 21525, 21833, 22144, 22458, 22774, 23092,
+	23413, 23736, 24062, 24390, 24720, 25053, 25388, 25726,
+	26066, 26408, 26753, 27101, 27451, 27803, 28158, 28515,
+	28875, 29237, 29602, 29969, 30338, 30710, 31085, 31462,
+	31841, 32223, 32608, 32995, 33384, 33776, 34170, 34567,
+	34967, 35369, 35773, 36180, 36589, 37001, 37416, 37833,
+	38252, 38674, 39099, 39526, 39956, 40388, 40823, 41260,
+	41700, 42142, 42587, 43034, 43484, 43937, 44392, 44849,
+	45310, 45772, 46238, 46706, 47176, 47649, 48125, 48603,
+	49084, 49567, 50053, 50542, 51033, 51526, 52023, 52522,
+	53023, 53527, 54034, 54543, 55055, 55570, 56087, 56607,
+	57129, 57654, 58182, 58712, 59245, 59780, 60318, 60859,
+	61402, 61948, 62497, 63048, 63602, 64159, 64718, 65280
+};
+
+/*
+ * Order the dither threshold moves through over 8 frames (bit reversed),
+ * so a value that needs to be rounded up k out of 8 frames is spread
+ * out over those frames instead of being on for k frames in a row
+ */
+static const uint8_t DITHER_SEQUENCE[8] = {0, 128, 64, 192, 32, 160, 96, 224};
+
+/*
+ * Function to set up a pipeline
+ */
+void ws2812b_color_init(WS2812B_PIPELINE* pipeline, uint8_t brightness, int dither)
+{
+	pipeline->DITHER = dither;
+	pipeline->FRAME = 0;
+
+	ws2812b_color_brightness(pipeline, brightness);
+}
+
+/*
+ * Function to change the brightness of a pipeline
+ *
+ * The gamma table and brightness are combined into one table, so each
+ * channel of each pixel only costs one lookup. This is the only place
+ * anything is multiplied (256 times), instead of for every pixel.
+ *
+ * Brightness 255 keeps the gamma table as it is and 0 is all black, the
+ * LUT is all 0 so not even dithering can round a channel up to 1.
+ */
+void ws2812b_color_brightness(WS2812B_PIPELINE* pipeline, uint8_t brightness)
+{
+	pipeline->BRIGHTNESS = brightness;
+
+	if(brightness == 0)
+	{
+		memset(pipeline->LUT, 0, sizeof(pipeline->LUT));
+		return;
+	}
+
+	for(int i = 0; i < 256; i++)
+	{
+		pipeline->LUT[i] = (uint16_t)((WS2812B_GAMMA_TABLE[i] * (uint32_t)brightness) / 255);
+	}
+}
+
+/*
+ * Function to convert HSV to a colour with integer math only
+ *
+ * The hue wheel is split into 6 regions (red-yellow-green-cyan-blue-
+ * magenta) of 43 steps each. Within a region one channel is at value, one
+ * at the bottom (p) and the last one ramps up (t) or down (q) across it.
+ *
+ * The result is linear, it still has to go through ws2812b_color_apply()
+ */
+WS2812B_COLOR ws2812b_hsv(uint8_t hue, uint8_t saturation, uint8_t value)
+{
+	WS2812B_COLOR color;
+	uint32_t region, remainder, p, q, t;
+
+	if(saturation == 0)
+	{
+		color.R = value;
+		color.G = value;
+		color.B = value;
+		return color;
+	}
+
+	region = hue / WS2812B_HUE_REGION;
+	remainder = (hue - (region * WS2812B_HUE_REGION)) * 6;
+
+	p = (value * (255 - saturation)) >> 8;
+	q = (value * (255 - ((saturation * remainder) >> 8))) >> 8;
+	t = (value * (255 - ((saturation * (255 - remainder)) >> 8))) >> 8;
+
+	switch(region)
+	{
+		case 0:
+			color.R = value; color.G = t; color.B = p;
+			break;
+		case 1:
+			color.R = q; color.G = value; color.B = p;
+			break;
+		case 2:
+			color.R = p; color.G = value; color.B = t;
+			break;
+		case 3:
+			color.R = p; color.G = q; color.B = value;
+			break;
+		case 4:
+			color.R = t; color.G = p; color.B = value;
+			break;
+		default:
+			color.R = value; color.G = p; color.B = q;
+			break;
+	}
+
+	return color;
+}
+
+/*
+ * Function to run a frame through gamma, brightness and dithering
+ *
+ * Without dithering each channel is the top 8 bits of its LUT entry.
+ * With dithering a threshold from DITHER_SEQUENCE is added before the
+ * fraction is dropped, so a channel at 2.25 is sent as 3 in 2 of every
+ * 8 frames and as 2 in the rest, which averages out to 2.25. This only
+ * works if frames are sent continuously (a few hundred per second), and
+ * moves to the next threshold every call.
+ */
+void ws2812b_color_apply(WS2812B_PIPELINE* pipeline, const WS2812B_COLOR* in, WS2812B_COLOR* out, uint16_t count)
+{
+	const uint16_t* lut = pipeline->LUT;
+	uint32_t dither = 0;
+
+	if(pipeline->DITHER)
+	{
+		dither = DITHER_SEQUENCE[pipeline->FRAME & 7];
+		pipeline->FRAME++;
+	}
+
+	//LUT values top out at 255.0, so adding under 1.0 can't go past 255
+	for(uint16_t i = 0; i < count; i++)
+	{
+		out[i].R = (uint8_t)((lut[in[i].R] + dither) >> 8);
+		out[i].G = (uint8_t)((lut[in[i].G] + dither) >> 8);
+		out[i].B = (uint8_t)((lut[in[i].B] + dither) >> 8);
+	}
+}